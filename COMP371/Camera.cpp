@@ -71,6 +71,29 @@ glm::vec3 Camera::upDirection() const
 	return up;
 }
 
+glm::vec3 Camera::getPosition() const
+{
+	return position;
+}
+
+float Camera::getYaw() const
+{
+	return yaw;
+}
+
+float Camera::getPitch() const
+{
+	return pitch;
+}
+
+void Camera::setState(glm::vec3 Position, float Yaw, float Pitch)
+{
+	position = Position;
+	yaw = Yaw;
+	pitch = Pitch;
+	updateCameraOrientation();
+}
+
 void Camera::reset()
 {
 	position = startPosition;
@@ -28,6 +28,12 @@ public:
 	glm::vec3 rightDirection() const;
 	glm::vec3 upDirection() const;
 
+	// Raw state, used to record and replay camera paths
+	glm::vec3 getPosition() const;
+	float getYaw() const;
+	float getPitch() const;
+	void setState(glm::vec3 Position, float Yaw, float Pitch);
+
 	void reset();
 };
 
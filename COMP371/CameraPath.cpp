@@ -0,0 +1,84 @@
+#include "CameraPath.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+void CameraPath::addEvent(const std::string& event)
+{
+	pendingEvents.push_back(event);
+}
+
+void CameraPath::addFrame(glm::vec3 position, float yaw, float pitch, float scale)
+{
+	Frame frame;
+	frame.position = position;
+	frame.yaw = yaw;
+	frame.pitch = pitch;
+	frame.scale = scale;
+	frame.events.swap(pendingEvents);
+	frames.push_back(frame);
+}
+
+bool CameraPath::load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		std::cout << "Camera path failed to load at path: " << path << std::endl;
+		return false;
+	}
+
+	frames.clear();
+	pendingEvents.clear();
+
+	std::string line;
+	while (getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string type;
+		stream >> type;
+
+		if (type == "frame")
+		{
+			glm::vec3 position;
+			float yaw, pitch, scale;
+			if (stream >> position.x >> position.y >> position.z >> yaw >> pitch >> scale)
+				addFrame(position, yaw, pitch, scale);
+		}
+		else if (type == "event")
+		{
+			std::string event;
+			getline(stream >> std::ws, event);
+			addEvent(event);
+		}
+	}
+	return !frames.empty();
+}
+
+bool CameraPath::save(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	file.precision(9); // round-trips floats exactly
+	for (const Frame& frame : frames)
+	{
+		for (const std::string& event : frame.events)
+			file << "event " << event << "\n";
+		file << "frame " << frame.position.x << " " << frame.position.y << " " << frame.position.z << " "
+			<< frame.yaw << " " << frame.pitch << " " << frame.scale << "\n";
+	}
+	return file.good();
+}
+
+size_t CameraPath::size() const
+{
+	return frames.size();
+}
+
+const CameraPath::Frame& CameraPath::frame(size_t index) const
+{
+	return frames[index];
+}
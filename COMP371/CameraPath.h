@@ -0,0 +1,38 @@
+#pragma once
+#include "glm.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * A recorded flight: the camera state of every frame plus the terrain-state events (skip size, step size,
+ * Catmull-Rom passes, draw mode...) that happened during it, so a run can be replayed frame for frame.
+ *
+ * Text format, one line per entry:
+ *	frame <px> <py> <pz> <yaw> <pitch> <scale>
+ *	event <command>		(applies to the next frame line)
+ */
+class CameraPath
+{
+public:
+	struct Frame
+	{
+		glm::vec3 position;
+		float yaw, pitch;
+		float scale;
+		std::vector<std::string> events; // applied before this frame is rendered
+	};
+
+	void addEvent(const std::string& event);
+	void addFrame(glm::vec3 position, float yaw, float pitch, float scale);
+
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+
+	size_t size() const;
+	const Frame& frame(size_t index) const;
+
+private:
+	std::vector<Frame> frames;
+	std::vector<std::string> pendingEvents;
+};
@@ -0,0 +1,30 @@
+#include "CameraUniforms.h"
+
+const char* CameraUniforms::BLOCK_NAME = "Camera";
+
+CameraUniforms::CameraUniforms()
+{
+}
+
+void CameraUniforms::init()
+{
+	glGenBuffers(1, &UBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Every program binds its Camera block to the same point, so this buffer is shared by all of them
+	glBindBufferBase(GL_UNIFORM_BUFFER, BINDING_POINT, UBO);
+}
+
+void CameraUniforms::update(const glm::mat4 &view, const glm::mat4 &projection)
+{
+	Block block;
+	block.view = view;
+	block.projection = projection;
+	block.viewProjection = projection * view;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <glew.h>
+#include "glm.hpp"
+
+/**
+ * Per-frame camera data shared by every shader through a std140 uniform block:
+ *
+ *	layout(std140) uniform Camera { mat4 view; mat4 projection; mat4 viewProjection; };
+ *
+ * Updated once per frame instead of setting the matrices on each program and draw.
+ */
+class CameraUniforms
+{
+public:
+	static const GLuint BINDING_POINT = 0;
+	static const char* BLOCK_NAME;
+
+	CameraUniforms();
+	void init();
+	void update(const glm::mat4 &view, const glm::mat4 &projection);
+
+private:
+	// Mirrors the std140 layout of the Camera block (mat4 members are tightly packed)
+	struct Block
+	{
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::mat4 viewProjection;
+	};
+
+	GLuint UBO = 0;
+};
@@ -0,0 +1,312 @@
+#include "CompressedHeights.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMPRESSED_HEIGHTS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Tiles decoded per thread and kept for the next reads
+static const int CACHED_TILES = 8;
+// The width bytes of a tile's rows, 4 to a word, follow its base value
+static const int HEADER_WORDS = 1 + CompressedHeights::TILE_SIZE / 4;
+
+static std::atomic<uint64_t> nextId(1);
+
+// Integer of the same order as the float: negative floats reversed below the positive ones
+static uint32_t toOrdered(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+#ifndef COMPRESSED_HEIGHTS_SSE2
+static float fromOrdered(uint32_t value)
+{
+	uint32_t bits = value & 0x80000000u ? value & 0x7FFFFFFFu : ~value;
+	float height;
+	memcpy(&height, &bits, sizeof(height));
+	return height;
+}
+#endif
+
+// Words of one lane of a packed row: 16 values of bits bits
+static int laneWords(int bits)
+{
+	return (bits + 1) / 2;
+}
+
+// Value i of a row goes to lane i % 4, at position i / 4 of that lane's bit stream
+static void packRow(const uint32_t* values, int bits, uint32_t* out)
+{
+	for (int i = 0; i < CompressedHeights::TILE_SIZE; i++)
+	{
+		int offset = (i >> 2) * bits, shift = offset & 31;
+		uint32_t* word = out + 4 * (offset >> 5) + (i & 3);
+		word[0] |= values[i] << shift;
+		if (shift + bits > 32)
+			word[4] |= values[i] >> (32 - shift);
+	}
+}
+
+/**
+ * Decodes one packed row; up holds the ordered heights of the row above and is left with those of this row.
+ * Each group of 4 residuals is unpacked, unzigzagged and summed along the row (two shifted adds and the carry of
+ * the previous group), which gives this row minus the row above.
+ */
+static void decodeRow(const uint32_t* packed, int bits, uint32_t* up, float* out)
+{
+#ifdef COMPRESSED_HEIGHTS_SSE2
+	const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : int((1u << bits) - 1));
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i allOnes = _mm_set1_epi32(-1);
+	const __m128i sign = _mm_set1_epi32(int(0x80000000u));
+	__m128i carry = _mm_setzero_si128();
+	for (int group = 0; group < CompressedHeights::TILE_SIZE / 4; group++)
+	{
+		__m128i residual = _mm_setzero_si128();
+		if (bits > 0)
+		{
+			int offset = group * bits, shift = offset & 31;
+			const __m128i* word = (const __m128i*)(packed + 4 * (offset >> 5));
+			__m128i value = _mm_srl_epi32(_mm_loadu_si128(word), _mm_cvtsi32_si128(shift));
+			if (shift + bits > 32)
+				value = _mm_or_si128(value, _mm_sll_epi32(_mm_loadu_si128(word + 1), _mm_cvtsi32_si128(32 - shift)));
+			value = _mm_and_si128(value, mask);
+			residual = _mm_xor_si128(_mm_srli_epi32(value, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(value, one)));
+		}
+		residual = _mm_add_epi32(residual, _mm_slli_si128(residual, 4));
+		residual = _mm_add_epi32(residual, _mm_slli_si128(residual, 8));
+		__m128i delta = _mm_add_epi32(residual, carry);
+		carry = _mm_shuffle_epi32(delta, _MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i ordered = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(up + 4 * group)), delta);
+		_mm_storeu_si128((__m128i*)(up + 4 * group), ordered);
+		__m128i negative = _mm_srai_epi32(ordered, 31);
+		__m128i heights = _mm_xor_si128(ordered, _mm_or_si128(_mm_xor_si128(negative, allOnes), sign));
+		_mm_storeu_ps(out + 4 * group, _mm_castsi128_ps(heights));
+	}
+#else
+	uint32_t delta = 0;
+	for (int i = 0; i < CompressedHeights::TILE_SIZE; i++)
+	{
+		uint32_t value = 0;
+		if (bits > 0)
+		{
+			int offset = (i >> 2) * bits, shift = offset & 31;
+			const uint32_t* word = packed + 4 * (offset >> 5) + (i & 3);
+			uint64_t pair = word[0] >> shift;
+			if (shift + bits > 32)
+				pair |= uint64_t(word[4]) << (32 - shift);
+			value = uint32_t(pair) & (bits == 32 ? 0xFFFFFFFFu : (1u << bits) - 1);
+		}
+		delta += (value >> 1) ^ (0u - (value & 1));
+		up[i] += delta;
+		out[i] = fromOrdered(up[i]);
+	}
+#endif
+}
+
+// Compressed words of the tile whose texel (0, 0) is at source, with lastX, lastZ the last texels inside the grid
+static void encodeTile(const float* source, int rowStride, int texelStride, int lastX, int lastZ, std::vector<uint32_t>& out)
+{
+	const int size = CompressedHeights::TILE_SIZE;
+	uint32_t up[CompressedHeights::TILE_SIZE], row[CompressedHeights::TILE_SIZE], residuals[CompressedHeights::TILE_SIZE];
+	uint32_t base = toOrdered(source[0]);
+	std::fill(up, up + size, base);
+
+	size_t header = out.size();
+	out.resize(header + HEADER_WORDS, 0);
+	out[header] = base;
+	for (int dz = 0; dz < size; dz++)
+	{
+		// The padding repeats the last row and column
+		const float* sourceRow = source + size_t(std::min(dz, lastZ)) * rowStride;
+		uint32_t largest = 0, previous = 0;
+		for (int dx = 0; dx < size; dx++)
+		{
+			row[dx] = toOrdered(sourceRow[size_t(std::min(dx, lastX)) * texelStride]);
+			uint32_t delta = row[dx] - up[dx];
+			int32_t residual = int32_t(delta - previous);
+			previous = delta;
+			residuals[dx] = (uint32_t(residual) << 1) ^ uint32_t(residual >> 31);
+			largest |= residuals[dx];
+		}
+		int bits = 0;
+		while (bits < 32 && (largest >> bits) != 0) bits++;
+
+		out[header + 1 + dz / 4] |= uint32_t(bits) << (8 * (dz % 4));
+		size_t rowStart = out.size();
+		out.resize(rowStart + 4 * laneWords(bits), 0);
+		packRow(residuals, bits, &out[rowStart]);
+		std::copy(row, row + size, up);
+	}
+}
+
+CompressedHeights::CompressedHeights() : width(0), height(0), tilesX(0), tilesZ(0), id(0)
+{
+}
+
+CompressedHeights CompressedHeights::fromRows(const float* source, int width, int height, int rowStride, int texelStride)
+{
+	CompressedHeights grid;
+	grid.width = width;
+	grid.height = height;
+	grid.tilesX = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+	grid.tilesZ = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+	grid.id = nextId++;
+
+	// Rows of tiles are compressed in parallel, then put together in order
+	std::vector<std::vector<uint32_t>> tileRows(grid.tilesZ);
+	std::vector<std::vector<size_t>> rowOffsets(grid.tilesZ);
+	parallelFor(grid.tilesZ, [&](int begin, int end)
+	{
+		for (int tz = begin; tz < end; tz++)
+		{
+			int z0 = tz << TILE_SHIFT;
+			for (int tx = 0; tx < grid.tilesX; tx++)
+			{
+				int x0 = tx << TILE_SHIFT;
+				rowOffsets[tz].push_back(tileRows[tz].size());
+				encodeTile(source + size_t(z0) * rowStride + size_t(x0) * texelStride, rowStride, texelStride,
+					width - 1 - x0, height - 1 - z0, tileRows[tz]);
+			}
+			tileRows[tz].shrink_to_fit();
+		}
+	});
+
+	size_t total = 0;
+	for (const std::vector<uint32_t>& tileRow : tileRows)
+		total += tileRow.size();
+	grid.words.reserve(total);
+	grid.tileOffsets.reserve(size_t(grid.tilesX) * grid.tilesZ + 1);
+	for (int tz = 0; tz < grid.tilesZ; tz++)
+	{
+		for (size_t offset : rowOffsets[tz])
+			grid.tileOffsets.push_back(grid.words.size() + offset);
+		grid.words.insert(grid.words.end(), tileRows[tz].begin(), tileRows[tz].end());
+		std::vector<uint32_t>().swap(tileRows[tz]);
+	}
+	grid.tileOffsets.push_back(grid.words.size());
+	return grid;
+}
+
+int CompressedHeights::getWidth() const
+{
+	return width;
+}
+
+int CompressedHeights::getHeight() const
+{
+	return height;
+}
+
+bool CompressedHeights::empty() const
+{
+	return words.empty();
+}
+
+size_t CompressedHeights::getMemoryBytes() const
+{
+	return words.capacity() * sizeof(uint32_t) + tileOffsets.capacity() * sizeof(size_t);
+}
+
+const void* CompressedHeights::getData() const
+{
+	return words.data();
+}
+
+void CompressedHeights::decodeTile(int tileX, int tileZ, float* out) const
+{
+	const uint32_t* tile = &words[tileOffsets[size_t(tileZ) * tilesX + tileX]];
+	const uint32_t* packed = tile + HEADER_WORDS;
+	uint32_t up[TILE_SIZE];
+	std::fill(up, up + TILE_SIZE, tile[0]);
+	for (int dz = 0; dz < TILE_SIZE; dz++)
+	{
+		int bits = (tile[1 + dz / 4] >> (8 * (dz % 4))) & 0xFF;
+		decodeRow(packed, bits, up, out + dz * TILE_SIZE);
+		packed += 4 * laneWords(bits);
+	}
+}
+
+// Recently decoded tiles of one thread, the least recently used replaced first
+struct DecodedTileCache
+{
+	struct Entry
+	{
+		uint64_t owner = 0;
+		size_t tile = 0;
+		unsigned lastUse = 0;
+		float heights[CompressedHeights::TILE_TEXELS];
+	};
+	std::unique_ptr<Entry[]> entries;
+	unsigned uses = 0;
+};
+
+const float* CompressedHeights::cachedTile(int tileX, int tileZ) const
+{
+	static thread_local DecodedTileCache cache;
+	if (!cache.entries)
+		cache.entries.reset(new DecodedTileCache::Entry[CACHED_TILES]);
+
+	size_t tile = size_t(tileZ) * tilesX + tileX;
+	DecodedTileCache::Entry* oldest = &cache.entries[0];
+	for (int i = 0; i < CACHED_TILES; i++)
+	{
+		DecodedTileCache::Entry& entry = cache.entries[i];
+		if (entry.owner == id && entry.tile == tile)
+		{
+			entry.lastUse = ++cache.uses;
+			return entry.heights;
+		}
+		if (entry.lastUse < oldest->lastUse)
+			oldest = &entry;
+	}
+	decodeTile(tileX, tileZ, oldest->heights);
+	oldest->owner = id;
+	oldest->tile = tile;
+	oldest->lastUse = ++cache.uses;
+	return oldest->heights;
+}
+
+void CompressedHeights::readBlock(int x, int z, int w, int h, float* out, int outStride, int outTexelStride) const
+{
+	for (int tz = z >> TILE_SHIFT; (tz << TILE_SHIFT) < z + h; tz++)
+	{
+		int rowBegin = std::max(z, tz << TILE_SHIFT), rowEnd = std::min(z + h, (tz + 1) << TILE_SHIFT);
+		for (int tx = x >> TILE_SHIFT; (tx << TILE_SHIFT) < x + w; tx++)
+		{
+			int colBegin = std::max(x, tx << TILE_SHIFT), colEnd = std::min(x + w, (tx + 1) << TILE_SHIFT);
+			const float* tile = cachedTile(tx, tz);
+			for (int row = rowBegin; row < rowEnd; row++)
+			{
+				const float* texel = tile + ((row & (TILE_SIZE - 1)) << TILE_SHIFT) + (colBegin & (TILE_SIZE - 1));
+				float* target = out + size_t(row - z) * outStride + size_t(colBegin - x) * outTexelStride;
+				if (outTexelStride == 1)
+					std::copy(texel, texel + (colEnd - colBegin), target);
+				else
+				{
+					for (int col = colBegin; col < colEnd; col++, target += outTexelStride)
+						*target = *texel++;
+				}
+			}
+		}
+	}
+}
+
+void CompressedHeights::toRows(float* out, int outStride, int outTexelStride) const
+{
+	// A band of one row of tiles per task, so every tile is decoded once
+	parallelFor(tilesZ, [&](int begin, int end)
+	{
+		int z0 = begin << TILE_SHIFT, z1 = std::min(height, end << TILE_SHIFT);
+		readBlock(0, z0, width, z1 - z0, out + size_t(z0) * outStride, outStride, outTexelStride);
+	});
+}
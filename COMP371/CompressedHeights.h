@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Height grid held losslessly compressed in 64x64 tiles, for grids that stay resident but are rarely read whole.
+ *
+ * Each float is mapped to an integer of the same order (so nearby heights are nearby integers) and predicted from
+ * its neighbours with the gradient predictor left + up - upLeft. The residuals of a tile row are zigzag coded and
+ * bit-packed at the width of the largest one, 4 interleaved lanes of 16 values, so a row decodes 4 texels at a
+ * time with SSE2: unpack, a prefix sum along the row (which undoes left - upLeft) and the row above. A tile of one
+ * height is a few words. Reading a region decodes its tiles on demand into a small cache of recently used tiles
+ * per thread, so threads never wait on each other and neighbouring reads reuse the decoded tiles.
+ */
+class CompressedHeights
+{
+public:
+	static const int TILE_SHIFT = 6;
+	static const int TILE_SIZE = 1 << TILE_SHIFT;
+	static const int TILE_TEXELS = TILE_SIZE * TILE_SIZE;
+
+	CompressedHeights();
+
+	// Heights (x, z) at source[z * rowStride + x * texelStride], e.g. the y of xyz vertices with texelStride 3
+	static CompressedHeights fromRows(const float* source, int width, int height, int rowStride, int texelStride = 1);
+
+	int getWidth() const;
+	int getHeight() const;
+	bool empty() const;
+	size_t getMemoryBytes() const; // compressed tiles and their offsets
+	const void* getData() const;
+
+	// The w x h block at (x, z) to out[row * outStride + col * outTexelStride]
+	void readBlock(int x, int z, int w, int h, float* out, int outStride, int outTexelStride = 1) const;
+	void toRows(float* out, int outStride, int outTexelStride = 1) const;
+
+	// One whole tile, TILE_SIZE rows of TILE_SIZE floats (the padding repeats the last row and column), uncached
+	void decodeTile(int tileX, int tileZ, float* out) const;
+
+private:
+	int width, height;
+	int tilesX, tilesZ;
+	uint64_t id; // tells the tiles of this grid apart in the thread caches
+	std::vector<uint32_t> words;
+	std::vector<size_t> tileOffsets; // first word of each tile, and the end
+
+	// The decoded tile from this thread's cache, decoding it on a miss
+	const float* cachedTile(int tileX, int tileZ) const;
+};
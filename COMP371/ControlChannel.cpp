@@ -0,0 +1,228 @@
+#include "ControlChannel.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+// AF_UNIX sockets exist on Windows 10 1803 and later, and afunix.h in the Windows 10 SDK 10.0.17063 and later;
+// older SDKs (the project's 8.1 included) build without the socket and only read the console
+#include <winsock2.h>
+#if defined(__has_include)
+#if __has_include(<afunix.h>)
+#include <afunix.h>
+#define CONTROL_SOCKET
+#endif
+#endif
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET SocketHandle;
+#define pollSockets WSAPoll
+static void closeSocket(SocketHandle socket) { closesocket(socket); }
+static void removeSocketFile(const std::string& path) { DeleteFileA(path.c_str()); }
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CONTROL_SOCKET
+typedef int SocketHandle;
+#define pollSockets ::poll
+static void closeSocket(SocketHandle socket) { close(socket); }
+static void removeSocketFile(const std::string& path) { unlink(path.c_str()); }
+#endif
+
+// A client gone before its reply must not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+// How long the socket thread waits for input before checking whether it should stop
+static const int SOCKET_POLL_MS = 100;
+// Longest command line a client may send; longer lines close the connection
+static const size_t MAX_LINE_LENGTH = 4096;
+
+ControlChannel::~ControlChannel()
+{
+	stop();
+}
+
+bool ControlChannel::start(const std::string& path)
+{
+	if (!consoleStarted)
+	{
+		// getline cannot be interrupted, so the thread is left to end with the process and only holds the queue
+		std::shared_ptr<Queue> commands = queue;
+		std::thread([commands]
+		{
+			std::string line;
+			while (std::getline(std::cin, line))
+				commands->push(Command{ line, -1 });
+		}).detach();
+		consoleStarted = true;
+	}
+	if (path.empty() || listener != -1) return true;
+
+#ifndef CONTROL_SOCKET
+	std::cout << "This build has no control socket (it needs the Windows 10 SDK 10.0.17063 or later), "
+		"commands are read from the console only" << std::endl;
+	return false;
+#else
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return false;
+#endif
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Control socket path too long: " << path << std::endl;
+		return false;
+	}
+	path.copy(address.sun_path, path.size());
+
+	// A socket file left by an earlier run would make bind fail
+	removeSocketFile(path);
+	SocketHandle socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (socket == (SocketHandle)-1 || bind(socket, (const sockaddr*)&address, sizeof(address)) != 0 || listen(socket, 4) != 0)
+	{
+		std::cout << "Failed to open the control socket " << path << std::endl;
+		if (socket != (SocketHandle)-1) closeSocket(socket);
+		return false;
+	}
+
+	socketPath = path;
+	listener = (long long)socket;
+	stopping = false;
+	socketThread = std::thread(&ControlChannel::socketLoop, this);
+	return true;
+#endif
+}
+
+void ControlChannel::stop()
+{
+	setWakeCallback(nullptr);
+	if (!socketThread.joinable()) return;
+
+	stopping = true;
+	socketThread.join();
+	closeSockets();
+	removeSocketFile(socketPath);
+}
+
+void ControlChannel::poll(std::vector<Command>& commands)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	commands.insert(commands.end(), queue->commands.begin(), queue->commands.end());
+	queue->commands.clear();
+}
+
+void ControlChannel::reply(const Command& command, const std::string& text)
+{
+	if (command.client < 0)
+	{
+		std::cout << text << std::endl;
+		return;
+	}
+
+	// The client may have disconnected since it sent the command
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	auto client = clients.find(command.client);
+	if (client == clients.end()) return;
+	std::string line = text + "\n";
+	send((SocketHandle)client->second, line.data(), (int)line.size(), SEND_FLAGS);
+}
+
+void ControlChannel::setWakeCallback(const std::function<void()>& wake)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	queue->wake = wake;
+}
+
+void ControlChannel::Queue::push(const Command& command)
+{
+	std::function<void()> callback;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		commands.push_back(command);
+		callback = wake;
+	}
+	if (callback)
+		callback();
+}
+
+void ControlChannel::socketLoop()
+{
+	std::map<int, std::string> partialLines; // input after the last newline of each client
+	while (!stopping)
+	{
+		std::vector<pollfd> sockets(1);
+		std::vector<int> ids(1, -1);
+		sockets[0].fd = (SocketHandle)listener;
+		sockets[0].events = POLLIN;
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			for (const auto& client : clients)
+			{
+				pollfd entry = {};
+				entry.fd = (SocketHandle)client.second;
+				entry.events = POLLIN;
+				sockets.push_back(entry);
+				ids.push_back(client.first);
+			}
+		}
+		if (pollSockets(sockets.data(), (unsigned)sockets.size(), SOCKET_POLL_MS) <= 0) continue;
+
+		if (sockets[0].revents & POLLIN)
+		{
+			SocketHandle connection = accept((SocketHandle)listener, nullptr, nullptr);
+			if (connection != (SocketHandle)-1)
+			{
+				std::lock_guard<std::mutex> lock(clientsMutex);
+				clients[nextClient++] = (long long)connection;
+			}
+		}
+
+		for (size_t i = 1; i < sockets.size(); i++)
+		{
+			if (!sockets[i].revents) continue;
+
+			char buffer[1024];
+			int received = recv(sockets[i].fd, buffer, sizeof(buffer), 0);
+			std::string& pending = partialLines[ids[i]];
+			if (received > 0)
+				pending.append(buffer, received);
+
+			// Queue every complete line, dropping the carriage return of CRLF clients
+			size_t newline;
+			while ((newline = pending.find('\n')) != std::string::npos)
+			{
+				std::string line = pending.substr(0, newline);
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				pending.erase(0, newline + 1);
+				queue->push(Command{ line, ids[i] });
+			}
+
+			if (received <= 0 || pending.size() > MAX_LINE_LENGTH)
+			{
+				std::lock_guard<std::mutex> lock(clientsMutex);
+				closeSocket(sockets[i].fd);
+				clients.erase(ids[i]);
+				partialLines.erase(ids[i]);
+			}
+		}
+	}
+}
+
+void ControlChannel::closeSockets()
+{
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	for (const auto& client : clients)
+		closeSocket((SocketHandle)client.second);
+	clients.clear();
+	closeSocket((SocketHandle)listener);
+	listener = -1;
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
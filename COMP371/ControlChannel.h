@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Line based commands from the console and from a local (Unix domain) socket, read on threads of their own and
+ * queued for the render loop, which takes them with poll and never blocks on input. Replies go back to where the
+ * command came from: the console prints them, a socket client receives them as lines.
+ *
+ * Any number of clients can connect to the socket, e.g. "socat - UNIX-CONNECT:comp371.sock".
+ */
+class ControlChannel
+{
+public:
+	struct Command
+	{
+		std::string line;
+		int client; // socket connection that sent it, -1 for the console
+	};
+
+	~ControlChannel();
+
+	// Starts reading the console, and the socket at socketPath unless it is empty. Returns false if the socket
+	// could not be opened; the console is read either way.
+	bool start(const std::string& socketPath);
+	void stop();
+
+	// Moves the commands received since the last call to commands, oldest first
+	void poll(std::vector<Command>& commands);
+	void reply(const Command& command, const std::string& text);
+	// Called on the reading threads after each command is queued, e.g. to wake a render loop waiting for events
+	void setWakeCallback(const std::function<void()>& wake);
+
+private:
+	// Shared with the console thread, which stays blocked in getline until the process exits
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Command> commands;
+		std::function<void()> wake;
+
+		void push(const Command& command);
+	};
+	std::shared_ptr<Queue> queue = std::make_shared<Queue>();
+	bool consoleStarted = false;
+
+	std::string socketPath;
+	long long listener = -1; // listening socket, -1 when closed
+	std::thread socketThread;
+	std::atomic<bool> stopping{ false };
+	std::mutex clientsMutex;
+	std::map<int, long long> clients; // connection id to socket
+	int nextClient = 0;
+
+	void socketLoop();
+	void closeSockets();
+};
@@ -0,0 +1,189 @@
+#include "DisplacedTerrain.h"
+
+DisplacedTerrain::DisplacedTerrain()
+{
+}
+
+void DisplacedTerrain::init(const Terrain& terrain)
+{
+	originalWidth = terrain.getOriginalWidth();
+	originalHeight = terrain.getOriginalHeight();
+
+	// Heights are uploaded once, at full resolution and reduced by the pyramid
+	glGenTextures(1, &heightTexture);
+	glBindTexture(GL_TEXTURE_2D, heightTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	uploadHeights(terrain, true);
+
+	// Shared patch: (PATCH_SIZE + 1)^2 grid vertices, positioned and displaced in the vertex shader
+	const int patchPoints = PATCH_SIZE + 1;
+	vector<float> patchVertices;
+	patchVertices.reserve(patchPoints * patchPoints * 3);
+	for (int row = 0; row < patchPoints; row++)
+	{
+		for (int col = 0; col < patchPoints; col++)
+		{
+			patchVertices.push_back((float)col);
+			patchVertices.push_back(0.0f);
+			patchVertices.push_back((float)row);
+		}
+	}
+
+	// Triangle strips joined by degenerate triangles, same layout as Terrain::getIndices
+	vector<int> patchIndices;
+	for (int y = 0; y < patchPoints - 1; y++)
+	{
+		if (y > 0)
+			patchIndices.push_back(y * patchPoints);
+		for (int x = 0; x < patchPoints; x++)
+		{
+			patchIndices.push_back(y * patchPoints + x);
+			patchIndices.push_back((y + 1) * patchPoints + x);
+		}
+		if (y < patchPoints - 2)
+			patchIndices.push_back((y + 2) * patchPoints - 1);
+	}
+	patchIndicesCount = patchIndices.size();
+
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, patchVertices.size() * sizeof(float), &patchVertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, patchIndices.size() * sizeof(int), &patchIndices[0], GL_STATIC_DRAW);
+
+	// patch-local grid positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void*)0);
+
+	glBindVertexArray(0);
+}
+
+void DisplacedTerrain::updateHeights(const Terrain& terrain)
+{
+	// A new heightmap can have another size
+	bool resized = terrain.getOriginalWidth() != originalWidth || terrain.getOriginalHeight() != originalHeight;
+	originalWidth = terrain.getOriginalWidth();
+	originalHeight = terrain.getOriginalHeight();
+	uploadHeights(terrain, resized);
+}
+
+/**
+ * Copies the pyramid levels into the mip levels of the height texture, allocating them first if the size changed.
+ * GL rounds the mip sizes down where the pyramid rounds up, so level 0 is padded by 2^(levels - 1) - 1 texels per
+ * axis to give every mip level room for its pyramid level; the shader never reads past the pyramid sizes.
+ */
+void DisplacedTerrain::uploadHeights(const Terrain& terrain, bool allocate)
+{
+	const HeightPyramid& pyramid = terrain.getPyramid();
+	textureLevels = std::min(pyramid.getLevelCount(), MAX_TEXTURE_LEVEL + 1);
+	int padding = (1 << (textureLevels - 1)) - 1;
+
+	glBindTexture(GL_TEXTURE_2D, heightTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	vector<float> heights;
+	for (int level = 0; level < textureLevels; level++)
+	{
+		const MortonHeights& levelHeights = pyramid.getLevel(level);
+		int levelWidth = levelHeights.getWidth();
+		int levelHeight = levelHeights.getHeight();
+		heights.resize(size_t(levelWidth) * levelHeight);
+		for (int row = 0; row < levelHeight; row++)
+			levelHeights.readRow(0, row, levelWidth, &heights[size_t(row) * levelWidth]);
+
+		if (allocate)
+		{
+			int textureWidth = std::max(1, (originalWidth + padding) >> level);
+			int textureHeight = std::max(1, (originalHeight + padding) >> level);
+			glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, textureWidth, textureHeight, 0, GL_RED, GL_FLOAT, NULL);
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, GL_RED, GL_FLOAT, &heights[0]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, textureLevels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void DisplacedTerrain::Draw(const Shader& shader, GLenum renderMode)
+{
+	// Number of vertices per axis of the equivalent CPU mesh
+	int verticesX = subdivisionsX * (controlPointsX() - 1) + 1;
+	int verticesZ = subdivisionsZ * (controlPointsZ() - 1) + 1;
+	int patchesX = (verticesX - 2) / PATCH_SIZE + 1;
+	int patchesZ = (verticesZ - 2) / PATCH_SIZE + 1;
+
+	shader.setInt("displacement", 1);
+	shader.setInt("heightMap", 0);
+	shader.setIVec2("heightMapSize", glm::ivec2(originalWidth, originalHeight));
+	shader.setInt("heightMapLevels", textureLevels);
+	shader.setInt("skipSize", skipSize);
+	shader.setIVec2("controlPoints", glm::ivec2(controlPointsX(), controlPointsZ()));
+	shader.setIVec2("subdivisions", glm::ivec2(subdivisionsX, subdivisionsZ));
+	shader.setInt("patchesPerRow", patchesX);
+	shader.setInt("patchSize", PATCH_SIZE);
+	shader.setInt("catmullRom", catmullRom ? 1 : 0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, heightTexture);
+	glBindVertexArray(VAO);
+	glDrawElementsInstanced(renderMode, patchIndicesCount, GL_UNSIGNED_INT, 0, patchesX * patchesZ);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	shader.setInt("displacement", 0);
+}
+
+/**
+ * Primitives of the equivalent CPU mesh (instanced patches overhanging the edge only add degenerate triangles)
+ */
+unsigned long long DisplacedTerrain::getTriangleCount(GLenum renderMode) const
+{
+	unsigned long long verticesX = subdivisionsX * (controlPointsX() - 1) + 1;
+	unsigned long long verticesZ = subdivisionsZ * (controlPointsZ() - 1) + 1;
+	if (renderMode == GL_POINTS)
+		return verticesX * verticesZ;
+	return 2 * (verticesX - 1) * (verticesZ - 1);
+}
+
+void DisplacedTerrain::setSkipSize(int skipSize)
+{
+	this->skipSize = skipSize;
+	subdivisionsX = 1;
+	subdivisionsZ = 1;
+	refinedAxes = 0;
+}
+
+void DisplacedTerrain::nextState(float stepSize)
+{
+	int numPtsPerSegment = splineSubdivisions(stepSize);
+	if (refinedAxes == 0)
+		subdivisionsX = numPtsPerSegment;
+	else if (refinedAxes == 1)
+		subdivisionsZ = numPtsPerSegment;
+	refinedAxes = std::min(refinedAxes + 1, 2);
+}
+
+void DisplacedTerrain::setCatmullRom(bool enabled)
+{
+	catmullRom = enabled;
+}
+
+bool DisplacedTerrain::getCatmullRom() const
+{
+	return catmullRom;
+}
+
+int DisplacedTerrain::controlPointsX() const
+{
+	return originalWidth / skipSize;
+}
+
+int DisplacedTerrain::controlPointsZ() const
+{
+	return originalHeight / skipSize;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <glew.h>
+#include <vector>
+
+#include "Shader.h"
+#include "Terrain.h"
+
+/**
+ * GPU render path for the Terrain: the heightmap is uploaded once as an R32F texture, with the HeightPyramid levels
+ * as its mipmaps, and a single small grid patch is instanced across the terrain. terrain.vert places each patch
+ * vertex, samples the heights and optionally evaluates Catmull-Rom, so changing the skip size or subdivision is a
+ * uniform change instead of a mesh rebuild.
+ */
+class DisplacedTerrain
+{
+public:
+	static const int PATCH_SIZE = 64; // quads per side of the shared grid patch
+	// Last pyramid level uploaded: skip sizes below 2^MAX_TEXTURE_LEVEL, which covers the viewer's, match the CPU mesh
+	static const int MAX_TEXTURE_LEVEL = 9;
+
+	DisplacedTerrain();
+	void init(const Terrain& terrain);
+	void updateHeights(const Terrain& terrain); // re-uploads the heights after the terrain was smoothed
+	void Draw(const Shader& shader, GLenum renderMode);
+	unsigned long long getTriangleCount(GLenum renderMode) const;
+
+	// Same meaning as on the Terrain: a control point per skipSize x skipSize block, at its center and with its mean
+	// height read from the pyramid levels like HeightPyramid::sampleRows, then refine along X and then Z
+	void setSkipSize(int skipSize);
+	void nextState(float stepSize);
+	void setCatmullRom(bool enabled);
+	bool getCatmullRom() const;
+
+private:
+	int originalWidth = 0, originalHeight = 0;
+	int skipSize = 1;
+	int subdivisionsX = 1, subdivisionsZ = 1;
+	int refinedAxes = 0;
+	bool catmullRom = true;
+
+	/* Render Data */
+	unsigned int VAO = 0, VBO = 0, EBO = 0, heightTexture = 0;
+	int textureLevels = 0;
+	int patchIndicesCount = 0;
+
+	void uploadHeights(const Terrain& terrain, bool allocate);
+
+	int controlPointsX() const;
+	int controlPointsZ() const;
+};
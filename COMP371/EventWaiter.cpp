@@ -0,0 +1,58 @@
+#include "EventWaiter.h"
+#include "..\glfw\glfw3.h"
+
+EventWaiter::EventWaiter()
+{
+	timer = std::thread(&EventWaiter::timerLoop, this);
+}
+
+EventWaiter::~EventWaiter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_one();
+	timer.join();
+}
+
+void EventWaiter::wait(double timeout)
+{
+	if (timeout < 0.0)
+	{
+		glfwWaitEvents();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+		armed = true;
+	}
+	changed.notify_one();
+	glfwWaitEvents();
+
+	// An empty event posted just after an event woke this wait only ends the next wait early
+	std::lock_guard<std::mutex> lock(mutex);
+	armed = false;
+}
+
+void EventWaiter::timerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		if (!armed)
+		{
+			changed.wait(lock);
+			continue;
+		}
+		// A later wait may have moved the deadline meanwhile
+		changed.wait_until(lock, deadline);
+		if (armed && std::chrono::steady_clock::now() >= deadline)
+		{
+			armed = false;
+			glfwPostEmptyEvent();
+		}
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * glfwWaitEvents with a timeout, as glfwWaitEventsTimeout does from GLFW 3.2 on: a timer thread posts an empty
+ * event once the timeout is up, which makes glfwWaitEvents return. Other threads can end a wait early the same
+ * way with glfwPostEmptyEvent.
+ */
+class EventWaiter
+{
+public:
+	EventWaiter();
+	~EventWaiter();
+
+	// Processes the events, waiting up to timeout seconds for the first one; a negative timeout waits for good
+	void wait(double timeout);
+
+private:
+	std::thread timer;
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool armed = false; // a wait is in progress until deadline
+	bool stopping = false;
+	std::chrono::steady_clock::time_point deadline;
+
+	void timerLoop();
+};
@@ -0,0 +1,54 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <math.h>
+
+void FrameStats::addFrame(double milliseconds, unsigned long long triangles)
+{
+	frameTimes.push_back(milliseconds);
+	totalMilliseconds += milliseconds;
+	totalTriangles += triangles;
+}
+
+void FrameStats::clear()
+{
+	frameTimes.clear();
+	totalMilliseconds = 0.0;
+	totalTriangles = 0;
+}
+
+size_t FrameStats::frameCount() const
+{
+	return frameTimes.size();
+}
+
+double FrameStats::percentile(double p) const
+{
+	if (frameTimes.empty()) return 0.0;
+
+	std::vector<double> sorted = frameTimes;
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	rank = std::min(std::max(rank, (size_t)1), sorted.size());
+	std::nth_element(sorted.begin(), sorted.begin() + rank - 1, sorted.end());
+	return sorted[rank - 1];
+}
+
+double FrameStats::meanMilliseconds() const
+{
+	return frameTimes.empty() ? 0.0 : totalMilliseconds / frameTimes.size();
+}
+
+double FrameStats::trianglesPerSecond() const
+{
+	return totalMilliseconds > 0.0 ? totalTriangles / (totalMilliseconds / 1000.0) : 0.0;
+}
+
+void FrameStats::print(std::ostream& out) const
+{
+	out << "frames: " << frameCount()
+		<< "  mean: " << meanMilliseconds() << " ms"
+		<< "  p50: " << percentile(50) << " ms"
+		<< "  p95: " << percentile(95) << " ms"
+		<< "  p99: " << percentile(99) << " ms"
+		<< "  triangles/s: " << trianglesPerSecond() << std::endl;
+}
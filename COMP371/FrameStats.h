@@ -0,0 +1,25 @@
+#pragma once
+#include <iostream>
+#include <vector>
+
+/**
+ * Collects per-frame timings and primitive counts and reports percentiles
+ */
+class FrameStats
+{
+public:
+	void addFrame(double milliseconds, unsigned long long triangles);
+	void clear();
+
+	size_t frameCount() const;
+	double percentile(double p) const; // nearest-rank, p in [0, 100]
+	double meanMilliseconds() const;
+	double trianglesPerSecond() const;
+
+	void print(std::ostream& out) const;
+
+private:
+	std::vector<double> frameTimes;
+	double totalMilliseconds = 0.0;
+	unsigned long long totalTriangles = 0;
+};
@@ -0,0 +1,47 @@
+#include "GpuTimer.h"
+
+void GpuTimer::init()
+{
+	glGenQueries(QUERY_COUNT, queries);
+}
+
+void GpuTimer::begin()
+{
+	// Only a GPU QUERY_COUNT frames behind makes this wait
+	if (pending == QUERY_COUNT)
+		collect(true);
+	glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+
+void GpuTimer::end()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	next = (next + 1) % QUERY_COUNT;
+	pending++;
+	collect(false);
+}
+
+double GpuTimer::getMilliseconds() const
+{
+	return milliseconds;
+}
+
+/**
+ * Reads the results that are in, oldest first; with wait, at least the oldest one
+ */
+void GpuTimer::collect(bool wait)
+{
+	while (pending > 0)
+	{
+		GLuint query = queries[(next - pending + QUERY_COUNT) % QUERY_COUNT];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available && !wait) return;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+		milliseconds = nanoseconds / 1.0e6;
+		pending--;
+		wait = false;
+	}
+}
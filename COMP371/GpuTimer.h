@@ -0,0 +1,25 @@
+#pragma once
+#include <glew.h>
+
+/**
+ * Measures the GPU time of the commands between begin and end of each frame with GL_TIME_ELAPSED queries.
+ * Results are read a few frames later, once the GPU has them, so the CPU never waits for the GPU.
+ */
+class GpuTimer
+{
+public:
+	void init();
+	void begin();
+	void end();
+	// GPU time of the latest frame whose result came back, 0 until the first one
+	double getMilliseconds() const;
+
+private:
+	static const int QUERY_COUNT = 4; // frames that can be in flight before a result must be read
+	GLuint queries[QUERY_COUNT] = {};
+	int next = 0; // query of the next frame
+	int pending = 0; // queries ended but not read, the oldest at next - pending
+	double milliseconds = 0.0;
+
+	void collect(bool wait);
+};
@@ -0,0 +1,204 @@
+#include "HeadlessRender.h"
+#include "Camera.h"
+#include "JobSystem.h"
+#include "Terrain.h"
+#include "gtc/matrix_transform.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+
+int runHeadless(int argc, char** argv)
+{
+	std::string outPath = argv[2];
+	std::string heightmapPath = "heightmaps/depth.bmp";
+	int skipSize = 1;
+	int resampleWidth = 0, resampleHeight = 0;
+	long long vertexBudget = 0;
+	Resampler::Filter resampleFilter = Resampler::LANCZOS3;
+	SplineBasis splineBasis = CATMULL_ROM;
+	float stepSize = 0.0f;
+	int refinePasses = -1;
+	int frames = 1;
+	int width = 800, height = 800;
+	GLenum drawMode = GL_TRIANGLE_STRIP;
+	int workers = -1;
+	bool pinThreads = false;
+	bool printMemory = false;
+	// Applied to the heights in command line order, false when the parameters don't suit the heightmap
+	std::vector<std::function<bool(Terrain&)> > filters;
+
+	for (int i = 3; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--heightmap" && hasValue) heightmapPath = argv[++i];
+		else if (arg == "--skip" && hasValue) skipSize = std::max(1, atoi(argv[++i]));
+		else if (arg == "--resolution" && hasValue) sscanf(argv[++i], "%dx%d", &resampleWidth, &resampleHeight);
+		else if (arg == "--budget" && hasValue) vertexBudget = atoll(argv[++i]);
+		else if (arg == "--resample" && hasValue)
+		{
+			if (!Resampler::fromName(argv[++i], resampleFilter))
+			{
+				std::cout << "Unknown resampling filter: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--spline" && hasValue)
+		{
+			if (!splineBasisFromName(argv[++i], splineBasis))
+			{
+				std::cout << "Unknown spline basis: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--step" && hasValue) stepSize = (float)atof(argv[++i]);
+		else if (arg == "--refine" && hasValue) refinePasses = atoi(argv[++i]);
+		else if (arg == "--frames" && hasValue) frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "--size" && hasValue) sscanf(argv[++i], "%dx%d", &width, &height);
+		else if (arg == "--points") drawMode = GL_POINTS;
+		else if (arg == "--workers" && hasValue) workers = std::max(0, atoi(argv[++i]));
+		else if (arg == "--pin-threads") pinThreads = true;
+		else if (arg == "--memory") printMemory = true;
+		else if (arg == "--smooth" && hasValue)
+		{
+			// kernel:parameter, e.g. gaussian:1.5 or box:2
+			std::string spec = argv[++i];
+			size_t colon = spec.find(':');
+			std::string kernelName = spec.substr(0, colon);
+			float parameter = colon == std::string::npos ? 1.0f : (float)atof(spec.c_str() + colon + 1);
+			if (kernelName != "gaussian" && kernelName != "box" && kernelName != "binomial")
+			{
+				std::cout << "Unknown smoothing kernel: " << spec << std::endl;
+				return -1;
+			}
+			// The kernel is only built once its radius (3 sigma for the Gaussian) is known to fit the heightmap
+			filters.push_back([=](Terrain& terrain)
+			{
+				int maxRadius = maxFilterRadius(terrain.getOriginalWidth(), terrain.getOriginalHeight());
+				double radius = kernelName == "gaussian" ? ceil(3.0 * parameter) : parameter;
+				FilterKernel kernel;
+				if (!(parameter > 0.0f && radius <= maxRadius) || !FilterKernel::fromName(kernelName, parameter, kernel))
+				{
+					std::cout << "Smoothing radius must be between 1 and " << maxRadius << ": " << spec << std::endl;
+					return false;
+				}
+				terrain.smooth(kernel);
+				return true;
+			});
+		}
+		else if (arg == "--median" && hasValue)
+		{
+			int radius = atoi(argv[++i]);
+			filters.push_back([=](Terrain& terrain)
+			{
+				int maxRadius = maxFilterRadius(terrain.getOriginalWidth(), terrain.getOriginalHeight());
+				if (radius < 1 || radius > maxRadius)
+				{
+					std::cout << "Median radius must be between 1 and " << maxRadius << ": " << radius << std::endl;
+					return false;
+				}
+				terrain.filterHeights([&](float* heights, int w, int h, int rowStride) { medianFilter(heights, w, h, rowStride, radius); });
+				return true;
+			});
+		}
+		else if (arg == "--bilateral" && hasValue)
+		{
+			// spatialSigma:rangeSigma, e.g. 1.5:0.1
+			float spatialSigma = 1.5f, rangeSigma = 0.1f;
+			sscanf(argv[++i], "%f:%f", &spatialSigma, &rangeSigma);
+			filters.push_back([=](Terrain& terrain)
+			{
+				int maxRadius = maxFilterRadius(terrain.getOriginalWidth(), terrain.getOriginalHeight());
+				if (!(spatialSigma > 0.0f && ceil(3.0 * spatialSigma) <= maxRadius) || !(rangeSigma > 0.0f && std::isfinite(rangeSigma)))
+				{
+					std::cout << "Bilateral takes a spatial sigma of at most " << maxRadius / 3.0 << " and a positive range sigma" << std::endl;
+					return false;
+				}
+				terrain.filterHeights([&](float* heights, int w, int h, int rowStride) { bilateralFilter(heights, w, h, rowStride, spatialSigma, rangeSigma); });
+				return true;
+			});
+		}
+		else
+		{
+			std::cout << "Unknown headless option: " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	if (workers >= 0 || pinThreads)
+		JobSystem::configure(workers, pinThreads);
+
+	Terrain terrain;
+	terrain.init(heightmapPath);
+	if (terrain.getOriginalWidth() <= 0)
+		return -1;
+	for (const auto& filter : filters)
+		if (!filter(terrain))
+			return -1;
+	// A skip larger than the map leaves no quad to draw, the viewer stops at the same size
+	skipSize = std::max(1, std::min(skipSize, std::min(terrain.getOriginalWidth(), terrain.getOriginalHeight()) / 2));
+	if (resampleWidth > 0 && resampleHeight > 0)
+		terrain.setResolution(resampleWidth, resampleHeight, resampleFilter);
+	else if (vertexBudget > 0)
+		terrain.setVertexBudget(vertexBudget, resampleFilter);
+	else
+		terrain.setSkipSize(skipSize);
+
+	// By default a step size refines both axes, like pressing 'N' twice
+	if (refinePasses < 0)
+		refinePasses = stepSize > 0.0f ? 2 : 0;
+	if (stepSize < 0.05f || stepSize > 1.0f)
+		refinePasses = 0;
+	terrain.setSplineBasis(splineBasis);
+	for (int i = 0; i < refinePasses; i++)
+		terrain.nextState(stepSize);
+
+	// Same camera, projection and model transform as the interactive view
+	Camera camera(glm::vec3(0.0f, 2.0f, 3.0f));
+	glm::mat4 projection = glm::perspective(45.0f, (float)width / (float)height, 0.01f, 100.0f);
+	glm::mat4 view = camera.ViewMatrix();
+	glm::mat4 model(1.0f);
+	model = glm::scale(model, glm::vec3(0.01f));
+	model = glm::translate(model, glm::vec3(-terrain.getOriginalWidth() / 2.0f, -0.75f, -terrain.getOriginalHeight() / 2.0f));
+
+	SoftwareRenderer renderer(width, height);
+	double totalSeconds = 0.0;
+	unsigned long long totalPrimitives = 0;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		// Orbit by turning the terrain around its center
+		float angle = glm::radians(360.0f * frame / frames);
+		glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		auto start = std::chrono::steady_clock::now();
+		renderer.clear(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+		terrain.Draw(renderer, projection * view * orbit * model, drawMode);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		totalSeconds += seconds;
+		totalPrimitives += renderer.getPrimitivesDrawn();
+
+		std::string framePath = outPath;
+		if (frames > 1)
+		{
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "_%04d", frame);
+			size_t extension = framePath.rfind('.');
+			framePath.insert(extension == std::string::npos ? framePath.size() : extension, suffix);
+		}
+		if (!renderer.writePng(framePath))
+		{
+			std::cout << "Failed to write " << framePath << std::endl;
+			return -1;
+		}
+		std::cout << framePath << ": " << seconds * 1000.0 << " ms, " << renderer.getPrimitivesDrawn() << " primitives" << std::endl;
+	}
+
+	std::cout << frames << " frames, " << totalSeconds * 1000.0 / frames << " ms/frame, "
+		<< totalPrimitives / totalSeconds << " primitives/s" << std::endl;
+	if (printMemory)
+		terrain.getMemoryStats().print(std::cout, "Terrain");
+	return 0;
+}
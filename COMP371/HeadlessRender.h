@@ -0,0 +1,19 @@
+#pragma once
+
+/**
+ * Renders the terrain with the SoftwareRenderer into PNG files, without creating a window or an OpenGL context.
+ *
+ * COMP371 --headless out.png [--heightmap path] [--skip N] [--step S] [--refine 0|1|2]
+ *                            [--spline catmull|bspline|hermite|centripetal]
+ *                            [--frames N] [--size WxH] [--points]
+ *                            [--smooth gaussian:S|box:R|binomial:R] [--median R] [--bilateral S:R]...
+ *                            [--resolution WxH | --budget N] [--resample bicubic|lanczos]
+ *                            [--workers N] [--pin-threads] [--memory]
+ *
+ * The height filters run in command line order, before the skip size is applied.
+ * --resolution and --budget resample to exactly W x H or at most N vertices instead of skipping.
+ * --workers sets the JobSystem worker threads besides the main one, --pin-threads pins each to its own CPU.
+ * --memory prints the memory held by the terrain and its allocations per stage after the frames.
+ * With several frames the camera orbits the terrain and the frame number is appended to the file name.
+ */
+int runHeadless(int argc, char** argv);
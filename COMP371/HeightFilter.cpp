@@ -0,0 +1,553 @@
+#include "HeightFilter.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <string.h>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHT_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Columns per strip: a ring of 2 * radius + 1 strip rows stays in the L2 cache for the usual radii
+static const int STRIP_WIDTH = 1024;
+// Bands shorter than this spend most of their time on the halo rows
+static const int MIN_BAND_ROWS = 32;
+// Radius limit of the command line filters: a 65 x 65 median window, a Gaussian of sigma 10
+static const int MAX_FILTER_RADIUS = 32;
+
+int FilterKernel::radius() const
+{
+	return (int)taps.size() / 2;
+}
+
+static FilterKernel normalized(std::vector<float> taps)
+{
+	float sum = 0.0f;
+	for (float tap : taps)
+		sum += tap;
+	// Zero-sum kernels (derivatives) are kept as given
+	if (sum != 0.0f)
+	{
+		for (float& tap : taps)
+			tap /= sum;
+	}
+
+	FilterKernel kernel;
+	kernel.taps = taps;
+	return kernel;
+}
+
+FilterKernel FilterKernel::gaussian(float sigma)
+{
+	if (sigma <= 0.0f)
+		return box(0);
+
+	int radius = (int)ceil(3.0f * sigma);
+	std::vector<float> taps(2 * radius + 1);
+	for (int i = -radius; i <= radius; i++)
+		taps[i + radius] = expf(-(i * i) / (2.0f * sigma * sigma));
+	return normalized(taps);
+}
+
+FilterKernel FilterKernel::box(int radius)
+{
+	return normalized(std::vector<float>(2 * std::max(radius, 0) + 1, 1.0f));
+}
+
+FilterKernel FilterKernel::binomial(int radius)
+{
+	// Build the row of Pascal's triangle in place
+	std::vector<float> taps(2 * std::max(radius, 0) + 1, 0.0f);
+	taps[0] = 1.0f;
+	for (size_t row = 1; row < taps.size(); row++)
+	{
+		for (size_t i = row; i > 0; i--)
+			taps[i] += taps[i - 1];
+	}
+	return normalized(taps);
+}
+
+FilterKernel FilterKernel::custom(const std::vector<float>& taps)
+{
+	std::vector<float> centered = taps.empty() ? std::vector<float>(1, 1.0f) : taps;
+	if (centered.size() % 2 == 0)
+		centered.push_back(0.0f);
+	return normalized(centered);
+}
+
+bool FilterKernel::fromName(const std::string& name, float parameter, FilterKernel& kernel)
+{
+	if (name == "gaussian") kernel = gaussian(parameter);
+	else if (name == "box") kernel = box((int)parameter);
+	else if (name == "binomial") kernel = binomial((int)parameter);
+	else return false;
+	return true;
+}
+
+// Multiply-adds of one convolution, fed from tapCount sources: sum of taps[k] * source(k)[i].
+// Symmetric kernels (every preset) add mirrored sources first, halving the multiplies.
+static void convolve(const float* const* sources, float* out, int count, const std::vector<float>& taps, bool symmetric)
+{
+	int tapCount = (int)taps.size();
+	int radius = tapCount / 2;
+	int i = 0;
+#ifdef HEIGHT_FILTER_SSE2
+	__m128 weights[64];
+	int vectorTaps = std::min(tapCount, 64);
+	for (int k = 0; k < vectorTaps; k++)
+		weights[k] = _mm_set1_ps(taps[k]);
+
+	// Two independent vectors per iteration keep both add chains in flight
+	for (; symmetric && tapCount <= 64 && i + 8 <= count; i += 8)
+	{
+		__m128 sum0 = _mm_mul_ps(weights[radius], _mm_loadu_ps(sources[radius] + i));
+		__m128 sum1 = _mm_mul_ps(weights[radius], _mm_loadu_ps(sources[radius] + i + 4));
+		for (int k = 0; k < radius; k++)
+		{
+			const float* near = sources[k] + i;
+			const float* far = sources[tapCount - 1 - k] + i;
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(weights[k], _mm_add_ps(_mm_loadu_ps(near), _mm_loadu_ps(far))));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(weights[k], _mm_add_ps(_mm_loadu_ps(near + 4), _mm_loadu_ps(far + 4))));
+		}
+		_mm_storeu_ps(out + i, sum0);
+		_mm_storeu_ps(out + i + 4, sum1);
+	}
+	for (; tapCount <= 64 && i + 4 <= count; i += 4)
+	{
+		__m128 sum;
+		if (symmetric)
+		{
+			sum = _mm_mul_ps(weights[radius], _mm_loadu_ps(sources[radius] + i));
+			for (int k = 0; k < radius; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(weights[k], _mm_add_ps(_mm_loadu_ps(sources[k] + i), _mm_loadu_ps(sources[tapCount - 1 - k] + i))));
+		}
+		else
+		{
+			sum = _mm_mul_ps(weights[0], _mm_loadu_ps(sources[0] + i));
+			for (int k = 1; k < tapCount; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(weights[k], _mm_loadu_ps(sources[k] + i)));
+		}
+		_mm_storeu_ps(out + i, sum);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float sum;
+		if (symmetric)
+		{
+			sum = taps[radius] * sources[radius][i];
+			for (int k = 0; k < radius; k++)
+				sum += taps[k] * (sources[k][i] + sources[tapCount - 1 - k][i]);
+		}
+		else
+		{
+			sum = taps[0] * sources[0][i];
+			for (int k = 1; k < tapCount; k++)
+				sum += taps[k] * sources[k][i];
+		}
+		out[i] = sum;
+	}
+}
+
+static bool isSymmetric(const std::vector<float>& taps)
+{
+	for (size_t k = 0; k < taps.size() / 2; k++)
+	{
+		if (taps[k] != taps[taps.size() - 1 - k])
+			return false;
+	}
+	return true;
+}
+
+namespace
+{
+	// Rows [begin, end) filtered by one task, with copies of the original rows its kernel reaches outside them
+	struct Band
+	{
+		int begin, end;
+		int aboveBegin; // first row stored in above
+		std::vector<float> above, below;
+
+		// Original row, wherever it is kept (rows inside the band only until the band overwrites them)
+		const float* sourceRow(const float* heights, int width, int rowStride, int row) const
+		{
+			if (row < begin) return &above[size_t(row - aboveBegin) * width];
+			if (row >= end) return &below[size_t(row - end) * width];
+			return heights + size_t(row) * rowStride;
+		}
+	};
+}
+
+// Splits the rows into one band per task; every band saves the original rows within radius of it before any band writes
+static std::vector<Band> makeBands(const float* heights, int width, int height, int rowStride, int radius)
+{
+	int bandCount = std::max(1, std::min(workerCount() * 2, height / std::max(MIN_BAND_ROWS, 2 * radius)));
+	std::vector<Band> bands(bandCount);
+
+	parallelFor(bandCount, [&](int begin, int end)
+	{
+		for (int b = begin; b < end; b++)
+		{
+			Band& band = bands[b];
+			band.begin = (int)((long long)height * b / bandCount);
+			band.end = (int)((long long)height * (b + 1) / bandCount);
+			band.aboveBegin = std::max(0, band.begin - radius);
+			int belowEnd = std::min(height, band.end + radius);
+
+			band.above.resize(size_t(band.begin - band.aboveBegin) * width);
+			for (int row = band.aboveBegin; row < band.begin; row++)
+				memcpy(&band.above[size_t(row - band.aboveBegin) * width], heights + size_t(row) * rowStride, width * sizeof(float));
+			band.below.resize(size_t(belowEnd - band.end) * width);
+			for (int row = band.end; row < belowEnd; row++)
+				memcpy(&band.below[size_t(row - band.end) * width], heights + size_t(row) * rowStride, width * sizeof(float));
+		}
+	});
+	return bands;
+}
+
+static void filterBand(float* heights, int width, int height, int rowStride, const std::vector<float>& taps, const Band& band)
+{
+	int radius = (int)taps.size() / 2;
+	int ringRows = 2 * radius + 1;
+	int bandRows = band.end - band.begin;
+	int stripWidth = std::min(width, std::max(STRIP_WIDTH, radius));
+
+	std::vector<float> ring(size_t(ringRows) * stripWidth);
+	std::vector<const float*> ringOrder(ringRows);
+	std::vector<float> line(stripWidth + 2 * radius);
+	std::vector<const float*> lineTaps(ringRows);
+	for (int k = 0; k < ringRows; k++)
+		lineTaps[k] = &line[k];
+	bool symmetric = isSymmetric(taps);
+	// Original values of the radius columns left of the current strip, already overwritten by the previous strip
+	std::vector<float> leftEdge(size_t(bandRows) * radius), nextLeftEdge(size_t(bandRows) * radius);
+
+	auto ringSlot = [&](int virtualRow) { return &ring[size_t((virtualRow - (band.begin - radius)) % ringRows) * stripWidth]; };
+
+	for (int x0 = 0; x0 < width; x0 += stripWidth)
+	{
+		int x1 = std::min(width, x0 + stripWidth);
+		int columns = x1 - x0;
+
+		// Horizontal pass of one original row of the strip into its ring slot
+		auto loadRow = [&](int virtualRow)
+		{
+			// Rows past the borders repeat the border row
+			int row = std::min(std::max(virtualRow, 0), height - 1);
+			const float* source = band.sourceRow(heights, width, rowStride, row);
+			const float* left = row >= band.begin && row < band.end ? &leftEdge[size_t(row - band.begin) * radius] : nullptr;
+			auto halo = [&](int column) -> float
+			{
+				column = std::min(std::max(column, 0), width - 1);
+				return left && column < x0 ? left[column - (x0 - radius)] : source[column];
+			};
+
+			for (int i = 0; i < radius; i++)
+			{
+				line[i] = halo(x0 - radius + i);
+				line[radius + columns + i] = halo(x1 + i);
+			}
+			memcpy(&line[radius], source + x0, columns * sizeof(float));
+			// The horizontal taps are the line shifted by k
+			convolve(lineTaps.data(), ringSlot(virtualRow), columns, taps, symmetric);
+		};
+
+		for (int virtualRow = band.begin - radius; virtualRow < band.begin + radius; virtualRow++)
+			loadRow(virtualRow);
+
+		for (int row = band.begin; row < band.end; row++)
+		{
+			loadRow(row + radius);
+			for (int k = 0; k < ringRows; k++)
+				ringOrder[k] = ringSlot(row - radius + k);
+
+			float* out = heights + size_t(row) * rowStride;
+			if (x1 < width)
+				memcpy(&nextLeftEdge[size_t(row - band.begin) * radius], out + x1 - radius, radius * sizeof(float));
+			convolve(ringOrder.data(), out + x0, columns, taps, symmetric);
+		}
+		leftEdge.swap(nextLeftEdge);
+	}
+}
+
+void convolveSeparable(float* heights, int width, int height, int rowStride, const FilterKernel& kernel)
+{
+	int radius = kernel.radius();
+	if (width <= 0 || height <= 0 || radius == 0)
+		return;
+
+	std::vector<Band> bands = makeBands(heights, width, height, rowStride, radius);
+	parallelFor((int)bands.size(), [&](int begin, int end)
+	{
+		for (int b = begin; b < end; b++)
+			filterBand(heights, width, height, rowStride, kernel.taps, bands[b]);
+	});
+}
+
+/* Non-separable filters: each output row is computed from a window of original rows */
+
+namespace
+{
+	// rows[k] is original row y - radiusZ + k, readable from column -radiusX to width - 1 + radiusX
+	typedef std::function<void(const float* const* rows, float* out, int width)> RowFilter;
+}
+
+// Runs filter on every row in place, band by band, keeping copies of the 2 * radiusZ + 1 original rows in a ring
+static void filterRowWindows(float* heights, int width, int height, int rowStride, int radiusX, int radiusZ, const RowFilter& filter)
+{
+	std::vector<Band> bands = makeBands(heights, width, height, rowStride, radiusZ);
+
+	parallelFor((int)bands.size(), [&](int begin, int end)
+	{
+		for (int b = begin; b < end; b++)
+		{
+			const Band& band = bands[b];
+			int ringRows = 2 * radiusZ + 1;
+			int paddedWidth = width + 2 * radiusX;
+			std::vector<float> ring(size_t(ringRows) * paddedWidth);
+			std::vector<const float*> window(ringRows);
+			auto ringSlot = [&](int virtualRow) { return &ring[size_t((virtualRow - (band.begin - radiusZ)) % ringRows) * paddedWidth]; };
+
+			// Copies an original row into its ring slot, repeating the border texels into the padding
+			auto loadRow = [&](int virtualRow)
+			{
+				int row = std::min(std::max(virtualRow, 0), height - 1);
+				const float* source = band.sourceRow(heights, width, rowStride, row);
+				float* slot = ringSlot(virtualRow);
+				std::fill(slot, slot + radiusX, source[0]);
+				memcpy(slot + radiusX, source, width * sizeof(float));
+				std::fill(slot + radiusX + width, slot + paddedWidth, source[width - 1]);
+			};
+
+			for (int virtualRow = band.begin - radiusZ; virtualRow < band.begin + radiusZ; virtualRow++)
+				loadRow(virtualRow);
+
+			for (int row = band.begin; row < band.end; row++)
+			{
+				loadRow(row + radiusZ);
+				for (int k = 0; k < ringRows; k++)
+					window[k] = ringSlot(row - radiusZ + k) + radiusX;
+				filter(window.data(), heights + size_t(row) * rowStride, width);
+			}
+		}
+	});
+}
+
+/* Median */
+
+// Larger windows don't fit a sorting network in registers, they use a partial sort instead
+static const int MAX_NETWORK_RADIUS = 3;
+
+static void compareExchange(float& a, float& b)
+{
+	float low = std::min(a, b);
+	b = std::max(a, b);
+	a = low;
+}
+
+#ifdef HEIGHT_FILTER_SSE2
+static void compareExchange(__m128& a, __m128& b)
+{
+	__m128 low = _mm_min_ps(a, b);
+	b = _mm_max_ps(a, b);
+	a = low;
+}
+#endif
+
+// Compare-exchange pairs leaving the median of count values at index count / 2
+static std::vector<std::pair<int, int> > medianNetwork(int count)
+{
+	std::vector<std::pair<int, int> > network;
+	if (count == 9)
+	{
+		// 19 exchanges for the 3x3 median (Paeth)
+		static const int pairs[19][2] = {
+			{ 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 1 }, { 3, 4 }, { 6, 7 }, { 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 3 },
+			{ 5, 8 }, { 4, 7 }, { 3, 6 }, { 1, 4 }, { 2, 5 }, { 4, 7 }, { 4, 2 }, { 6, 4 }, { 4, 2 } };
+		for (const auto& pair : pairs)
+			network.push_back(std::make_pair(pair[0], pair[1]));
+		return network;
+	}
+
+	// Batcher's odd-even merge sort over the next power of two. The padding acts as +infinity and stays at the top,
+	// so exchanges reaching into it never change anything and are left out.
+	int padded = 1;
+	while (padded < count) padded <<= 1;
+	for (int p = 1; p < padded; p <<= 1)
+	{
+		for (int k = p; k >= 1; k >>= 1)
+		{
+			for (int j = k % p; j + k < padded; j += 2 * k)
+			{
+				for (int i = 0; i < k && i + j + k < padded; i++)
+				{
+					if ((i + j) / (2 * p) == (i + j + k) / (2 * p) && i + j + k < count)
+						network.push_back(std::make_pair(i + j, i + j + k));
+				}
+			}
+		}
+	}
+	return network;
+}
+
+void medianFilter(float* heights, int width, int height, int rowStride, int radius)
+{
+	if (width <= 0 || height <= 0 || radius <= 0)
+		return;
+
+	int side = 2 * radius + 1;
+	int count = side * side;
+	int middle = count / 2;
+
+	if (radius > MAX_NETWORK_RADIUS)
+	{
+		filterRowWindows(heights, width, height, rowStride, radius, radius, [&](const float* const* rows, float* out, int rowWidth)
+		{
+			std::vector<float> window(count);
+			for (int x = 0; x < rowWidth; x++)
+			{
+				for (int k = 0; k < count; k++)
+					window[k] = rows[k / side][x + k % side - radius];
+				std::nth_element(window.begin(), window.begin() + middle, window.end());
+				out[x] = window[middle];
+			}
+		});
+		return;
+	}
+
+	std::vector<std::pair<int, int> > network = medianNetwork(count);
+	filterRowWindows(heights, width, height, rowStride, radius, radius, [&](const float* const* rows, float* out, int rowWidth)
+	{
+		int x = 0;
+#ifdef HEIGHT_FILTER_SSE2
+		// 4 neighbouring texels go through the network side by side
+		__m128 vectorWindow[(2 * MAX_NETWORK_RADIUS + 1) * (2 * MAX_NETWORK_RADIUS + 1)];
+		for (; x + 4 <= rowWidth; x += 4)
+		{
+			for (int dz = 0, k = 0; dz < side; dz++)
+			{
+				for (int dx = -radius; dx <= radius; dx++)
+					vectorWindow[k++] = _mm_loadu_ps(rows[dz] + x + dx);
+			}
+			for (const auto& exchange : network)
+				compareExchange(vectorWindow[exchange.first], vectorWindow[exchange.second]);
+			_mm_storeu_ps(out + x, vectorWindow[middle]);
+		}
+#endif
+		float window[(2 * MAX_NETWORK_RADIUS + 1) * (2 * MAX_NETWORK_RADIUS + 1)];
+		for (; x < rowWidth; x++)
+		{
+			for (int dz = 0, k = 0; dz < side; dz++)
+			{
+				for (int dx = -radius; dx <= radius; dx++)
+					window[k++] = rows[dz][x + dx];
+			}
+			for (const auto& exchange : network)
+				compareExchange(window[exchange.first], window[exchange.second]);
+			out[x] = window[middle];
+		}
+	});
+}
+
+/* Bilateral */
+
+// exp(x) for x <= 0 with a relative error below 1e-6: 2^integer from the exponent bits times a polynomial 2^fraction
+static float fastExp(float x)
+{
+	float t = std::max(x, -80.0f) * 1.44269504f;
+	float integer = floorf(t);
+	float f = t - integer;
+	float fraction = 1.0f + f * (0.693147182f + f * (0.240226507f + f * (0.0555041087f + f * (0.00961812911f + f * 0.00133335581f))));
+	union { int bits; float value; } scale;
+	scale.bits = ((int)integer + 127) << 23;
+	return fraction * scale.value;
+}
+
+#ifdef HEIGHT_FILTER_SSE2
+static __m128 fastExp4(__m128 x)
+{
+	__m128 t = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-80.0f)), _mm_set1_ps(1.44269504f));
+	__m128i integer = _mm_cvttps_epi32(t);
+	// Truncation rounds the negative values up: step those back by one
+	integer = _mm_add_epi32(integer, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(integer), t)));
+	__m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(integer));
+	__m128 fraction = _mm_add_ps(_mm_set1_ps(0.00961812911f), _mm_mul_ps(f, _mm_set1_ps(0.00133335581f)));
+	fraction = _mm_add_ps(_mm_set1_ps(0.0555041087f), _mm_mul_ps(f, fraction));
+	fraction = _mm_add_ps(_mm_set1_ps(0.240226507f), _mm_mul_ps(f, fraction));
+	fraction = _mm_add_ps(_mm_set1_ps(0.693147182f), _mm_mul_ps(f, fraction));
+	fraction = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, fraction));
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(integer, _mm_set1_epi32(127)), 23));
+	return _mm_mul_ps(fraction, scale);
+}
+#endif
+
+// 1D bilateral: out[i] = sum of w * sources[k][i] / sum of w, w = spatial[k] * exp(rangeScale * (sources[k][i] - center)^2)
+static void bilateral(const float* const* sources, float* out, int count, const std::vector<float>& spatial, float rangeScale)
+{
+	int tapCount = (int)spatial.size();
+	int radius = tapCount / 2;
+	int i = 0;
+#ifdef HEIGHT_FILTER_SSE2
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 center = _mm_loadu_ps(sources[radius] + i);
+		__m128 weighted = _mm_setzero_ps(), weights = _mm_setzero_ps();
+		for (int k = 0; k < tapCount; k++)
+		{
+			__m128 value = _mm_loadu_ps(sources[k] + i);
+			__m128 difference = _mm_sub_ps(value, center);
+			__m128 weight = _mm_mul_ps(_mm_set1_ps(spatial[k]), fastExp4(_mm_mul_ps(_mm_set1_ps(rangeScale), _mm_mul_ps(difference, difference))));
+			weighted = _mm_add_ps(weighted, _mm_mul_ps(weight, value));
+			weights = _mm_add_ps(weights, weight);
+		}
+		_mm_storeu_ps(out + i, _mm_div_ps(weighted, weights));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float center = sources[radius][i];
+		float weighted = 0.0f, weights = 0.0f;
+		for (int k = 0; k < tapCount; k++)
+		{
+			float value = sources[k][i];
+			float difference = value - center;
+			float weight = spatial[k] * fastExp(rangeScale * (difference * difference));
+			weighted += weight * value;
+			weights += weight;
+		}
+		out[i] = weighted / weights;
+	}
+}
+
+void bilateralFilter(float* heights, int width, int height, int rowStride, float spatialSigma, float rangeSigma)
+{
+	if (width <= 0 || height <= 0 || spatialSigma <= 0.0f || rangeSigma <= 0.0f)
+		return;
+
+	// The center tap has no height difference, so the weight sum is never zero
+	FilterKernel spatialKernel = FilterKernel::gaussian(spatialSigma);
+	const std::vector<float>& spatial = spatialKernel.taps;
+	int radius = (int)spatial.size() / 2;
+	float rangeScale = -1.0f / (2.0f * rangeSigma * rangeSigma);
+
+	filterRowWindows(heights, width, height, rowStride, radius, 0, [&](const float* const* rows, float* out, int rowWidth)
+	{
+		std::vector<const float*> sources(spatial.size());
+		for (int k = 0; k < (int)sources.size(); k++)
+			sources[k] = rows[0] + k - radius;
+		bilateral(sources.data(), out, rowWidth, spatial, rangeScale);
+	});
+	filterRowWindows(heights, width, height, rowStride, 0, radius, [&](const float* const* rows, float* out, int rowWidth)
+	{
+		bilateral(rows, out, rowWidth, spatial, rangeScale);
+	});
+}
+
+int maxFilterRadius(int width, int height)
+{
+	return std::min(MAX_FILTER_RADIUS, std::min(width, height));
+}
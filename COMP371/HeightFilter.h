@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Normalized 1D filter taps (2 * radius + 1 weights, centered), applied along both axes by convolveSeparable
+ */
+struct FilterKernel
+{
+	std::vector<float> taps;
+
+	int radius() const;
+
+	static FilterKernel gaussian(float sigma); // radius of ceil(3 sigma)
+	static FilterKernel box(int radius);
+	static FilterKernel binomial(int radius);  // row 2 * radius of Pascal's triangle
+	static FilterKernel custom(const std::vector<float>& taps); // an even count gets a zero weight appended
+
+	// "gaussian" with a sigma, "box" or "binomial" with a radius; false for an unknown name
+	static bool fromName(const std::string& name, float parameter, FilterKernel& kernel);
+};
+
+/**
+ * Convolves a row-major height grid with kernel along x and then z, in place, repeating the border texels.
+ * Both passes are fused: each thread sweeps a band of rows one cache-sized column strip at a time, keeping only
+ * a ring of 2 * radius + 1 horizontally filtered rows of the strip, so the grid is read and written once.
+ */
+void convolveSeparable(float* heights, int width, int height, int rowStride, const FilterKernel& kernel);
+
+/**
+ * Median of the (2 * radius + 1)^2 neighbourhood, in place: removes isolated spikes and keeps steps sharp.
+ * Radii up to 3 run a sorting network on 4 texels at a time (SSE2), larger radii a partial sort per texel.
+ */
+void medianFilter(float* heights, int width, int height, int rowStride, int radius);
+
+/**
+ * Separable approximation of the bilateral filter, in place: a 1D bilateral pass along x and then along z.
+ * Neighbours are weighted by a Gaussian of their distance (spatialSigma texels) and of their height difference
+ * (rangeSigma, in normalized height), so steps much taller than rangeSigma are smoothed along but not across.
+ */
+void bilateralFilter(float* heights, int width, int height, int rowStride, float spatialSigma, float rangeSigma);
+
+/**
+ * Largest radius (3 sigma for the Gaussians) the viewer and the headless renderer accept for a filter of a
+ * width x height heightmap: within the map, and small enough that a median window stays a few thousand texels.
+ */
+int maxFilterRadius(int width, int height);
@@ -0,0 +1,134 @@
+#include "HeightPyramid.h"
+
+#include <algorithm>
+#include <math.h>
+#include <utility>
+
+void HeightPyramid::build(MortonHeights heights)
+{
+	levels.clear();
+	levels.push_back(std::move(heights));
+
+	// Odd last rows and columns are repeated to fill their block, so every level covers the whole grid
+	while (levels.back().getWidth() > 1 || levels.back().getHeight() > 1)
+		levels.push_back(levels.back().halve());
+}
+
+int HeightPyramid::getLevelCount() const
+{
+	return (int)levels.size();
+}
+
+bool HeightPyramid::empty() const
+{
+	return levels.empty();
+}
+
+size_t HeightPyramid::getMemoryBytes() const
+{
+	size_t bytes = 0;
+	for (const MortonHeights& level : levels)
+		bytes += level.getMemoryBytes();
+	return bytes;
+}
+
+const MortonHeights& HeightPyramid::getLevel(int level) const
+{
+	return levels[level];
+}
+
+namespace
+{
+	// Bilinear footprint of the reduced texels begin..end - 1 in one level, along one axis (index 0 is texel begin)
+	struct Taps
+	{
+		std::vector<int> first, second;
+		std::vector<float> weight; // of second
+
+		Taps(int levelIndex, int levelSize, int skipSize, int begin, int end) : first(end - begin), second(end - begin), weight(end - begin)
+		{
+			// Reduced texel i is centered at i * skipSize + (skipSize - 1) / 2 in level 0, level texel x at x * scale + (scale - 1) / 2
+			int scale = 1 << levelIndex;
+			float step = (float)skipSize / scale;
+			float offset = ((skipSize - 1) * 0.5f - (scale - 1) * 0.5f) / scale;
+			for (int i = 0; i < end - begin; i++)
+			{
+				float position = std::min(std::max((begin + i) * step + offset, 0.0f), levelSize - 1.0f);
+				first[i] = (int)position;
+				second[i] = std::min(first[i] + 1, levelSize - 1);
+				weight[i] = position - first[i];
+			}
+		}
+	};
+}
+
+void HeightPyramid::sampleLevel(int levelIndex, int skipSize, int rowBegin, int rowEnd, int count, float* out) const
+{
+	const MortonHeights& level = levels[levelIndex];
+	int levelWidth = level.getWidth();
+	Taps columns(levelIndex, levelWidth, skipSize, 0, count);
+	Taps rows(levelIndex, level.getHeight(), skipSize, rowBegin, rowEnd);
+	std::vector<float> row0(levelWidth), row1(levelWidth), lerped(levelWidth);
+	int row0Index = -1, row1Index = -1;
+
+	for (int row = rowBegin; row < rowEnd; row++)
+	{
+		// Unpack the two level rows, keeping the ones the previous reduced row already read
+		if (rows.first[row - rowBegin] == row1Index)
+		{
+			row0.swap(row1);
+			std::swap(row0Index, row1Index);
+		}
+		if (rows.first[row - rowBegin] != row0Index)
+		{
+			row0Index = rows.first[row - rowBegin];
+			level.readRow(0, row0Index, levelWidth, row0.data());
+		}
+		if (rows.second[row - rowBegin] != row1Index)
+		{
+			row1Index = rows.second[row - rowBegin];
+			level.readRow(0, row1Index, levelWidth, row1.data());
+		}
+
+		// Interpolate the two level rows once, then each reduced texel only blends two neighbours of that row
+		float fz = rows.weight[row - rowBegin];
+		for (int x = 0; x < levelWidth; x++)
+			lerped[x] = row0[x] + fz * (row1[x] - row0[x]);
+
+		float* heights = out + size_t(row - rowBegin) * count;
+		for (int col = 0; col < count; col++)
+		{
+			float left = lerped[columns.first[col]];
+			heights[col] = left + columns.weight[col] * (lerped[columns.second[col]] - left);
+		}
+	}
+}
+
+void HeightPyramid::sampleRows(int skipSize, int rowBegin, int rowEnd, int count, float* out) const
+{
+	skipSize = std::max(skipSize, 1);
+
+	// Finest level whose blocks are no larger than the skip size
+	int level = 0;
+	while ((2 << level) <= skipSize && level + 1 < (int)levels.size())
+		level++;
+
+	// A power of two reads its level directly: reduced texel (col, row) is level texel (col, row)
+	if ((1 << level) == skipSize)
+	{
+		for (int row = rowBegin; row < rowEnd; row++)
+			levels[level].readRow(0, row, count, out + size_t(row - rowBegin) * count);
+		return;
+	}
+
+	// Otherwise sample both levels at the block centers and blend by the log2 distance
+	sampleLevel(level, skipSize, rowBegin, rowEnd, count, out);
+	if (level + 1 < (int)levels.size())
+	{
+		std::vector<float> coarse(size_t(rowEnd - rowBegin) * count);
+		sampleLevel(level + 1, skipSize, rowBegin, rowEnd, count, coarse.data());
+		float blend = log2f((float)skipSize) - level;
+		for (size_t i = 0; i < coarse.size(); i++)
+			out[i] += blend * (coarse[i] - out[i]);
+	}
+}
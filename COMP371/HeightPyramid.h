@@ -0,0 +1,34 @@
+#pragma once
+#include "MortonHeights.h"
+
+#include <vector>
+
+/**
+ * Area-averaged mip pyramid of a height grid: level l holds the mean of every 2^l x 2^l block of level 0.
+ * Built once in parallel, it lets Terrain::setSkipSize read a power-of-two reduction straight from one level
+ * and blend two adjacent levels for the other skip sizes, instead of point sampling the full grid.
+ * Levels are stored as MortonHeights, so halving a level and reading its rows both stay in contiguous tiles.
+ */
+class HeightPyramid
+{
+public:
+	void build(MortonHeights heights);
+
+	int getLevelCount() const;
+	bool empty() const;
+	size_t getMemoryBytes() const; // all levels
+
+	// Heights of one level; its texel (x, z) is the mean of the 2^level x 2^level block at (x * 2^level, z * 2^level)
+	const MortonHeights& getLevel(int level) const;
+
+	// Heights of reduced rows [rowBegin, rowEnd), columns [0, count), for a reduction by skipSize, written to out
+	// row after row: the mean of each skipSize x skipSize block of level 0, read from one level for powers of two
+	// and blended from the two nearest levels otherwise.
+	void sampleRows(int skipSize, int rowBegin, int rowEnd, int count, float* out) const;
+
+private:
+	std::vector<MortonHeights> levels;
+
+	// Bilinear samples of one level at the block centers of reduced rows
+	void sampleLevel(int levelIndex, int skipSize, int rowBegin, int rowEnd, int count, float* out) const;
+};
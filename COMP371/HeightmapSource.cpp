@@ -0,0 +1,63 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "HeightmapSource.h"
+#include "ProceduralHeightmap.h"
+#include "TiledHeightFile.h"
+#include "stb_image.h"
+
+#include <iostream>
+
+std::shared_ptr<HeightmapSource> HeightmapSource::open(const std::string& path)
+{
+	if (path.compare(0, 6, "noise:") == 0)
+		return ProceduralHeightmap::fromSpec(path.substr(6));
+	if (path.size() > 6 && path.compare(path.size() - 6, 6, ".tiles") == 0)
+		return TiledHeightmap::load(path);
+	return ImageHeightmap::load(path);
+}
+
+ImageHeightmap::ImageHeightmap(const unsigned char* data, int width, int height, int nrComponents)
+	: width(width), height(height), nrComponents(nrComponents), pixels(data, data + size_t(width) * height * nrComponents)
+{
+}
+
+std::shared_ptr<ImageHeightmap> ImageHeightmap::load(const std::string& path)
+{
+	int imageWidth, imageHeight, imageComponents;
+	unsigned char *imageData = stbi_load(path.c_str(), &imageWidth, &imageHeight, &imageComponents, 0);
+
+	if (!imageData)
+	{
+		std::cout << "Texture failed to load at path: " << path << std::endl;
+		return nullptr;
+	}
+
+	std::shared_ptr<ImageHeightmap> image = std::make_shared<ImageHeightmap>(imageData, imageWidth, imageHeight, imageComponents);
+	stbi_image_free(imageData);
+	return image;
+}
+
+int ImageHeightmap::getWidth() const
+{
+	return width;
+}
+
+int ImageHeightmap::getHeight() const
+{
+	return height;
+}
+
+size_t ImageHeightmap::getMemoryBytes() const
+{
+	return pixels.capacity();
+}
+
+void ImageHeightmap::readRegion(int x, int z, int regionWidth, int regionHeight, float* out, int rowStride) const
+{
+	for (int row = 0; row < regionHeight; row++)
+	{
+		const unsigned char* pixel = &pixels[((size_t(z) + row) * width + x) * nrComponents];
+		float* heights = out + size_t(row) * rowStride;
+		for (int col = 0; col < regionWidth; col++)
+			heights[col] = pixel[col * nrComponents] / 255.0f; // first color value of pixel
+	}
+}
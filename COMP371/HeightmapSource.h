@@ -0,0 +1,46 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Where a Terrain gets its heights from. Heights are normalized to [0, 1] and read by region, so a source
+ * can produce them lazily (see ProceduralHeightmap) instead of holding the whole map in memory.
+ */
+class HeightmapSource
+{
+public:
+	virtual ~HeightmapSource() {}
+
+	virtual int getWidth() const = 0;
+	virtual int getHeight() const = 0;
+
+	// Writes the heights of columns [x, x + width) and rows [z, z + height) to out, rows rowStride floats apart
+	virtual void readRegion(int x, int z, int width, int height, float* out, int rowStride) const = 0;
+
+	// Bytes the source keeps in memory
+	virtual size_t getMemoryBytes() const { return 0; }
+
+	// Opens an image file, a ".tiles" file (see TiledHeightFile), or a procedural map for paths of the form
+	// "noise:key=value,..." (see ProceduralHeightmap)
+	static std::shared_ptr<HeightmapSource> open(const std::string& path);
+};
+
+/**
+ * Heightmap held as 8-bit pixels (first color channel), loaded with stb_image or given directly
+ */
+class ImageHeightmap : public HeightmapSource
+{
+public:
+	ImageHeightmap(const unsigned char* data, int width, int height, int nrComponents);
+	static std::shared_ptr<ImageHeightmap> load(const std::string& path);
+
+	int getWidth() const override;
+	int getHeight() const override;
+	void readRegion(int x, int z, int width, int height, float* out, int rowStride) const override;
+	size_t getMemoryBytes() const override;
+
+private:
+	int width, height, nrComponents;
+	std::vector<unsigned char> pixels;
+};
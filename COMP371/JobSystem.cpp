@@ -0,0 +1,313 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct Job
+{
+	std::function<void()> task;
+	std::atomic<int> pending; // unfinished dependencies, plus one until submit has registered them all
+	std::atomic<bool> done;
+	std::mutex mutex; // guards dependents and the switch to done
+	std::vector<JobHandle> dependents;
+	unsigned long long group; // the job submitted outside any job that this one is part of, shared by its whole tree
+
+	Job() : pending(1), done(false), group(0) {}
+};
+
+// Index of the worker running on this thread, -1 outside the pool
+static thread_local int currentWorker = -1;
+// Group of the job running on this thread, 0 outside any job
+static thread_local unsigned long long currentGroup = 0;
+static std::atomic<unsigned long long> nextGroup(1);
+
+// How long a waiting thread with nothing to run sleeps before looking for stolen work again
+static const std::chrono::microseconds WAIT_POLL(200);
+
+static void pinToCpu(std::thread& thread, int cpu)
+{
+#ifdef _WIN32
+	SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (cpu % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu % CPU_SETSIZE, &cpus);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+	(void)thread;
+	(void)cpu;
+#endif
+}
+
+JobSystem& JobSystem::get()
+{
+	static JobSystem system(-1, false);
+	return system;
+}
+
+void JobSystem::configure(int workers, bool pinThreads, int firstCpu)
+{
+	JobSystem& system = get();
+	system.stop();
+	system.start(workers, pinThreads, firstCpu);
+}
+
+JobSystem::JobSystem(int workers, bool pinThreads) : queuedJobs(0), waitingThreads(0), stopping(false)
+{
+	start(workers, pinThreads);
+}
+
+JobSystem::~JobSystem()
+{
+	stop();
+}
+
+void JobSystem::start(int workerCount, bool pinThreads, int firstCpu)
+{
+	if (workerCount < 0)
+		workerCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	// Jobs left in the old queues are dropped with them, so the count must not keep waking workers for them
+	stopping = false;
+	queues.clear();
+	queuedJobs = 0;
+	for (int i = 0; i <= workerCount; i++)
+		queues.emplace_back(new Queue());
+	for (int i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+		if (pinThreads)
+			pinToCpu(workers.back(), firstCpu + i + 1);
+	}
+}
+
+void JobSystem::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeWorkers.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+int JobSystem::getThreadCount() const
+{
+	return (int)workers.size() + 1;
+}
+
+JobHandle JobSystem::submit(std::function<void()> task, const std::vector<JobHandle>& dependencies)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->task = std::move(task);
+	job->group = currentGroup ? currentGroup : nextGroup++;
+	for (const JobHandle& dependency : dependencies)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->done) continue;
+		job->pending++;
+		dependency->dependents.push_back(job);
+	}
+
+	// The last dependency to finish schedules the job, possibly this one
+	if (--job->pending == 0)
+		schedule(job);
+	return job;
+}
+
+bool JobSystem::isDone(const JobHandle& job)
+{
+	return job->done;
+}
+
+void JobSystem::wait(const JobHandle& job)
+{
+	// Threads outside the pool only help with the job's own tree, so the render thread never picks up a whole
+	// rebuild; the workers run anything, which also keeps them from all waiting on each other
+	unsigned long long group = currentWorker < 0 && !workers.empty() ? job->group : 0;
+	while (!job->done)
+	{
+		JobHandle other = findJob(group);
+		if (other)
+		{
+			run(other);
+			continue;
+		}
+
+		// Nothing to help with: sleep until a job finishes or new work shows up, which may be of another group
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		waitingThreads++;
+		jobFinished.wait_for(lock, WAIT_POLL, [&] { return job->done || (group == 0 && queuedJobs > 0); });
+		waitingThreads--;
+	}
+}
+
+void JobSystem::schedule(const JobHandle& job)
+{
+	Queue& queue = *queues[currentWorker + 1];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+	queuedJobs++;
+
+	// Taking the lock orders the push before a sleeping thread's last look at queuedJobs
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wakeWorkers.notify_one();
+	if (waitingThreads > 0)
+		jobFinished.notify_all();
+}
+
+JobHandle JobSystem::findJob(unsigned long long group)
+{
+	if (queuedJobs == 0) return JobHandle();
+	if (group != 0)
+		return findGroupJob(group);
+
+	int own = currentWorker + 1;
+	int count = (int)queues.size();
+	for (int i = 0; i < count; i++)
+	{
+		// Own jobs newest first (still in cache), then steal the oldest job of the shared queue and the other workers
+		int index = (own + i) % count;
+		Queue& queue = *queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) continue;
+
+		JobHandle job;
+		if (i == 0 && own > 0)
+		{
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		queuedJobs--;
+		return job;
+	}
+	return JobHandle();
+}
+
+JobHandle JobSystem::findGroupJob(unsigned long long group)
+{
+	for (const std::unique_ptr<Queue>& queue : queues)
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		for (auto it = queue->jobs.begin(); it != queue->jobs.end(); ++it)
+		{
+			if ((*it)->group != group) continue;
+			JobHandle job = *it;
+			queue->jobs.erase(it);
+			queuedJobs--;
+			return job;
+		}
+	}
+	return JobHandle();
+}
+
+void JobSystem::run(const JobHandle& job)
+{
+	unsigned long long outerGroup = currentGroup;
+	currentGroup = job->group;
+	job->task();
+	job->task = nullptr;
+	currentGroup = outerGroup;
+
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		dependents.swap(job->dependents);
+	}
+	for (const JobHandle& dependent : dependents)
+	{
+		if (--dependent->pending == 0)
+			schedule(dependent);
+	}
+
+	if (waitingThreads > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		jobFinished.notify_all();
+	}
+}
+
+void JobSystem::workerLoop(int index)
+{
+	currentWorker = index;
+	while (true)
+	{
+		JobHandle job = findJob();
+		if (job)
+		{
+			run(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeWorkers.wait(lock, [&] { return stopping || queuedJobs > 0; });
+		if (stopping) break;
+	}
+	currentWorker = -1;
+}
+
+void JobSystem::parallelFor(int count, const std::function<void(int begin, int end)>& body, int grainSize)
+{
+	if (count <= 0) return;
+
+	// Split into a few chunks per thread so uneven chunks balance out
+	int threads = std::min(getThreadCount(), (count + grainSize - 1) / grainSize);
+	if (threads <= 1)
+	{
+		body(0, count);
+		return;
+	}
+	int chunkSize = std::max(grainSize, count / (threads * 4));
+	std::atomic<int> next(0);
+
+	// Helpers and caller pull chunks from the same counter; a helper that starts late finds it exhausted
+	auto drain = [&]()
+	{
+		for (int begin = next.fetch_add(chunkSize); begin < count; begin = next.fetch_add(chunkSize))
+			body(begin, std::min(begin + chunkSize, count));
+	};
+
+	std::vector<JobHandle> helpers;
+	for (int i = 1; i < threads; i++)
+		helpers.push_back(submit(drain));
+	drain();
+	for (const JobHandle& helper : helpers)
+		wait(helper);
+}
+
+void JobSystem::parallelFor2D(int width, int height, const std::function<void(int x0, int x1, int z0, int z1)>& body,
+	int grainX, int grainZ)
+{
+	if (width <= 0 || height <= 0) return;
+
+	int tilesX = (width + grainX - 1) / grainX;
+	int tilesZ = (height + grainZ - 1) / grainZ;
+	parallelFor(tilesX * tilesZ, [&](int begin, int end)
+	{
+		for (int tile = begin; tile < end; tile++)
+		{
+			int x0 = (tile % tilesX) * grainX, z0 = (tile / tilesX) * grainZ;
+			body(x0, std::min(x0 + grainX, width), z0, std::min(z0 + grainZ, height));
+		}
+	});
+}
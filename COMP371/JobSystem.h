@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+/**
+ * Work-stealing scheduler shared by the CPU stages. Every worker owns a deque: it pushes and pops its own jobs
+ * at the back, and idle workers steal from the front of the others. Threads outside the pool submit to a shared
+ * queue. A job can wait for other jobs (its dependencies), and a thread waiting for a job runs queued jobs
+ * meanwhile, so jobs may submit and wait for jobs of their own without blocking a worker. A thread outside the
+ * pool only runs jobs of the tree it waits for (the job and those submitted while it runs), so waiting for a
+ * small job never makes the render thread run someone else's rebuild.
+ *
+ * The pool starts on first use with hardware_concurrency - 1 workers, the caller making up the last thread,
+ * and at least one worker so jobs submitted in the background always make progress.
+ */
+class JobSystem
+{
+public:
+	static JobSystem& get();
+
+	// Restarts the pool with workers threads (-1 for the default), worker i pinned to CPU firstCpu + i + 1
+	// when pinThreads is set. Only call it while no job is running.
+	static void configure(int workers, bool pinThreads = false, int firstCpu = 0);
+
+	// Workers plus the calling thread
+	int getThreadCount() const;
+
+	// Runs task once all of dependencies have finished
+	JobHandle submit(std::function<void()> task, const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+	static bool isDone(const JobHandle& job);
+	// Returns once job has finished, running other jobs until then (outside the pool, only jobs of its tree)
+	void wait(const JobHandle& job);
+
+	// body(begin, end) on disjoint sub-ranges of [0, count) of at least grainSize, the caller's thread included
+	void parallelFor(int count, const std::function<void(int begin, int end)>& body, int grainSize = 1);
+	// body(x0, x1, z0, z1) on disjoint tiles of the width x height range, grainX x grainZ each
+	void parallelFor2D(int width, int height, const std::function<void(int x0, int x1, int z0, int z1)>& body,
+		int grainX = 1, int grainZ = 1);
+
+	~JobSystem();
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<JobHandle> jobs;
+	};
+
+	// queues[0] is shared by the threads outside the pool, queues[i + 1] belongs to worker i
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<int> queuedJobs;
+	std::atomic<int> waitingThreads;
+	std::atomic<bool> stopping;
+	std::mutex sleepMutex;
+	std::condition_variable wakeWorkers, jobFinished;
+
+	JobSystem(int workers, bool pinThreads);
+	void start(int workerCount, bool pinThreads, int firstCpu = 0);
+	void stop();
+
+	void workerLoop(int index);
+	void schedule(const JobHandle& job);
+	JobHandle findJob(unsigned long long group = 0); // group 0 takes any job
+	JobHandle findGroupJob(unsigned long long group);
+	void run(const JobHandle& job);
+};
@@ -6,18 +6,33 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <climits>
+#include <cmath>
 #include "glm.hpp"
 #include "gtc/matrix_transform.hpp"
 #include "gtc/type_ptr.hpp"
 
 #include "Camera.h"
+#include "CameraPath.h"
+#include "CameraUniforms.h"
+#include "ControlChannel.h"
+#include "DisplacedTerrain.h"
+#include "EventWaiter.h"
+#include "FrameStats.h"
+#include "GpuTimer.h"
+#include "HeadlessRender.h"
+#include "JobSystem.h"
+#include "QualityGovernor.h"
 #include "Shader.h"
+#include "StreamedRefinement.h"
 #include "Terrain.h"
 
 using namespace std;
 
 // Window dimensions
 const GLuint WIDTH = 800, HEIGHT = 800;
+const string WINDOW_TITLE = "Load one cube";
 
 glm::vec3 camera_position;
 glm::vec3 triangle_scale;
@@ -39,23 +54,114 @@ float lastSkipSizeUpdate = 0.0f;
 // Player controlled variables
 GLenum drawMode = GL_TRIANGLE_STRIP;
 
+// Frames are only drawn when something on screen changed, unless redrawContinuously (--continuous) is set
+bool redraw = true;
+bool redrawContinuously = false;
+// How often the idle loop wakes to follow background work (mesh rebuilds, loads, shader compiles)
+const double BACKGROUND_POLL_SECONDS = 0.05;
+
 // Prototype
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
+void window_refresh_callback(GLFWwindow* window);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void processInput(GLFWwindow *window);
 void setDrawMode(GLenum newDrawMode);
 void reset();
+bool applyEvent(const string& event);
+void processCommands();
+string statsLine();
+void updateHeightmap(bool wait);
+int maxSkipSize();
+bool isDrawnMeshUploading();
+void printMemory();
 
 // Terrain with HeightMap
 Terrain terrain;
 Terrain origTerrain;
 bool showOriginalTerrain = false;
-float stepSize;
+DisplacedTerrain gpuTerrain;
+bool useGpuDisplacement = false;
+// Mesh settings at startup, until the console or the control socket changes them
+const int DEFAULT_SKIP_SIZE = 4;
+const float DEFAULT_STEP_SIZE = 0.5f;
+// Ranges of the mesh settings; a skip size is also held to 2 vertices along each axis
+const int MAX_SKIP_SIZE = 300;
+const float MIN_STEP_SIZE = 0.05f, MAX_STEP_SIZE = 1.0f;
+int skipSize = DEFAULT_SKIP_SIZE;
+float stepSize = DEFAULT_STEP_SIZE;
+int terrainWidth = 0, terrainHeight = 0; // size of the heightmap on screen, kept here as the terrain may be loading another
+
+// Commands from the console and the control socket, run between frames
+ControlChannel control;
+
+// Changes the skip size to hold a frame time, off until --governor or the governor command sets one
+QualityGovernor governor;
+GpuTimer gpuTimer;
+
+// Heightmap file opened by a job for a "heightmap" event; each load has its own so a newer one can start meanwhile
+struct HeightmapLoad
+{
+	string path;
+	JobHandle job;
+	shared_ptr<HeightmapSource> source; // set by the job, null if the file could not be opened or is too large for the mesh
+};
+shared_ptr<HeightmapLoad> heightmapLoad;
+bool heightmapUploadPending = false; // the terrain heights are changing in the background, the displacement texture follows
+
+// Camera path recording and replay
+CameraPath cameraPath;
+string recordPath;
+bool replaying = false;
+bool benchmarkMode = false; // replay as fast as possible and report frame times
+size_t replayFrame = 0;
+FrameStats frameStats;
 
 // The MAIN function, from here we start the application and run the game loop
-int main()
+int main(int argc, char** argv)
 {
+	// Render to PNG files on the CPU, without a window or OpenGL
+	if (argc > 2 && std::string(argv[1]) == "--headless")
+		return runHeadless(argc, argv);
+	// Refine the whole heightmap into a tiled file on disk, without building a mesh, or rows of it for a coordinator
+	if (argc > 2 && (std::string(argv[1]) == "--refine-to" || std::string(argv[1]) == "--refine-worker"))
+		return runRefineToFile(argc, argv);
+
+	string heightmapPath = "heightmaps/depth.bmp";
+	int workers = -1;
+	bool pinThreads = false;
+	// A new CPU mesh goes to the GPU in bands of at most this long and this many MB per frame, 0 for no limit
+	float uploadBudgetMs = 4.0f, uploadBudgetMB = 64.0f;
+	string controlPath; // Unix domain socket taking the same commands as the console, none by default
+	double governorTarget = 0.0; // frame time in ms the skip size is adjusted for, 0 to leave it alone
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--heightmap" && i + 1 < argc)
+			heightmapPath = argv[++i]; // an image, or "noise:..." for a procedural map
+		else if (arg == "--record" && i + 1 < argc)
+			recordPath = argv[++i];
+		else if (arg == "--replay" && i + 1 < argc)
+			replaying = cameraPath.load(argv[++i]);
+		else if (arg == "--benchmark")
+			benchmarkMode = true;
+		else if (arg == "--workers" && i + 1 < argc)
+			workers = std::max(0, atoi(argv[++i])); // JobSystem threads besides the main one
+		else if (arg == "--pin-threads")
+			pinThreads = true;
+		else if (arg == "--upload-budget" && i + 1 < argc)
+			sscanf(argv[++i], "%f:%f", &uploadBudgetMs, &uploadBudgetMB);
+		else if (arg == "--control" && i + 1 < argc)
+			controlPath = argv[++i];
+		else if (arg == "--governor" && i + 1 < argc)
+			governorTarget = atof(argv[++i]);
+		else if (arg == "--continuous")
+			redrawContinuously = true;
+	}
+	benchmarkMode = benchmarkMode && replaying;
+	if (workers >= 0 || pinThreads)
+		JobSystem::configure(workers, pinThreads);
+
 	std::cout << "Starting GLFW context, OpenGL 3.3" << std::endl;
 	// Init GLFW
 	glfwInit();
@@ -65,7 +171,7 @@ int main()
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Create a GLFWwindow object that we can use for GLFW's functions
-	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Load one cube", nullptr, nullptr);
+	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, WINDOW_TITLE.c_str(), nullptr, nullptr);
 	if (window == nullptr)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -73,11 +179,15 @@ int main()
 		return -1;
 	}
 	glfwMakeContextCurrent(window);
+	// Benchmarks measure the real frame time, not the display refresh
+	if (benchmarkMode)
+		glfwSwapInterval(0);
 
 	// Set the callback functions for mouse movements and frame size change
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
 
 	// Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
@@ -102,13 +212,43 @@ int main()
 
 	triangle_scale = glm::vec3(0.01f);
 
-	// Terrain Plain
-	terrain.init("heightmaps/depth.bmp");
-	origTerrain.init("heightmaps/depth.bmp");
+	// Terrain Plain, both terrains read the same heightmap
+	shared_ptr<HeightmapSource> heightmap = HeightmapSource::open(heightmapPath);
+	if (!heightmap || !Terrain::checkMeshSize(heightmap->getWidth(), heightmap->getHeight()))
+	{
+		glfwTerminate();
+		return -1;
+	}
+	terrain.init(heightmap);
+	// Replays only keep the byte budget, so every run swaps the meshes in on the same frames
+	terrain.setUploadBudget(replaying ? 0.0f : uploadBudgetMs, size_t(std::max(0.0f, uploadBudgetMB) * (1 << 20)));
+	origTerrain.init(heightmap);
+	gpuTerrain.init(origTerrain);
+	terrainWidth = terrain.getOriginalWidth();
+	terrainHeight = terrain.getOriginalHeight();
 	Shader terrainShader("shaders/terrain.vert", "shaders/terrain.frag");
-
-	// Ask user for skipSize and stepSize for CatMull operations
-	reset();
+	CameraUniforms cameraUniforms;
+	cameraUniforms.init();
+	gpuTimer.init();
+	// Replays keep the skip sizes they recorded
+	governor.setTarget(replaying ? 0.0 : governorTarget);
+	GLint modelLocation = -1;
+	bool terrainShaderReady = false;
+	int exitCode = 0;
+	int titleProgress = -1; // percentage of the mesh rebuild shown in the title, -1 for none
+
+	// Start from the default skipSize and stepSize for CatMull operations (a replayed path carries its own)
+	if (!replaying)
+	{
+		reset();
+		cout << "Commands: set-skip N, set-step S, next-state, load-heightmap PATH, governor MS|off, stats, or any replay event" << endl;
+	}
+	control.start(controlPath);
+	// Commands end the wait for events of an idle loop
+	control.setWakeCallback([] { glfwPostEmptyEvent(); });
+	EventWaiter events;
+	glm::mat4 drawnView;
+	glm::vec3 drawnScale;
 
 		// Game loop
 		while (!glfwWindowShouldClose(window))
@@ -117,45 +257,155 @@ int main()
 			float currentFrame = glfwGetTime();
 			deltaTime = currentFrame - lastFrame;
 			lastFrame = currentFrame;
+			double frameStart = glfwGetTime();
+			unsigned long long trianglesDrawn = 0;
+
+			// Replay the next recorded frame once the program is ready, so every run renders the same frames
+			if (replaying && terrainShaderReady)
+			{
+				if (replayFrame == cameraPath.size())
+				{
+					replaying = false;
+					if (benchmarkMode)
+					{
+						frameStats.print(cout);
+						printMemory();
+						glfwSetWindowShouldClose(window, GL_TRUE);
+						continue;
+					}
+				}
+				else
+				{
+					const CameraPath::Frame& frame = cameraPath.frame(replayFrame++);
+					for (const string& event : frame.events)
+						applyEvent(event);
+					// Every run draws the same meshes on the same frames
+					updateHeightmap(true);
+					terrain.finishRebuild();
+					camera.setState(frame.position, frame.yaw, frame.pitch);
+					triangle_scale = glm::vec3(frame.scale);
+				}
+			}
 
-			// Handle inputs
+			// Handle inputs, then the commands, which only start the mesh work
 			processInput(window);
+			processCommands();
+			updateHeightmap(false);
+
+			// The terrain program compiles in the background, finish its setup once it has linked
+			if (!terrainShaderReady && terrainShader.poll())
+			{
+				terrainShader.bindUniformBlock(CameraUniforms::BLOCK_NAME, CameraUniforms::BINDING_POINT);
+				modelLocation = terrainShader.uniformLocation("model");
+				terrainShaderReady = true;
+				redraw = true;
+			}
+			// Nothing can be drawn without it (both meshes use it), so don't leave an empty window or a replay waiting forever
+			if (terrainShader.hasFailed())
+			{
+				cout << "The terrain program failed to build (see the errors above), exiting" << endl;
+				exitCode = 1;
+				break;
+			}
+
+			// The mesh rebuilds in the background, show how far it got
+			int progress = terrain.isRebuilding() ? (int)(terrain.getRebuildProgress() * 100) : -1;
+			if (progress != titleProgress)
+			{
+				titleProgress = progress;
+				string title = progress < 0 ? WINDOW_TITLE : WINDOW_TITLE + " - rebuilding mesh " + to_string(progress) + "%";
+				glfwSetWindowTitle(window, title.c_str());
+			}
+
+			// Nothing changed on screen: wait for input, waking now and then while background work is in flight
+			glm::mat4 view = camera.ViewMatrix();
+			if (view != drawnView || triangle_scale != drawnScale)
+				redraw = true;
+			if (!redraw && !redrawContinuously && !replaying && !isDrawnMeshUploading())
+			{
+				bool working = terrain.isRebuilding() || origTerrain.isRebuilding() || heightmapLoad || heightmapUploadPending || !terrainShaderReady;
+				events.wait(working ? BACKGROUND_POLL_SECONDS : -1.0);
+				// Camera keys move from the end of the wait, not from the last frame
+				lastFrame = glfwGetTime();
+				continue;
+			}
+			redraw = false;
+			drawnView = view;
+			drawnScale = triangle_scale;
 
 			// Render
+			gpuTimer.begin();
 			// Clear the colorbuffer
 			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-			// View matrix
-			glm::mat4 view;
-			view = camera.ViewMatrix();
+			// Camera matrices, shared by all programs for this frame
+			cameraUniforms.update(view, projection);
 
 			// Terrain
-			terrainShader.UseProgram();
-			glm::mat4 model(1.0f);
-			model = glm::scale(model, triangle_scale);
-			model = glm::translate(model, glm::vec3(-terrain.getOriginalWidth() / 2.0f, -0.75f, -terrain.getOriginalHeight() / 2.0f));
-			terrainShader.setMat4("projection", projection);
-			terrainShader.setMat4("view", view);
-			terrainShader.setMat4("model", model);
-			if(showOriginalTerrain)
+			if (terrainShaderReady)
 			{
-				origTerrain.Draw(drawMode);
-			}else
+				terrainShader.UseProgram();
+				glm::mat4 model(1.0f);
+				model = glm::scale(model, triangle_scale);
+				model = glm::translate(model, glm::vec3(-terrainWidth / 2.0f, -0.75f, -terrainHeight / 2.0f));
+				terrainShader.setMat4(modelLocation, model);
+				if(showOriginalTerrain)
+				{
+					origTerrain.Draw(drawMode);
+					trianglesDrawn = origTerrain.getTriangleCount(drawMode);
+				}else if (useGpuDisplacement)
+				{
+					gpuTerrain.Draw(terrainShader, drawMode);
+					trianglesDrawn = gpuTerrain.getTriangleCount(drawMode);
+				}else
+				{
+					terrain.Draw(drawMode);
+					trianglesDrawn = terrain.getTriangleCount(drawMode);
+				}
+			}
+
+			gpuTimer.end();
+			double cpuMilliseconds = (glfwGetTime() - frameStart) * 1000.0;
+
+			// Hold the frame time with the skip size, judged on frames that draw the latest mesh
+			bool settled = !terrain.isRebuilding() && !isDrawnMeshUploading() && !heightmapLoad && !heightmapUploadPending && !showOriginalTerrain;
+			int governedSkip = governor.update(cpuMilliseconds, gpuTimer.getMilliseconds(), skipSize, settled);
+			governedSkip = std::min(governedSkip, maxSkipSize());
+			if (governedSkip > 0 && governedSkip != skipSize)
 			{
-				terrain.Draw(drawMode);
+				cout << "Governor: " << governor.getDecision() << endl;
+				applyEvent("skip " + to_string(governedSkip));
 			}
 
+			if (!recordPath.empty() && terrainShaderReady)
+				cameraPath.addFrame(camera.getPosition(), camera.getYaw(), camera.getPitch(), triangle_scale.x);
+
+			// Make the frame time include the GPU work
+			if (benchmarkMode)
+				glFinish();
+
 			// Swap the screen buffers
 			glfwSwapBuffers(window);
 			// Check if any events have been activiated (key pressed, mouse moved etc.) and call corresponding response functions
 			glfwPollEvents();
 
+			if (replaying && benchmarkMode && replayFrame > 0)
+				frameStats.addFrame((glfwGetTime() - frameStart) * 1000.0, trianglesDrawn);
+
 		}
 
-	// Terminate GLFW, clearing any resources allocated by GLFW.
+	if (!recordPath.empty() && !cameraPath.save(recordPath))
+		std::cout << "Failed to save camera path to " << recordPath << std::endl;
+
+	// Stop taking commands and the mesh work still running, then terminate GLFW, clearing any resources allocated by GLFW.
+	control.stop();
+	if (heightmapLoad)
+		JobSystem::get().wait(heightmapLoad->job);
+	terrain.cancelRebuild();
+	origTerrain.cancelRebuild();
 	glfwTerminate();
-	return 0;
+	return exitCode;
 }
 
 // Process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -167,6 +417,10 @@ void processInput(GLFWwindow *window)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	}
 
+	// A replayed path drives the camera and the terrain
+	if (replaying)
+		return;
+
 	// Camera Position keys
 	float cameraSensitivity = 15.0f * deltaTime;
 	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
@@ -188,26 +442,71 @@ void processInput(GLFWwindow *window)
 	// CatMull
 	if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
 	{
-		terrain.nextState(stepSize);
+		applyEvent("next");
 		lastSkipSizeUpdate = glfwGetTime();
 	}
 
+	// Switch between the CPU mesh and the GPU displacement path
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		applyEvent(useGpuDisplacement ? "gpu 0" : "gpu 1");
+		lastSkipSizeUpdate = glfwGetTime();
+	}
+
+	// Toggle Catmull-Rom evaluation in the displacement shader (linear interpolation otherwise)
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		applyEvent(gpuTerrain.getCatmullRom() ? "catmull 0" : "catmull 1");
+		lastSkipSizeUpdate = glfwGetTime();
+	}
+
+
+	// Cycle the spline basis of the following CPU CatMull passes
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		applyEvent(string("spline ") + splineBasisName((SplineBasis)((terrain.getSplineBasis() + 1) % 4)));
+		lastSkipSizeUpdate = glfwGetTime();
+	}
 
 	// Show original terrain buffer
 	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
 	{
-		showOriginalTerrain = !showOriginalTerrain;
+		applyEvent(showOriginalTerrain ? "original 0" : "original 1");
+		lastSkipSizeUpdate = glfwGetTime();
+	}
+
+	// Smooth the heights, the mesh goes back to the reduced state
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		applyEvent("smooth gaussian 1");
+		lastSkipSizeUpdate = glfwGetTime();
+	}
+
+	// Remove the depth spikes before any CatMull Rom pass can overshoot them
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		applyEvent("median 1");
+		lastSkipSizeUpdate = glfwGetTime();
+	}
+
+	// Print the memory held by the meshes
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
+		printMemory();
 		lastSkipSizeUpdate = glfwGetTime();
 	}
 
 	// Change Render Mode
-	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
-		setDrawMode(GL_TRIANGLE_STRIP);
-	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-		setDrawMode(GL_POINTS);
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && drawMode != GL_TRIANGLE_STRIP)
+		applyEvent("draw strip");
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && drawMode != GL_POINTS)
+		applyEvent("draw points");
 
-	if (glfwGetKey(window, GLFW_KEY_BACKSPACE) == GLFW_PRESS)
+	if (glfwGetKey(window, GLFW_KEY_BACKSPACE) == GLFW_PRESS && glfwGetTime() - lastSkipSizeUpdate > 1)
+	{
 		reset();
+		lastSkipSizeUpdate = glfwGetTime();
+	}
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
@@ -250,6 +549,13 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 	// Update the project matrix to ensure we keep the proper aspect ratio
 	projection = glm::perspective(45.0f, (GLfloat)width / (GLfloat)height, 0.01f, 100.0f); 
+	redraw = true;
+}
+
+void window_refresh_callback(GLFWwindow* window)
+{
+	// The window was uncovered or needs its contents again
+	redraw = true;
 }
 
 void setDrawMode(GLenum newDrawMode)
@@ -257,24 +563,331 @@ void setDrawMode(GLenum newDrawMode)
 	drawMode = newDrawMode;
 }
 
+/**
+ * Memory of both CPU meshes, current and peak; they share the same heightmap source
+ */
+void printMemory()
+{
+	terrain.getMemoryStats().print(cout, "Terrain");
+	origTerrain.getMemoryStats().print(cout, "Original terrain");
+}
+
+/**
+ * Puts the camera back and rebuilds the reduced mesh; the skip and step sizes come from the console or the control
+ * socket, which never stop the rendering
+ */
 void reset()
 {
-	int skipSize = 0;
-	stepSize = 0;
+	applyEvent("step " + to_string(stepSize));
+	applyEvent("skip " + to_string(skipSize));
 
-	while(skipSize < 1 || skipSize > 300)
+	camera.reset();
+}
+
+/**
+ * Runs the commands received since the last frame. set-skip, set-step, next-state and load-heightmap become
+ * events, governor sets the frame time target, and any other line is taken as an event as is; every mesh change
+ * runs in the background.
+ */
+void processCommands()
+{
+	vector<ControlChannel::Command> commands;
+	control.poll(commands);
+	for (const ControlChannel::Command& command : commands)
 	{
-		cout << "Enter reduce skip size between 1 to 300: ";
-		cin >> skipSize;
+		istringstream stream(command.line);
+		string name;
+		stream >> name;
+		if (name.empty()) continue;
+
+		if (name == "stats")
+		{
+			control.reply(command, statsLine());
+			continue;
+		}
+		// A replayed path drives the terrain
+		if (replaying)
+		{
+			control.reply(command, "error: replaying a camera path");
+			continue;
+		}
+
+		if (name == "governor")
+		{
+			// governor MS holds the frame time at MS, governor off leaves the skip size alone
+			string value;
+			stream >> value;
+			double target = atof(value.c_str());
+			if (value != "off" && target <= 0.0)
+			{
+				control.reply(command, "error: governor takes a frame time in ms or off");
+				continue;
+			}
+			governor.setTarget(value == "off" ? 0.0 : target);
+			control.reply(command, "ok");
+			continue;
+		}
+
+		string event = command.line;
+		// applyEvent checks the ranges, as for every other source of events
+		if (name == "set-skip" || name == "set-step")
+		{
+			string value;
+			stream >> value;
+			event = name.substr(4) + " " + value;
+		}
+		else if (name == "next-state")
+			event = "next";
+		else if (name == "load-heightmap")
+		{
+			string path;
+			getline(stream >> ws, path);
+			event = "heightmap " + path;
+		}
+
+		control.reply(command, applyEvent(event) ? "ok" : "error: invalid command: " + command.line);
+	}
+}
+
+/**
+ * One line on the mesh settings, the rebuild in flight, the triangles drawn and the memory of the CPU mesh
+ */
+string statsLine()
+{
+	ostringstream line;
+	line << "heightmap " << terrainWidth << "x" << terrainHeight << ", skip " << skipSize << ", step " << stepSize;
+	if (heightmapLoad || heightmapUploadPending)
+		line << (heightmapLoad ? ", loading heightmap" : ", updating heights");
+	if (terrain.isRebuilding())
+		line << ", rebuilding mesh " << (int)(terrain.getRebuildProgress() * 100) << "%";
+	line << ", " << terrain.getTriangleCount(drawMode) << (drawMode == GL_POINTS ? " points" : " triangles");
+
+	const MemoryStats& memory = terrain.getMemoryStats();
+	line << ", CPU " << memory.getBytes(MemoryStats::CPU) / (1 << 20) << " MB (peak " << memory.getPeakBytes(MemoryStats::CPU) / (1 << 20)
+		<< "), GPU " << memory.getBytes(MemoryStats::GPU) / (1 << 20) << " MB";
+	line << ", governor: " << governor.getDecision();
+	return line.str();
+}
+
+/**
+ * Moves the heightmap loads along: once the job has opened the file both terrains load it in the background, and
+ * once they are done the displacement texture follows, as it does after a height filter. wait does every step right
+ * away, as replays need.
+ */
+void updateHeightmap(bool wait)
+{
+	// Without workers nothing else runs the job
+	JobSystem& jobs = JobSystem::get();
+	if (heightmapLoad && (wait || jobs.getThreadCount() == 1))
+		jobs.wait(heightmapLoad->job);
+	if (heightmapLoad && JobSystem::isDone(heightmapLoad->job))
+	{
+		if (heightmapLoad->source)
+		{
+			terrain.requestHeightmap(heightmapLoad->source);
+			origTerrain.requestHeightmap(heightmapLoad->source);
+			heightmapUploadPending = true;
+		}
+		heightmapLoad.reset();
 	}
 
-	while (stepSize < 0.05f || stepSize > 1.0f)
+	if (!heightmapUploadPending) return;
+	if (wait)
 	{
-		cout << "Enter CatMull step size between 0.05 to 1.0: ";
-		cin >> stepSize;
+		terrain.finishRebuild();
+		origTerrain.finishRebuild();
 	}
+	if (terrain.isRebuilding() || origTerrain.isRebuilding()) return;
+
+	gpuTerrain.updateHeights(terrain);
+	gpuTerrain.setSkipSize(skipSize);
+	terrainWidth = terrain.getOriginalWidth();
+	terrainHeight = terrain.getOriginalHeight();
+	heightmapUploadPending = false;
+	redraw = true;
+}
+
+/**
+ * Largest skip size for the heightmap on screen: MAX_SKIP_SIZE, or less so each axis keeps at least 2 vertices
+ */
+int maxSkipSize()
+{
+	return std::min(MAX_SKIP_SIZE, std::min(terrainWidth, terrainHeight) / 2);
+}
 
-	terrain.setSkipSize(skipSize);
+/**
+ * Whether the CPU mesh on screen still has bands to upload, which only the frames drawing it send
+ */
+bool isDrawnMeshUploading()
+{
+	if (useGpuDisplacement && !showOriginalTerrain) return false;
+	return showOriginalTerrain ? origTerrain.isUploading() : terrain.isUploading();
+}
 
-	camera.reset();
+/**
+ * Applies a terrain-state change, recording it when a camera path is being recorded.
+ * Keyboard input, commands and replayed paths all go through here. Returns false for an invalid event.
+ */
+bool applyEvent(const string& event)
+{
+	istringstream stream(event);
+	string command;
+	stream >> command;
+
+	if (command == "skip")
+	{
+		int value = 0;
+		int maxSkip = maxSkipSize();
+		if (!(stream >> value) || value < 1 || value > maxSkip)
+		{
+			cout << "Skip size must be between 1 and " << maxSkip << ": " << event << endl;
+			return false;
+		}
+		skipSize = value;
+		terrain.requestSkipSize(skipSize);
+		gpuTerrain.setSkipSize(skipSize);
+	}
+	else if (command == "resolution" || command == "budget")
+	{
+		// resolution width height [bicubic|lanczos], budget vertexCount [bicubic|lanczos]; the GPU path keeps its skip size
+		long long first = 0, second = 2;
+		bool parsed = bool(stream >> first);
+		if (command == "resolution")
+			parsed = parsed && (stream >> second);
+		string filterName = "lanczos";
+		stream >> filterName;
+		Resampler::Filter filter;
+		if (!parsed || first < 2 || second < 2 || !Resampler::fromName(filterName, filter))
+		{
+			cout << "Invalid resampling event: " << event << endl;
+			return false;
+		}
+		// The mesh counts its vertex floats and indices in int
+		if (command == "resolution" ? !Terrain::checkMeshSize(first, second) : first > INT_MAX / 3)
+		{
+			cout << "Resampling to at most " << INT_MAX / 3 << " vertices: " << event << endl;
+			return false;
+		}
+		if (command == "resolution")
+			terrain.requestResolution((int)first, (int)second, filter);
+		else
+			terrain.requestVertexBudget(first, filter);
+	}
+	else if (command == "spline")
+	{
+		// catmull|bspline|hermite|centripetal, for the CPU mesh; the displacement shader stays Catmull-Rom
+		string name;
+		stream >> name;
+		SplineBasis basis;
+		if (!splineBasisFromName(name, basis))
+		{
+			cout << "Unknown spline basis: " << name << endl;
+			return false;
+		}
+		terrain.finishRebuild();
+		terrain.setSplineBasis(basis);
+		cout << "Spline basis: " << name << endl;
+	}
+	else if (command == "step")
+	{
+		float value = 0.0f;
+		if (!(stream >> value) || value < MIN_STEP_SIZE || value > MAX_STEP_SIZE)
+		{
+			cout << "Step size must be between " << MIN_STEP_SIZE << " and " << MAX_STEP_SIZE << ": " << event << endl;
+			return false;
+		}
+		stepSize = value;
+	}
+	else if (command == "heightmap")
+	{
+		// heightmap path|noise:...: the file is opened by a job, then loaded into both terrains (see updateHeightmap)
+		shared_ptr<HeightmapLoad> load = make_shared<HeightmapLoad>();
+		getline(stream >> ws, load->path);
+		if (load->path.empty())
+		{
+			cout << "Missing heightmap path" << endl;
+			return false;
+		}
+		load->job = JobSystem::get().submit([load]
+		{
+			load->source = HeightmapSource::open(load->path);
+			if (load->source && !Terrain::checkMeshSize(load->source->getWidth(), load->source->getHeight()))
+				load->source.reset();
+		});
+		heightmapLoad = load;
+	}
+	else if (command == "next")
+	{
+		terrain.requestNextState(stepSize);
+		gpuTerrain.nextState(stepSize);
+	}
+	else if (command == "original" || command == "gpu" || command == "catmull")
+	{
+		int enabled = 0;
+		stream >> enabled;
+		if (command == "original") showOriginalTerrain = enabled != 0;
+		if (command == "gpu") useGpuDisplacement = enabled != 0;
+		if (command == "catmull") gpuTerrain.setCatmullRom(enabled != 0);
+	}
+	else if (command == "smooth" || command == "median" || command == "bilateral")
+	{
+		// smooth gaussian|box|binomial N, median radius, bilateral spatialSigma rangeSigma; the filter runs in the
+		// rebuild job, so it captures its parameters by value. Radii (3 sigma for the Gaussians) stay within
+		// maxFilterRadius of the heightmap on screen.
+		int maxRadius = maxFilterRadius(terrainWidth, terrainHeight);
+		if (command == "smooth")
+		{
+			string kernelName;
+			float parameter = 0.0f;
+			bool parsed = bool(stream >> kernelName >> parameter);
+			double radius = kernelName == "gaussian" ? ceil(3.0 * parameter) : parameter;
+			FilterKernel kernel;
+			if (!parsed || !(parameter > 0.0f && radius <= maxRadius) || !FilterKernel::fromName(kernelName, parameter, kernel))
+			{
+				cout << "Smoothing takes gaussian sigma, box radius or binomial radius, with a radius of at most "
+					<< maxRadius << ": " << event << endl;
+				return false;
+			}
+			terrain.requestFilterHeights([kernel](float* heights, int width, int height, int rowStride) { convolveSeparable(heights, width, height, rowStride, kernel); });
+		}
+		else if (command == "median")
+		{
+			int radius = 0;
+			if (!(stream >> radius) || radius < 1 || radius > maxRadius)
+			{
+				cout << "Median radius must be between 1 and " << maxRadius << ": " << event << endl;
+				return false;
+			}
+			terrain.requestFilterHeights([radius](float* heights, int width, int height, int rowStride) { medianFilter(heights, width, height, rowStride, radius); });
+		}
+		else
+		{
+			float spatialSigma = 0.0f, rangeSigma = 0.0f;
+			bool parsed = bool(stream >> spatialSigma >> rangeSigma);
+			if (!parsed || !(spatialSigma > 0.0f && ceil(3.0 * spatialSigma) <= maxRadius) || !(rangeSigma > 0.0f && std::isfinite(rangeSigma)))
+			{
+				cout << "Bilateral takes a spatial sigma of at most " << maxRadius / 3.0 << " and a positive range sigma: " << event << endl;
+				return false;
+			}
+			terrain.requestFilterHeights([spatialSigma, rangeSigma](float* heights, int width, int height, int rowStride) { bilateralFilter(heights, width, height, rowStride, spatialSigma, rangeSigma); });
+		}
+		// The displacement texture follows once the job is done, as for a new heightmap
+		heightmapUploadPending = true;
+	}
+	else if (command == "draw")
+	{
+		string mode;
+		stream >> mode;
+		setDrawMode(mode == "points" ? GL_POINTS : GL_TRIANGLE_STRIP);
+	}
+	else
+	{
+		cout << "Unknown terrain event: " << event << endl;
+		return false;
+	}
+
+	if (!recordPath.empty() && !replaying)
+		cameraPath.addEvent(event);
+	redraw = true;
+	return true;
 }
\ No newline at end of file
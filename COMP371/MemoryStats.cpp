@@ -0,0 +1,83 @@
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+static const char* KIND_NAMES[] = { "CPU", "GPU" };
+
+static std::string megabytes(size_t bytes)
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+	return text.str();
+}
+
+void MemoryStats::setBytes(Kind kind, const std::string& name, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto entry = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.kind == kind && e.name == name; });
+	if (entry == entries.end())
+		entry = entries.insert(entries.end(), Entry{ kind, name, 0, 0 });
+
+	totalBytes[kind] = totalBytes[kind] - entry->bytes + bytes;
+	peakTotalBytes[kind] = std::max(peakTotalBytes[kind], totalBytes[kind]);
+	entry->bytes = bytes;
+	entry->peakBytes = std::max(entry->peakBytes, bytes);
+}
+
+void MemoryStats::addAllocations(const std::string& stage, size_t count, size_t bytes)
+{
+	if (count == 0) return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto entry = std::find_if(stages.begin(), stages.end(), [&](const StageAllocations& s) { return s.stage == stage; });
+	if (entry == stages.end())
+		entry = stages.insert(stages.end(), StageAllocations{ stage, 0, 0 });
+	entry->count += count;
+	entry->bytes += bytes;
+}
+
+size_t MemoryStats::getBytes(Kind kind) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return totalBytes[kind];
+}
+
+size_t MemoryStats::getPeakBytes(Kind kind) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return peakTotalBytes[kind];
+}
+
+std::vector<MemoryStats::Entry> MemoryStats::getEntries() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries;
+}
+
+std::vector<MemoryStats::StageAllocations> MemoryStats::getStageAllocations() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stages;
+}
+
+void MemoryStats::print(std::ostream& out, const std::string& title) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	out << title << " memory:" << std::endl;
+	for (const Entry& entry : entries)
+	{
+		out << "  " << KIND_NAMES[entry.kind] << "  " << std::left << std::setw(20) << entry.name << std::right
+			<< std::setw(12) << megabytes(entry.bytes) << "  (peak " << megabytes(entry.peakBytes) << ")" << std::endl;
+	}
+	for (int kind = CPU; kind <= GPU; kind++)
+	{
+		out << "  " << KIND_NAMES[kind] << "  " << std::left << std::setw(20) << "total" << std::right
+			<< std::setw(12) << megabytes(totalBytes[kind]) << "  (peak " << megabytes(peakTotalBytes[kind]) << ")" << std::endl;
+	}
+	for (const StageAllocations& stage : stages)
+	{
+		out << "  allocations in " << stage.stage << ": " << stage.count << ", " << megabytes(stage.bytes) << std::endl;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Bytes held by named CPU containers and GPU buffers, with the high-water mark of each and of the totals,
+ * and the allocations made by each stage. Owners report a size whenever it changes; every call is thread safe.
+ */
+class MemoryStats
+{
+public:
+	enum Kind { CPU, GPU };
+
+	struct Entry
+	{
+		Kind kind;
+		std::string name;
+		size_t bytes;
+		size_t peakBytes;
+	};
+
+	struct StageAllocations
+	{
+		std::string stage;
+		size_t count;
+		size_t bytes;
+	};
+
+	void setBytes(Kind kind, const std::string& name, size_t bytes);
+	void addAllocations(const std::string& stage, size_t count, size_t bytes);
+
+	size_t getBytes(Kind kind) const;
+	size_t getPeakBytes(Kind kind) const; // high-water mark of the total
+	std::vector<Entry> getEntries() const; // in the order they were first reported
+	std::vector<StageAllocations> getStageAllocations() const;
+
+	void print(std::ostream& out, const std::string& title) const;
+
+private:
+	mutable std::mutex mutex;
+	std::vector<Entry> entries;
+	std::vector<StageAllocations> stages;
+	size_t totalBytes[2] = { 0, 0 };
+	size_t peakTotalBytes[2] = { 0, 0 };
+};
@@ -0,0 +1,252 @@
+#include "MortonHeights.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MORTON_HEIGHTS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Tiles are converted in parallel blocks of this many tiles across and down
+static const int CONVERT_BLOCK_X = 4;
+static const int CONVERT_BLOCK_Z = 2;
+
+// spread() of every in-tile coordinate
+static const unsigned short SPREAD[MortonHeights::TILE_SIZE] =
+{
+	0, 1, 4, 5, 16, 17, 20, 21, 64, 65, 68, 69, 80, 81, 84, 85,
+	256, 257, 260, 261, 272, 273, 276, 277, 320, 321, 324, 325, 336, 337, 340, 341
+};
+
+MortonHeights::MortonHeights() : width(0), height(0), tilesX(0), tilesZ(0)
+{
+}
+
+MortonHeights::MortonHeights(int width, int height)
+	: width(width), height(height),
+	tilesX((width + TILE_SIZE - 1) >> TILE_SHIFT), tilesZ((height + TILE_SIZE - 1) >> TILE_SHIFT),
+	data(size_t(tilesX) * tilesZ * TILE_TEXELS)
+{
+}
+
+MortonHeights MortonHeights::fromRows(const float* source, int width, int height, int rowStride, int texelStride)
+{
+	MortonHeights grid(width, height);
+	parallelFor2D(grid.tilesX, grid.tilesZ, [&](int tx0, int tx1, int tz0, int tz1)
+	{
+		for (int tz = tz0; tz < tz1; tz++)
+		{
+			for (int tx = tx0; tx < tx1; tx++)
+			{
+				int x0 = tx << TILE_SHIFT;
+				int z0 = tz << TILE_SHIFT;
+				float* texels = &grid.data[(size_t(tz) * grid.tilesX + tx) * TILE_TEXELS];
+
+				// The padding repeats the last row and column
+				size_t columns[TILE_SIZE];
+				for (int dx = 0; dx < TILE_SIZE; dx++)
+					columns[dx] = size_t(std::min(x0 + dx, width - 1)) * texelStride;
+
+				// A 2x2 block from two rows is 4 consecutive texels
+				for (int dz = 0; dz < TILE_SIZE; dz += 2)
+				{
+					const float* row0 = source + size_t(std::min(z0 + dz, height - 1)) * rowStride;
+					const float* row1 = source + size_t(std::min(z0 + dz + 1, height - 1)) * rowStride;
+					float* rows = texels + (SPREAD[dz] << 1);
+					for (int dx = 0; dx < TILE_SIZE; dx += 2)
+					{
+						float* block = rows + SPREAD[dx];
+						block[0] = row0[columns[dx]];
+						block[1] = row0[columns[dx + 1]];
+						block[2] = row1[columns[dx]];
+						block[3] = row1[columns[dx + 1]];
+					}
+				}
+			}
+		}
+	}, CONVERT_BLOCK_X, CONVERT_BLOCK_Z);
+	return grid;
+}
+
+int MortonHeights::getWidth() const
+{
+	return width;
+}
+
+int MortonHeights::getHeight() const
+{
+	return height;
+}
+
+bool MortonHeights::empty() const
+{
+	return data.empty();
+}
+
+size_t MortonHeights::getMemoryBytes() const
+{
+	return data.capacity() * sizeof(float);
+}
+
+void MortonHeights::readRow(int x, int z, int count, float* out) const
+{
+	const float* tileRow = &data[size_t(z >> TILE_SHIFT) * tilesX * TILE_TEXELS];
+	unsigned zBits = SPREAD[z & (TILE_SIZE - 1)] << 1;
+	int end = x + count;
+	while (x < end)
+	{
+		// One tile at a time: only the x bits change along the row
+		const float* texels = tileRow + size_t(x >> TILE_SHIFT) * TILE_TEXELS + zBits;
+		int tileEnd = std::min(end, (x | (TILE_SIZE - 1)) + 1);
+		// Within a 4x4 block a row of 4 is two pairs of adjacent texels
+		for (; (x & 3) == 0 && x + 4 <= tileEnd; x += 4, out += 4)
+		{
+			const float* block = texels + SPREAD[x & (TILE_SIZE - 1)];
+#ifdef MORTON_HEIGHTS_SSE2
+			__m128 pairs = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)block);
+			_mm_storeu_ps(out, _mm_loadh_pi(pairs, (const __m64*)(block + 4)));
+#else
+			out[0] = block[0];
+			out[1] = block[1];
+			out[2] = block[4];
+			out[3] = block[5];
+#endif
+		}
+		for (; x < tileEnd; x++)
+			*out++ = texels[SPREAD[x & (TILE_SIZE - 1)]];
+	}
+}
+
+void MortonHeights::readColumn(int x, int z, int count, float* out) const
+{
+	unsigned xBits = SPREAD[x & (TILE_SIZE - 1)];
+	int end = z + count;
+	while (z < end)
+	{
+		const float* texels = &data[(size_t(z >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT)) * TILE_TEXELS + xBits];
+		int tileEnd = std::min(end, (z | (TILE_SIZE - 1)) + 1);
+		for (; (z & 3) == 0 && z + 4 <= tileEnd; z += 4, out += 4)
+		{
+			const float* block = texels + (SPREAD[z & (TILE_SIZE - 1)] << 1);
+			out[0] = block[0];
+			out[1] = block[2];
+			out[2] = block[8];
+			out[3] = block[10];
+		}
+		for (; z < tileEnd; z++)
+			*out++ = texels[SPREAD[z & (TILE_SIZE - 1)] << 1];
+	}
+}
+
+void MortonHeights::readBlock(int x, int z, int w, int h, float* out, int outStride) const
+{
+	int row = 0;
+	for (; row < h && ((z + row) & 3); row++)
+		readRow(x, z + row, w, out + size_t(row) * outStride);
+	for (; row + 4 <= h; row += 4)
+		readQuadRows(x, z + row, w, out + size_t(row) * outStride, outStride);
+	for (; row < h; row++)
+		readRow(x, z + row, w, out + size_t(row) * outStride);
+}
+
+void MortonHeights::readQuadRows(int x, int z, int count, float* out, int outStride) const
+{
+	const float* tileRow = &data[size_t(z >> TILE_SHIFT) * tilesX * TILE_TEXELS];
+	unsigned zBits = SPREAD[z & (TILE_SIZE - 1)] << 1;
+	int end = x + count;
+	for (; x < end && (x & 3); x++, out++)
+		for (int row = 0; row < 4; row++)
+			out[row * outStride] = get(x, z + row);
+
+	// Each 4x4 block is 16 consecutive texels: rows 0 and 1 interleave in its first half, rows 2 and 3 in its second
+	for (; x + 4 <= end; x += 4, out += 4)
+	{
+		const float* block = tileRow + size_t(x >> TILE_SHIFT) * TILE_TEXELS + (zBits | SPREAD[x & (TILE_SIZE - 1)]);
+#ifdef MORTON_HEIGHTS_SSE2
+		__m128 top0 = _mm_loadu_ps(block), top1 = _mm_loadu_ps(block + 4);
+		__m128 bottom0 = _mm_loadu_ps(block + 8), bottom1 = _mm_loadu_ps(block + 12);
+		_mm_storeu_ps(out, _mm_movelh_ps(top0, top1));
+		_mm_storeu_ps(out + outStride, _mm_movehl_ps(top1, top0));
+		_mm_storeu_ps(out + 2 * size_t(outStride), _mm_movelh_ps(bottom0, bottom1));
+		_mm_storeu_ps(out + 3 * size_t(outStride), _mm_movehl_ps(bottom1, bottom0));
+#else
+		for (int row = 0; row < 4; row++)
+		{
+			const float* pairs = block + (row & 1) * 2 + (row >> 1) * 8;
+			float* line = out + size_t(row) * outStride;
+			line[0] = pairs[0];
+			line[1] = pairs[1];
+			line[2] = pairs[4];
+			line[3] = pairs[5];
+		}
+#endif
+	}
+
+	for (; x < end; x++, out++)
+		for (int row = 0; row < 4; row++)
+			out[row * outStride] = get(x, z + row);
+}
+
+void MortonHeights::toRows(float* out, int outStride) const
+{
+	parallelFor(tilesZ, [&](int begin, int end)
+	{
+		for (int row = begin << TILE_SHIFT; row < std::min(end << TILE_SHIFT, height); row++)
+			readRow(0, row, width, out + size_t(row) * outStride);
+	});
+}
+
+MortonHeights MortonHeights::halve() const
+{
+	MortonHeights coarse((width + 1) / 2, (height + 1) / 2);
+
+	// Fine tile (tx, tz) fills one quadrant of coarse tile (tx / 2, tz / 2); a quadrant is a contiguous quarter
+	// of the tile in Morton order and fine texels 4i..4i+3 are the 2x2 block of its coarse texel i.
+	// Each parallel block of 2x2 fine tiles fills one coarse tile.
+	parallelFor2D(tilesX, tilesZ, [&](int tx0, int tx1, int tz0, int tz1)
+	{
+		for (int tz = tz0; tz < tz1; tz++)
+		{
+			for (int tx = tx0; tx < tx1; tx++)
+			{
+				const float* fine = &data[(size_t(tz) * tilesX + tx) * TILE_TEXELS];
+				float* out = &coarse.data[(size_t(tz >> 1) * coarse.tilesX + (tx >> 1)) * TILE_TEXELS
+					+ ((tx & 1) | ((tz & 1) << 1)) * (TILE_TEXELS / 4)];
+				int i = 0;
+#ifdef MORTON_HEIGHTS_SSE2
+				__m128 quarter = _mm_set1_ps(0.25f);
+				for (; i + 4 <= TILE_TEXELS / 4; i += 4)
+				{
+					// Transpose 4 blocks so each lane sums one block
+					__m128 b0 = _mm_loadu_ps(fine + 4 * i), b1 = _mm_loadu_ps(fine + 4 * i + 4);
+					__m128 b2 = _mm_loadu_ps(fine + 4 * i + 8), b3 = _mm_loadu_ps(fine + 4 * i + 12);
+					_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+					_mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(_mm_add_ps(b0, b1), _mm_add_ps(b2, b3)), quarter));
+				}
+#endif
+				for (; i < TILE_TEXELS / 4; i++)
+					out[i] = ((fine[4 * i] + fine[4 * i + 1]) + (fine[4 * i + 2] + fine[4 * i + 3])) * 0.25f;
+			}
+		}
+	}, 2, 2);
+
+	coarse.padEdges();
+	return coarse;
+}
+
+void MortonHeights::padEdges()
+{
+	int paddedWidth = tilesX << TILE_SHIFT, paddedHeight = tilesZ << TILE_SHIFT;
+	for (int z = 0; z < height; z++)
+	{
+		float last = get(width - 1, z);
+		for (int x = width; x < paddedWidth; x++)
+			at(x, z) = last;
+	}
+	for (int z = height; z < paddedHeight; z++)
+	{
+		for (int x = 0; x < paddedWidth; x++)
+			at(x, z) = get(x, height - 1);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+/**
+ * Height grid stored in 32x32 tiles, each tile in Morton (Z) order: a 64-byte cache line holds a 4x4 block and a
+ * 4 KB page one whole tile, so columns, blocks and 2D neighbourhoods touch about as few lines and pages as rows do.
+ * Tiles follow each other row by row. The grid is padded to whole tiles by repeating its last row and column.
+ *
+ * A 2x2 block is 4 consecutive texels, so halving a level reads and writes contiguous memory.
+ */
+class MortonHeights
+{
+public:
+	static const int TILE_SHIFT = 5;
+	static const int TILE_SIZE = 1 << TILE_SHIFT;
+	static const int TILE_TEXELS = TILE_SIZE * TILE_SIZE;
+
+	MortonHeights();
+	MortonHeights(int width, int height);
+
+	// Heights (x, z) at source[z * rowStride + x * texelStride], e.g. the y of xyz vertices with texelStride 3
+	static MortonHeights fromRows(const float* source, int width, int height, int rowStride, int texelStride = 1);
+
+	int getWidth() const;
+	int getHeight() const;
+	bool empty() const;
+	size_t getMemoryBytes() const; // tiles, padding included
+
+	float get(int x, int z) const { return data[offset(x, z)]; }
+	float& at(int x, int z) { return data[offset(x, z)]; }
+
+	// count texels starting at (x, z), along a row or down a column
+	void readRow(int x, int z, int count, float* out) const;
+	void readColumn(int x, int z, int count, float* out) const;
+	// The w x h block at (x, z), row-major with outStride floats per row
+	void readBlock(int x, int z, int w, int h, float* out, int outStride) const;
+	void toRows(float* out, int outStride) const;
+
+	// Means of the 2x2 blocks, (width + 1) / 2 by (height + 1) / 2; an odd last row or column repeats itself
+	MortonHeights halve() const;
+
+	// Interleaves the bits of a tile coordinate (0..TILE_SIZE - 1) with zeros
+	static unsigned spread(unsigned value)
+	{
+		value = (value | (value << 4)) & 0x0F0Fu;
+		value = (value | (value << 2)) & 0x3333u;
+		return (value | (value << 1)) & 0x5555u;
+	}
+
+	size_t offset(int x, int z) const
+	{
+		size_t tile = size_t(z >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT);
+		return (tile << (2 * TILE_SHIFT)) | spread(x & (TILE_SIZE - 1)) | (spread(z & (TILE_SIZE - 1)) << 1);
+	}
+
+private:
+	int width, height;
+	int tilesX, tilesZ;
+	std::vector<float> data;
+
+	// Repeats the last column and row into the padding of the edge tiles
+	void padEdges();
+	// readBlock for 4 rows starting at a multiple of 4, a 4x4 block at a time
+	void readQuadRows(int x, int z, int count, float* out, int outStride) const;
+};
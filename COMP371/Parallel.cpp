@@ -0,0 +1,18 @@
+#include "Parallel.h"
+#include "JobSystem.h"
+
+int workerCount()
+{
+	return JobSystem::get().getThreadCount();
+}
+
+void parallelFor(int count, const std::function<void(int begin, int end)>& body, int grainSize)
+{
+	JobSystem::get().parallelFor(count, body, grainSize);
+}
+
+void parallelFor2D(int width, int height, const std::function<void(int x0, int x1, int z0, int z1)>& body,
+	int grainX, int grainZ)
+{
+	JobSystem::get().parallelFor2D(width, height, body, grainX, grainZ);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <functional>
+
+/**
+ * Data-parallel helpers shared by the CPU stages, run as jobs on the JobSystem.
+ * body is called on disjoint sub-ranges from several threads, the caller's included,
+ * and each call returns once the whole range has been processed.
+ */
+int workerCount();
+void parallelFor(int count, const std::function<void(int begin, int end)>& body, int grainSize = 1);
+// Tiles of grainX x grainZ over width x height
+void parallelFor2D(int width, int height, const std::function<void(int x0, int x1, int z0, int z1)>& body,
+	int grainX = 1, int grainZ = 1);
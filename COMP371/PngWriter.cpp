@@ -0,0 +1,113 @@
+#include "PngWriter.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+/* Minimal PNG encoder: zlib "stored" (uncompressed) deflate blocks, so no compression library is needed */
+
+static unsigned int crcTable[256];
+
+static void initCrcTable()
+{
+	for (unsigned int n = 0; n < 256; n++)
+	{
+		unsigned int c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+}
+
+static unsigned int crc32(const unsigned char* data, size_t length, unsigned int crc = 0xFFFFFFFFu)
+{
+	for (size_t i = 0; i < length; i++)
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void putBigEndian(std::vector<unsigned char>& out, unsigned int value)
+{
+	out.push_back(value >> 24);
+	out.push_back(value >> 16);
+	out.push_back(value >> 8);
+	out.push_back(value);
+}
+
+static void writeChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> chunk;
+	putBigEndian(chunk, data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	putBigEndian(chunk, crc32(&chunk[4], chunk.size() - 4) ^ 0xFFFFFFFFu);
+	file.write(reinterpret_cast<const char*>(&chunk[0]), chunk.size());
+}
+
+bool writePng(const std::string& path, int width, int height, const unsigned char* rgb)
+{
+	static bool crcReady = false;
+	if (!crcReady)
+	{
+		initCrcTable();
+		crcReady = true;
+	}
+
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	file.write(reinterpret_cast<const char*>(signature), 8);
+
+	std::vector<unsigned char> header;
+	putBigEndian(header, width);
+	putBigEndian(header, height);
+	header.push_back(8); // bit depth
+	header.push_back(2); // color type RGB
+	header.push_back(0); // deflate
+	header.push_back(0); // adaptive filtering
+	header.push_back(0); // no interlace
+	writeChunk(file, "IHDR", header);
+
+	// Scanlines, each prefixed by filter type 0 (none)
+	size_t rowSize = size_t(width) * 3;
+	std::vector<unsigned char> raw;
+	raw.reserve((rowSize + 1) * height);
+	for (int row = 0; row < height; row++)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb + row * rowSize, rgb + (row + 1) * rowSize);
+	}
+
+	// zlib stream of stored blocks (at most 65535 bytes each) followed by the Adler-32 of the raw data
+	std::vector<unsigned char> zlib;
+	zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+	size_t offset = 0;
+	do
+	{
+		size_t blockSize = std::min<size_t>(65535, raw.size() - offset);
+		bool last = offset + blockSize == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(blockSize & 0xFF);
+		zlib.push_back(blockSize >> 8);
+		zlib.push_back(~blockSize & 0xFF);
+		zlib.push_back((~blockSize >> 8) & 0xFF);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		offset += blockSize;
+	} while (offset < raw.size());
+
+	unsigned int a = 1, b = 0;
+	for (unsigned char byte : raw)
+	{
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	putBigEndian(zlib, (b << 16) | a);
+	writeChunk(file, "IDAT", zlib);
+
+	writeChunk(file, "IEND", std::vector<unsigned char>());
+	return file.good();
+}
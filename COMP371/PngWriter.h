@@ -0,0 +1,5 @@
+#pragma once
+#include <string>
+
+// Writes 8-bit RGB pixels (rows top to bottom, 3 bytes per pixel) to a PNG file, returns false on I/O failure
+bool writePng(const std::string& path, int width, int height, const unsigned char* rgb);
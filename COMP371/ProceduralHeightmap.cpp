@@ -0,0 +1,305 @@
+#include "ProceduralHeightmap.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROCEDURAL_HEIGHTMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+// Lattice hash constants (odd multipliers with well mixed bits)
+static const unsigned int HASH_X = 0x8da6b343u;
+static const unsigned int HASH_Z = 0xd8163841u;
+static const unsigned int HASH_MIX = 0x7feb352du;
+// Each octave gets its own seed and lattice offset so octaves don't line up at the origin
+static const unsigned int OCTAVE_SEED_STEP = 0x9e3779b9u;
+// Diagonal gradient noise stays within about [-0.7, 0.7]; this spreads fBm over most of [0, 1]
+static const float FBM_SCALE = 0.7f;
+
+static unsigned int mixHash(unsigned int hash)
+{
+	hash ^= hash >> 16;
+	hash *= HASH_MIX;
+	hash ^= hash >> 15;
+	return hash;
+}
+
+static float octaveOffset(unsigned int octaveSeed)
+{
+	return (mixHash(octaveSeed) & 0xffff) / 256.0f; // [0, 256) lattice cells, exact in float
+}
+
+static float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+// Dot product of the offset (fx, fz) with one of the four diagonal gradients picked by the low hash bits
+static float gradient(unsigned int hash, float fx, float fz)
+{
+	return ((hash & 1) ? -fx : fx) + ((hash & 2) ? -fz : fz);
+}
+
+static float perlin(float px, float pz, unsigned int seed)
+{
+	float floorX = floorf(px), floorZ = floorf(pz);
+	float fx = px - floorX, fz = pz - floorZ;
+	unsigned int hx0 = (unsigned int)(int)floorX * HASH_X, hx1 = hx0 + HASH_X;
+	unsigned int hz0 = (unsigned int)(int)floorZ * HASH_Z ^ seed, hz1 = ((unsigned int)(int)floorZ + 1) * HASH_Z ^ seed;
+
+	float n00 = gradient(mixHash(hx0 ^ hz0), fx, fz);
+	float n10 = gradient(mixHash(hx1 ^ hz0), fx - 1.0f, fz);
+	float n01 = gradient(mixHash(hx0 ^ hz1), fx, fz - 1.0f);
+	float n11 = gradient(mixHash(hx1 ^ hz1), fx - 1.0f, fz - 1.0f);
+
+	float u = fade(fx), v = fade(fz);
+	float nx0 = n00 + u * (n10 - n00);
+	float nx1 = n01 + u * (n11 - n01);
+	return nx0 + v * (nx1 - nx0);
+}
+
+#ifdef PROCEDURAL_HEIGHTMAP_SSE2
+// SSE2 has no 32-bit low multiply, so multiply the even and odd lanes separately
+static __m128i mulLo32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128i mixHash4(__m128i hash)
+{
+	hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+	hash = mulLo32(hash, _mm_set1_epi32((int)HASH_MIX));
+	return _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+}
+
+static __m128 floor4(__m128 value, __m128i& integer)
+{
+	integer = _mm_cvttps_epi32(value);
+	__m128 truncated = _mm_cvtepi32_ps(integer);
+	// Truncation rounds negative values up: step those back by one
+	__m128i roundedUp = _mm_castps_si128(_mm_cmpgt_ps(truncated, value));
+	integer = _mm_add_epi32(integer, roundedUp); // the mask is -1 where set
+	return _mm_cvtepi32_ps(integer);
+}
+
+static __m128 fade4(__m128 t)
+{
+	__m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+	return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+static __m128 gradient4(__m128i hash, __m128 fx, __m128 fz)
+{
+	// Move hash bit 0 and bit 1 into the float sign bit to negate fx and fz
+	__m128 signX = _mm_castsi128_ps(_mm_slli_epi32(hash, 31));
+	__m128 signZ = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(hash, 1), 31));
+	return _mm_add_ps(_mm_xor_ps(fx, signX), _mm_xor_ps(fz, signZ));
+}
+
+static __m128 perlin4(__m128 px, __m128 pz, unsigned int seed)
+{
+	__m128i ix, iz;
+	__m128 fx = _mm_sub_ps(px, floor4(px, ix));
+	__m128 fz = _mm_sub_ps(pz, floor4(pz, iz));
+	__m128i seed4 = _mm_set1_epi32((int)seed);
+	__m128i hx0 = mulLo32(ix, _mm_set1_epi32((int)HASH_X));
+	__m128i hx1 = _mm_add_epi32(hx0, _mm_set1_epi32((int)HASH_X));
+	__m128i hz0 = _mm_xor_si128(mulLo32(iz, _mm_set1_epi32((int)HASH_Z)), seed4);
+	__m128i hz1 = _mm_xor_si128(mulLo32(_mm_add_epi32(iz, _mm_set1_epi32(1)), _mm_set1_epi32((int)HASH_Z)), seed4);
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 fx1 = _mm_sub_ps(fx, one), fz1 = _mm_sub_ps(fz, one);
+	__m128 n00 = gradient4(mixHash4(_mm_xor_si128(hx0, hz0)), fx, fz);
+	__m128 n10 = gradient4(mixHash4(_mm_xor_si128(hx1, hz0)), fx1, fz);
+	__m128 n01 = gradient4(mixHash4(_mm_xor_si128(hx0, hz1)), fx, fz1);
+	__m128 n11 = gradient4(mixHash4(_mm_xor_si128(hx1, hz1)), fx1, fz1);
+
+	__m128 u = fade4(fx), v = fade4(fz);
+	__m128 nx0 = _mm_add_ps(n00, _mm_mul_ps(u, _mm_sub_ps(n10, n00)));
+	__m128 nx1 = _mm_add_ps(n01, _mm_mul_ps(u, _mm_sub_ps(n11, n01)));
+	return _mm_add_ps(nx0, _mm_mul_ps(v, _mm_sub_ps(nx1, nx0)));
+}
+#endif
+
+ProceduralHeightmap::ProceduralHeightmap(const Parameters& parameters)
+	: parameters(parameters)
+{
+	amplitudeSum = 0.0f;
+	float amplitude = 1.0f;
+	for (int octave = 0; octave < parameters.octaves; octave++)
+	{
+		amplitudeSum += amplitude;
+		amplitude *= parameters.gain;
+	}
+	if (amplitudeSum <= 0.0f) amplitudeSum = 1.0f;
+}
+
+std::shared_ptr<ProceduralHeightmap> ProceduralHeightmap::fromSpec(const std::string& spec)
+{
+	Parameters parameters;
+	std::stringstream specStream(spec);
+	std::string item;
+	while (getline(specStream, item, ','))
+	{
+		size_t equals = item.find('=');
+		std::string key = item.substr(0, equals);
+		std::stringstream value(equals == std::string::npos ? "" : item.substr(equals + 1));
+		bool valid = true;
+		char separator;
+
+		if (key == "size") valid = !!(value >> parameters.width >> separator >> parameters.height) && separator == 'x';
+		else if (key == "seed") valid = !!(value >> parameters.seed);
+		else if (key == "octaves") valid = !!(value >> parameters.octaves);
+		else if (key == "frequency") valid = !!(value >> parameters.frequency);
+		else if (key == "lacunarity") valid = !!(value >> parameters.lacunarity);
+		else if (key == "gain") valid = !!(value >> parameters.gain);
+		else if (key == "type")
+		{
+			std::string type = value.str();
+			valid = type == "fbm" || type == "ridged";
+			parameters.type = type == "ridged" ? RIDGED : FBM;
+		}
+		else valid = false;
+
+		if (!valid)
+		{
+			std::cout << "Invalid procedural heightmap option: " << item << std::endl;
+			return nullptr;
+		}
+	}
+
+	if (parameters.width < 2 || parameters.height < 2 || parameters.octaves < 1)
+	{
+		std::cout << "Procedural heightmap needs a size of at least 2x2 and one octave" << std::endl;
+		return nullptr;
+	}
+	return std::make_shared<ProceduralHeightmap>(parameters);
+}
+
+int ProceduralHeightmap::getWidth() const
+{
+	return parameters.width;
+}
+
+int ProceduralHeightmap::getHeight() const
+{
+	return parameters.height;
+}
+
+float ProceduralHeightmap::sample(int x, int z) const
+{
+	float frequency = parameters.frequency;
+	float amplitude = 1.0f;
+	float sum = 0.0f;
+	float weight = 1.0f; // ridged: sharp ridges of one octave sharpen the next
+
+	for (int octave = 0; octave < parameters.octaves; octave++)
+	{
+		unsigned int octaveSeed = parameters.seed + octave * OCTAVE_SEED_STEP;
+		float offset = octaveOffset(octaveSeed);
+		float noise = perlin(((float)x + offset) * frequency, ((float)z + offset) * frequency, octaveSeed);
+
+		if (parameters.type == RIDGED)
+		{
+			float ridge = 1.0f - fabsf(noise);
+			ridge = ridge * ridge * weight;
+			weight = std::min(std::max(ridge * 2.0f, 0.0f), 1.0f);
+			sum += amplitude * ridge;
+		}
+		else
+		{
+			sum += amplitude * noise;
+		}
+
+		frequency *= parameters.lacunarity;
+		amplitude *= parameters.gain;
+	}
+
+	float height = parameters.type == RIDGED ? sum / amplitudeSum : 0.5f + sum / (amplitudeSum * FBM_SCALE) * 0.5f;
+	return std::min(std::max(height, 0.0f), 1.0f);
+}
+
+void ProceduralHeightmap::readRegion(int x, int z, int width, int height, float* out, int rowStride) const
+{
+	// Tiles follow a fixed TILE_SIZE grid; only those overlapping the region are generated
+	int firstTileX = x / TILE_SIZE, lastTileX = (x + width - 1) / TILE_SIZE;
+	int firstTileZ = z / TILE_SIZE, lastTileZ = (z + height - 1) / TILE_SIZE;
+	int tilesX = lastTileX - firstTileX + 1;
+	int tileCount = tilesX * (lastTileZ - firstTileZ + 1);
+	if (width <= 0 || height <= 0) return;
+
+	parallelFor(tileCount, [&](int begin, int end)
+	{
+		for (int tile = begin; tile < end; tile++)
+		{
+			int tileX = (firstTileX + tile % tilesX) * TILE_SIZE;
+			int tileZ = (firstTileZ + tile / tilesX) * TILE_SIZE;
+			int x0 = std::max(x, tileX), x1 = std::min(x + width, tileX + TILE_SIZE);
+			int z0 = std::max(z, tileZ), z1 = std::min(z + height, tileZ + TILE_SIZE);
+			readTile(x0, z0, x1 - x0, z1 - z0, out + size_t(z0 - z) * rowStride + (x0 - x), rowStride);
+		}
+	});
+}
+
+void ProceduralHeightmap::readTile(int x, int z, int width, int height, float* out, int rowStride) const
+{
+	for (int row = 0; row < height; row++)
+	{
+		float* heights = out + size_t(row) * rowStride;
+		int col = 0;
+
+#ifdef PROCEDURAL_HEIGHTMAP_SSE2
+		// Same operations as sample, 4 texels of the row at a time
+		__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		for (; col + 4 <= width; col += 4)
+		{
+			__m128 texelX = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x + col), _mm_setr_epi32(0, 1, 2, 3)));
+			__m128 texelZ = _mm_set1_ps((float)(z + row));
+			float frequency = parameters.frequency;
+			float amplitude = 1.0f;
+			__m128 sum = zero;
+			__m128 weight = one;
+
+			for (int octave = 0; octave < parameters.octaves; octave++)
+			{
+				unsigned int octaveSeed = parameters.seed + octave * OCTAVE_SEED_STEP;
+				__m128 offset = _mm_set1_ps(octaveOffset(octaveSeed));
+				__m128 frequency4 = _mm_set1_ps(frequency);
+				__m128 noise = perlin4(_mm_mul_ps(_mm_add_ps(texelX, offset), frequency4),
+					_mm_mul_ps(_mm_add_ps(texelZ, offset), frequency4), octaveSeed);
+
+				if (parameters.type == RIDGED)
+				{
+					__m128 ridge = _mm_sub_ps(one, _mm_and_ps(noise, absMask));
+					ridge = _mm_mul_ps(_mm_mul_ps(ridge, ridge), weight);
+					weight = _mm_min_ps(_mm_max_ps(_mm_mul_ps(ridge, _mm_set1_ps(2.0f)), zero), one);
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), ridge));
+				}
+				else
+				{
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), noise));
+				}
+
+				frequency *= parameters.lacunarity;
+				amplitude *= parameters.gain;
+			}
+
+			__m128 result = parameters.type == RIDGED
+				? _mm_div_ps(sum, _mm_set1_ps(amplitudeSum))
+				: _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(_mm_div_ps(sum, _mm_set1_ps(amplitudeSum * FBM_SCALE)), _mm_set1_ps(0.5f)));
+			_mm_storeu_ps(heights + col, _mm_min_ps(_mm_max_ps(result, zero), one));
+		}
+#endif
+
+		for (; col < width; col++)
+			heights[col] = sample(x + col, z + row);
+	}
+}
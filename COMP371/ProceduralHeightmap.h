@@ -0,0 +1,45 @@
+#pragma once
+#include "HeightmapSource.h"
+
+/**
+ * Seeded fBm or ridged Perlin noise heightmap of any size. Nothing is stored: readRegion evaluates the noise
+ * for the requested texels only, one TILE_SIZE tile per task in parallel and 4 texels at a time with SSE2,
+ * so maps far larger than memory can be read in bands. The same seed and parameters always give the same heights.
+ */
+class ProceduralHeightmap : public HeightmapSource
+{
+public:
+	enum Type { FBM, RIDGED };
+
+	struct Parameters
+	{
+		int width = 4096;
+		int height = 4096;
+		unsigned int seed = 1;
+		Type type = FBM;
+		int octaves = 8;
+		float frequency = 1.0f / 512.0f; // of the first octave, in cycles per texel
+		float lacunarity = 2.0f;		 // frequency multiplier between octaves
+		float gain = 0.5f;				 // amplitude multiplier between octaves
+	};
+
+	static const int TILE_SIZE = 256;
+
+	explicit ProceduralHeightmap(const Parameters& parameters);
+
+	// Parses "size=WxH,seed=N,type=fbm|ridged,octaves=N,frequency=F,lacunarity=F,gain=F", every key optional
+	static std::shared_ptr<ProceduralHeightmap> fromSpec(const std::string& spec);
+
+	int getWidth() const override;
+	int getHeight() const override;
+	void readRegion(int x, int z, int width, int height, float* out, int rowStride) const override;
+
+	// Height at a single texel, identical to what readRegion returns for it
+	float sample(int x, int z) const;
+
+private:
+	Parameters parameters;
+	float amplitudeSum; // sum of the octave amplitudes, normalizes the result to [0, 1]
+
+	void readTile(int x, int z, int width, int height, float* out, int rowStride) const;
+};
@@ -0,0 +1,117 @@
+#include "QualityGovernor.h"
+
+#include <algorithm>
+#include <math.h>
+#include <sstream>
+
+// Frames whose median cost makes one decision
+static const size_t WINDOW_FRAMES = 30;
+// Hysteresis band around the target: coarser above target * (1 + OVER_MARGIN), finer below target * UNDER_MARGIN
+static const double OVER_MARGIN = 0.1;
+static const double UNDER_MARGIN = 0.7;
+// A finer mesh aims below the target, so the estimate being off does not overrun it right away
+static const double REFINE_AIM = 0.85;
+// Windows in a row below the band before going finer
+static const int QUIET_WINDOWS = 2;
+// Windows before a skip size that overran may be tried again
+static const int COOLING_WINDOWS = 20;
+// Same range as the set-skip command
+static const int MAX_SKIP = 300;
+
+void QualityGovernor::setTarget(double milliseconds)
+{
+	target = std::max(0.0, milliseconds);
+	windows = 0;
+	overrunSkip = 0;
+	restartWindow(0);
+	decision = isEnabled() ? "starting" : "off";
+}
+
+double QualityGovernor::getTarget() const
+{
+	return target;
+}
+
+bool QualityGovernor::isEnabled() const
+{
+	return target > 0.0;
+}
+
+int QualityGovernor::update(double cpuMilliseconds, double gpuMilliseconds, int skipSize, bool settled)
+{
+	if (!isEnabled()) return 0;
+	lastCpu = cpuMilliseconds;
+	lastGpu = gpuMilliseconds;
+
+	// A mesh on its way, or a skip size changed by hand, starts the measurement over
+	if (!settled || skipSize != observedSkip)
+	{
+		restartWindow(skipSize);
+		if (!settled)
+			decision = "waiting for the mesh";
+		return 0;
+	}
+	costs.push_back(std::max(cpuMilliseconds, gpuMilliseconds));
+	if (costs.size() < WINDOW_FRAMES) return 0;
+
+	std::nth_element(costs.begin(), costs.begin() + costs.size() / 2, costs.end());
+	lastMedian = costs[costs.size() / 2];
+	costs.clear();
+	windows++;
+
+	std::ostringstream text;
+	text.setf(std::ios::fixed);
+	text.precision(1);
+	int newSkip = skipSize;
+	if (lastMedian > target * (1.0 + OVER_MARGIN))
+	{
+		// Triangles, and roughly the cost, go with 1 / skip^2
+		quietWindows = 0;
+		overrunSkip = skipSize;
+		overrunWindow = windows;
+		newSkip = std::min(MAX_SKIP, std::max(skipSize + 1, (int)ceil(skipSize * sqrt(lastMedian / target))));
+		text << (newSkip == skipSize ? "at the coarsest skip " : "coarser, skip ") << skipSize;
+	}
+	else if (lastMedian < target * UNDER_MARGIN && skipSize > 1)
+	{
+		bool cooling = overrunSkip > 0 && windows - overrunWindow < COOLING_WINDOWS;
+		int finest = cooling ? overrunSkip + 1 : 1;
+		if (++quietWindows >= QUIET_WINDOWS)
+			newSkip = std::max(finest, std::min(skipSize - 1, (int)ceil(skipSize * sqrt(lastMedian / (target * REFINE_AIM)))));
+		if (newSkip != skipSize)
+			text << "finer, skip " << skipSize;
+		else if (skipSize <= finest)
+			text << "holding skip " << skipSize << " (skip " << overrunSkip << " overran)";
+		else
+			text << "holding skip " << skipSize << " (under budget)";
+	}
+	else
+	{
+		quietWindows = 0;
+		text << "holding skip " << skipSize;
+	}
+	if (newSkip != skipSize)
+		text << " -> " << newSkip;
+	text << ": median " << lastMedian << " ms, target " << target << " ms";
+	decision = text.str();
+
+	return newSkip == skipSize ? 0 : newSkip;
+}
+
+std::string QualityGovernor::getDecision() const
+{
+	if (!isEnabled()) return decision;
+
+	std::ostringstream text;
+	text.setf(std::ios::fixed);
+	text.precision(1);
+	text << decision << " (last frame CPU " << lastCpu << " ms, GPU " << lastGpu << " ms)";
+	return text.str();
+}
+
+void QualityGovernor::restartWindow(int skipSize)
+{
+	costs.clear();
+	observedSkip = skipSize;
+	quietWindows = 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Picks the skip size that holds the frame time near a target. Each frame reports the CPU time spent on it and
+ * the GPU time of its draw calls; the slower of the two is the frame cost. Once a window of frames is in, the
+ * median cost decides:
+ *
+ *	above target * (1 + OVER_MARGIN)	coarser mesh, scaled by the square root of the overrun (triangles go with 1 / skip^2)
+ *	below target * UNDER_MARGIN		finer mesh aimed below the target, only after QUIET_WINDOWS such windows
+ *	in between				hold
+ *
+ * A skip size that overran is not tried again until COOLING_WINDOWS windows later, so the mesh does not bounce
+ * between a skip size that is too fine and one that is fine.
+ */
+class QualityGovernor
+{
+public:
+	void setTarget(double milliseconds); // 0 turns the governor off
+	double getTarget() const;
+	bool isEnabled() const;
+
+	// Takes the times of a frame drawn at skipSize; settled is false while the mesh changes, as those frames
+	// don't show the cost of any one mesh. Returns the skip size to switch to, or 0 to keep skipSize.
+	int update(double cpuMilliseconds, double gpuMilliseconds, int skipSize, bool settled);
+
+	// Last decision and the costs behind it, one line for the stats
+	std::string getDecision() const;
+
+private:
+	double target = 0.0;
+	std::vector<double> costs; // frame costs of the current window
+	int observedSkip = 0; // skip size the window was measured at
+	int quietWindows = 0; // windows in a row below the lower margin
+	int windows = 0; // windows completed since enabled
+	int overrunSkip = 0; // finest skip size that overran, 0 for none
+	int overrunWindow = 0; // window it overran in
+	double lastCpu = 0.0, lastGpu = 0.0, lastMedian = 0.0;
+	std::string decision = "off";
+
+	void restartWindow(int skipSize);
+};
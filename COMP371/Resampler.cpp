@@ -0,0 +1,224 @@
+#include "Resampler.h"
+#include "MortonHeights.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Smallest number of target rows worth handing to a thread
+static const int RESAMPLE_GRAIN = 8;
+
+static const float PI = 3.14159265f;
+
+static float filterSupport(Resampler::Filter filter)
+{
+	return filter == Resampler::LANCZOS3 ? 3.0f : 2.0f;
+}
+
+static float filterWeight(Resampler::Filter filter, float x)
+{
+	x = fabsf(x);
+	if (filter == Resampler::LANCZOS3)
+	{
+		if (x < 1e-6f) return 1.0f;
+		if (x >= 3.0f) return 0.0f;
+		float piX = PI * x;
+		return 3.0f * sinf(piX) * sinf(piX / 3.0f) / (piX * piX);
+	}
+
+	// Keys cubic with a = -0.5, the Catmull-Rom spline the terrain is refined with
+	if (x < 1.0f) return (1.5f * x - 2.5f) * x * x + 1.0f;
+	if (x < 2.0f) return ((-0.5f * x + 2.5f) * x - 4.0f) * x + 2.0f;
+	return 0.0f;
+}
+
+float Resampler::sourcePosition(int index, int sourceSize, int targetSize)
+{
+	if (targetSize <= 1)
+		return (sourceSize - 1) * 0.5f;
+	return index * (float)(sourceSize - 1) / (targetSize - 1);
+}
+
+bool Resampler::fromName(const std::string& name, Filter& filter)
+{
+	if (name == "bicubic") filter = BICUBIC;
+	else if (name == "lanczos") filter = LANCZOS3;
+	else return false;
+	return true;
+}
+
+Resampler::AxisTable Resampler::buildTable(int sourceSize, int targetSize, Filter filter)
+{
+	// Shrinking stretches the filter over the source texels that fold into one target texel
+	float ratio = targetSize > 1 ? (float)(sourceSize - 1) / (targetSize - 1) : (float)sourceSize;
+	float stretch = std::max(1.0f, ratio);
+	float support = filterSupport(filter) * stretch;
+
+	AxisTable table;
+	table.taps = ((int)ceil(2.0f * support) + 3) & ~3;
+	table.first.resize(targetSize);
+	table.weights.assign(size_t(targetSize) * table.taps, 0.0f);
+
+	for (int i = 0; i < targetSize; i++)
+	{
+		float center = sourcePosition(i, sourceSize, targetSize);
+		int first = (int)ceil(center - support);
+		float* weights = &table.weights[size_t(i) * table.taps];
+		float sum = 0.0f;
+		for (int k = 0; k < table.taps; k++)
+		{
+			weights[k] = filterWeight(filter, (first + k - center) / stretch);
+			sum += weights[k];
+		}
+		for (int k = 0; k < table.taps; k++)
+			weights[k] /= sum;
+		table.first[i] = first;
+	}
+	return table;
+}
+
+namespace
+{
+	// A row-major grid: rows are read in place
+	struct StridedRows
+	{
+		const float* heights;
+		int stride;
+
+		struct Reader
+		{
+			const StridedRows& source;
+
+			// Rows are read in place, so there is no ring of lines to size by the tap count
+			Reader(const StridedRows& source, int) : source(source) {}
+			const float* row(int index) { return source.heights + size_t(index) * source.stride; }
+		};
+	};
+
+	// MortonHeights: rows are unpacked into a ring of one line per tap. The taps of a target row are consecutive
+	// source rows, so they never share a line, and the next target row finds most of them already unpacked.
+	struct TiledRows
+	{
+		const MortonHeights& heights;
+
+		struct Reader
+		{
+			const MortonHeights& heights;
+			int taps;
+			std::vector<float> lines;
+			std::vector<int> lineRows;
+
+			Reader(const TiledRows& source, int taps)
+				: heights(source.heights), taps(taps), lines(size_t(taps) * source.heights.getWidth()), lineRows(taps, -1)
+			{
+			}
+
+			const float* row(int index)
+			{
+				int slot = index % taps;
+				float* line = &lines[size_t(slot) * heights.getWidth()];
+				if (lineRows[slot] != index)
+				{
+					heights.readRow(0, index, heights.getWidth(), line);
+					lineRows[slot] = index;
+				}
+				return line;
+			}
+		};
+	};
+}
+
+template <typename RowSource>
+void Resampler::resampleRows(const RowSource& source, int sourceWidth, int sourceHeight,
+	float* target, int targetWidth, int targetHeight, Filter filter)
+{
+	if (sourceWidth <= 0 || sourceHeight <= 0 || targetWidth <= 0 || targetHeight <= 0)
+		return;
+
+	AxisTable columns = buildTable(sourceWidth, targetWidth, filter);
+	AxisTable rows = buildTable(sourceHeight, targetHeight, filter);
+	// The vertical pass writes a source-width row with this many border texels repeated on each side,
+	// so the horizontal taps never need clamping
+	int pad = columns.taps;
+
+	parallelFor(targetHeight, [&](int begin, int end)
+	{
+		std::vector<float> line(sourceWidth + 2 * pad);
+		std::vector<const float*> sourceRows(rows.taps);
+		typename RowSource::Reader reader(source, rows.taps);
+
+		for (int y = begin; y < end; y++)
+		{
+			// Vertical pass, 4 source columns at a time
+			const float* weights = &rows.weights[size_t(y) * rows.taps];
+			for (int k = 0; k < rows.taps; k++)
+				sourceRows[k] = reader.row(std::min(std::max(rows.first[y] + k, 0), sourceHeight - 1));
+
+			float* out = &line[pad];
+			int x = 0;
+#ifdef RESAMPLER_SSE2
+			for (; x + 4 <= sourceWidth; x += 4)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < rows.taps; k++)
+				{
+					if (weights[k] != 0.0f)
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(sourceRows[k] + x)));
+				}
+				_mm_storeu_ps(out + x, sum);
+			}
+#endif
+			for (; x < sourceWidth; x++)
+			{
+				float sum = 0.0f;
+				for (int k = 0; k < rows.taps; k++)
+				{
+					if (weights[k] != 0.0f)
+						sum += weights[k] * sourceRows[k][x];
+				}
+				out[x] = sum;
+			}
+			std::fill(line.begin(), line.begin() + pad, out[0]);
+			std::fill(line.begin() + pad + sourceWidth, line.end(), out[sourceWidth - 1]);
+
+			// Horizontal pass, 4 taps at a time
+			float* targetRow = target + size_t(y) * targetWidth;
+			for (int i = 0; i < targetWidth; i++)
+			{
+				const float* texels = out + columns.first[i];
+				const float* columnWeights = &columns.weights[size_t(i) * columns.taps];
+#ifdef RESAMPLER_SSE2
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < columns.taps; k += 4)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(columnWeights + k), _mm_loadu_ps(texels + k)));
+				sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+				sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+				targetRow[i] = _mm_cvtss_f32(sum);
+#else
+				float sum = 0.0f;
+				for (int k = 0; k < columns.taps; k++)
+					sum += columnWeights[k] * texels[k];
+				targetRow[i] = sum;
+#endif
+			}
+		}
+	}, RESAMPLE_GRAIN);
+}
+
+void Resampler::resample(const float* source, int sourceWidth, int sourceHeight, int sourceStride,
+	float* target, int targetWidth, int targetHeight, Filter filter)
+{
+	StridedRows rows = { source, sourceStride };
+	resampleRows(rows, sourceWidth, sourceHeight, target, targetWidth, targetHeight, filter);
+}
+
+void Resampler::resample(const MortonHeights& source, float* target, int targetWidth, int targetHeight, Filter filter)
+{
+	TiledRows rows = { source };
+	resampleRows(rows, source.getWidth(), source.getHeight(), target, targetWidth, targetHeight, filter);
+}
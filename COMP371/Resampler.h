@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class MortonHeights;
+
+/**
+ * Resizes a height grid to any width and height, independently per axis, with a bicubic (Catmull-Rom) or Lanczos3
+ * filter. Corner samples are kept: target texel i sits at source position i * (sourceSize - 1) / (targetSize - 1),
+ * and when shrinking the filter is widened by the same ratio so the result doesn't alias.
+ *
+ * The weights of every target row and column are computed once per resample (one set per output phase) and
+ * the grid is filtered vertically then horizontally, a target row at a time, in parallel and with SSE2.
+ */
+class Resampler
+{
+public:
+	enum Filter { BICUBIC, LANCZOS3 };
+
+	static void resample(const float* source, int sourceWidth, int sourceHeight, int sourceStride,
+		float* target, int targetWidth, int targetHeight, Filter filter);
+	// Unpacks each source row from its tiles once per thread, as the target rows reach it
+	static void resample(const MortonHeights& source, float* target, int targetWidth, int targetHeight, Filter filter);
+
+	// Source position of target texel index along an axis
+	static float sourcePosition(int index, int sourceSize, int targetSize);
+
+	// "bicubic" or "lanczos"; false for an unknown name
+	static bool fromName(const std::string& name, Filter& filter);
+
+private:
+	// Filter weights of every target texel along one axis: taps weights starting at source texel first[i]
+	struct AxisTable
+	{
+		int taps;
+		std::vector<int> first;
+		std::vector<float> weights; // taps per target texel, padded with zeros to a multiple of 4
+	};
+
+	static AxisTable buildTable(int sourceSize, int targetSize, Filter filter);
+
+	// Both passes over a source read through RowSource::Reader, which maps a source row index to its texels
+	template <typename RowSource>
+	static void resampleRows(const RowSource& source, int sourceWidth, int sourceHeight,
+		float* target, int targetWidth, int targetHeight, Filter filter);
+};
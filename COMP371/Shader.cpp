@@ -1,47 +1,134 @@
 #include "Shader.h"
 #include <type_ptr.hpp>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
-Shader::Shader(const std::string vertex_shader_path, const std::string fragment_shader_path)
+// Program binaries are stored here, one file per (sources, driver) hash
+static const char* SHADER_CACHE_DIR = "shadercache";
+static const unsigned int SHADER_CACHE_MAGIC = 0x31374253; // "SB71"
+
+static bool readFile(const std::string& path, std::string& contents)
 {
-	// Build and compile our shader program
-	// Vertex shader
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.is_open())
+		return false;
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_shader_path, std::ios::in);
+	std::stringstream buffer;
+	buffer << stream.rdbuf();
+	contents = buffer.str();
+	return true;
+}
 
-	if (VertexShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+// 64-bit FNV-1a
+static unsigned long long hashString(const std::string& text, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
 	}
-	else {
+	return hash;
+}
+
+static std::string glString(GLenum name)
+{
+	const GLubyte* value = glGetString(name);
+	return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+Shader::Shader(const std::string vertex_shader_path, const std::string fragment_shader_path)
+{
+	ID = 0;
+
+	// Read the shader code from the files
+	std::string VertexShaderCode, FragmentShaderCode;
+	if (!readFile(vertex_shader_path, VertexShaderCode)) {
 		printf("Impossible to open %s. Are you in the right directory ?\n", vertex_shader_path.c_str());
-		getchar();
-		exit(-1);
+		status = FAILED;
+		return;
+	}
+	if (!readFile(fragment_shader_path, FragmentShaderCode)) {
+		printf("Impossible to open %s. Are you in the right directory?\n", fragment_shader_path.c_str());
+		status = FAILED;
+		return;
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_shader_path, std::ios::in);
+	// A binary is only valid for the exact sources and the exact driver that produced it
+	unsigned long long hash = hashString(VertexShaderCode);
+	hash = hashString(std::string(1, '\0') + FragmentShaderCode, hash);
+	hash = hashString(glString(GL_VENDOR) + glString(GL_RENDERER) + glString(GL_VERSION), hash);
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bin", hash);
+	cachePath = std::string(SHADER_CACHE_DIR) + "/" + fileName;
 
-	if (FragmentShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	ID = glCreateProgram();
+	if (loadBinary())
+	{
+		status = READY;
+		reflectUniforms();
+		return;
 	}
-	else {
-		printf("Impossible to open %s. Are you in the right directory?\n", fragment_shader_path.c_str());
-		getchar();
-		exit(-1);
+
+	// Let the driver compile on its own threads when it can, poll() then never blocks
+	static bool compilerThreadsSet = false;
+	if (GLEW_ARB_parallel_shader_compile && !compilerThreadsSet)
+	{
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		compilerThreadsSet = true;
 	}
 
-	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	char const * VertexSourcePointer = VertexShaderCode.c_str();
 	glShaderSource(vertexShader, 1, &VertexSourcePointer, NULL);
 	glCompileShader(vertexShader);
+
+	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+	glShaderSource(fragmentShader, 1, &FragmentSourcePointer, NULL);
+	glCompileShader(fragmentShader);
+
+	// Link shaders (compile errors are reported once the link completes)
+	glAttachShader(ID, vertexShader);
+	glAttachShader(ID, fragmentShader);
+	if (GLEW_ARB_get_program_binary)
+		glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(ID);
+	status = COMPILING;
+}
+
+bool Shader::poll()
+{
+	if (status == COMPILING)
+	{
+		if (GLEW_ARB_parallel_shader_compile)
+		{
+			GLint completed = GL_FALSE;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_ARB, &completed);
+			if (!completed)
+				return false;
+		}
+		finishLink();
+	}
+	return status == READY;
+}
+
+bool Shader::isReady() const
+{
+	return status == READY;
+}
+
+bool Shader::hasFailed() const
+{
+	return status == FAILED;
+}
+
+void Shader::finishLink()
+{
 	// Check for compile time errors
 	GLint success;
 	GLchar infoLog[512];
@@ -51,31 +138,127 @@ Shader::Shader(const std::string vertex_shader_path, const std::string fragment_
 		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
 		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
 	}
-	// Fragment shader
-	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(fragmentShader, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(fragmentShader);
-	// Check for compile time errors
 	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
 	if (!success)
 	{
 		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
 		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 	}
-	// Link shaders
-	ID = glCreateProgram();
-	glAttachShader(ID, vertexShader);
-	glAttachShader(ID, fragmentShader);
-	glLinkProgram(ID);
 	// Check for linking errors
 	glGetProgramiv(ID, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(ID, 512, NULL, infoLog);
 		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
 	}
+	glDetachShader(ID, vertexShader);
+	glDetachShader(ID, fragmentShader);
 	glDeleteShader(vertexShader); //free up memory
 	glDeleteShader(fragmentShader);
+
+	if (!success)
+	{
+		status = FAILED;
+		return;
+	}
+
+	status = READY;
+	saveBinary();
+	reflectUniforms();
+}
+
+/**
+ * Loads the program from the binary cache, returns false when there is no usable binary (missing, stale or rejected)
+ */
+bool Shader::loadBinary()
+{
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+
+	std::ifstream file(cachePath, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	unsigned int magic = 0;
+	GLenum format = 0;
+	GLint length = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&format), sizeof(format));
+	file.read(reinterpret_cast<char*>(&length), sizeof(length));
+	if (!file || magic != SHADER_CACHE_MAGIC || length <= 0)
+		return false;
+
+	std::vector<char> binary(length);
+	file.read(binary.data(), length);
+	if (!file)
+		return false;
+
+	// The driver may still reject the binary (e.g. after an update), in which case we compile from source
+	glProgramBinary(ID, format, binary.data(), length);
+	GLint success = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	return success == GL_TRUE;
+}
+
+void Shader::saveBinary() const
+{
+	if (!GLEW_ARB_get_program_binary)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+#ifdef _WIN32
+	_mkdir(SHADER_CACHE_DIR);
+#else
+	mkdir(SHADER_CACHE_DIR, 0755);
+#endif
+	std::ofstream file(cachePath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return;
+
+	file.write(reinterpret_cast<const char*>(&SHADER_CACHE_MAGIC), sizeof(SHADER_CACHE_MAGIC));
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	file.write(binary.data(), length);
+}
+
+/**
+ * Queries the active uniforms and uniform blocks of the linked program once, so setting a uniform never asks the driver
+ */
+void Shader::reflectUniforms()
+{
+	GLint count = 0;
+	GLchar name[256];
+
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(ID, i, sizeof(name), NULL, &size, &type, name);
+		GLint location = glGetUniformLocation(ID, name);
+		if (location < 0) continue; // members of uniform blocks have no location
+
+		// Arrays are reported as "name[0]", store them under their plain name too
+		std::string uniformName = name;
+		uniformLocations[uniformName] = location;
+		size_t bracket = uniformName.find('[');
+		if (bracket != std::string::npos)
+			uniformLocations[uniformName.substr(0, bracket)] = location;
+	}
+
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		glGetActiveUniformBlockName(ID, i, sizeof(name), NULL, name);
+		uniformBlocks[name] = i;
+	}
 }
 
 void Shader::UseProgram()
@@ -83,18 +266,62 @@ void Shader::UseProgram()
 	glUseProgram(ID);
 }
 
+GLint Shader::uniformLocation(const std::string& name) const
+{
+	auto it = uniformLocations.find(name);
+	return it != uniformLocations.end() ? it->second : -1;
+}
+
+GLint Shader::uniformBlockIndex(const std::string& name) const
+{
+	auto it = uniformBlocks.find(name);
+	return it != uniformBlocks.end() ? (GLint)it->second : -1;
+}
+
+void Shader::bindUniformBlock(const std::string& name, GLuint bindingPoint) const
+{
+	GLint blockIndex = uniformBlockIndex(name);
+	if (blockIndex >= 0)
+		glUniformBlockBinding(ID, blockIndex, bindingPoint);
+}
+
 void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+	setMat4(uniformLocation(name), mat);
 }
 
 void Shader::setVec3(const std::string& name, const glm::vec3& vec) const
 {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
+	setVec3(uniformLocation(name), vec);
 }
 
 void Shader::setVec4(const std::string& name, const glm::vec4& vec) const
 {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
+	setVec4(uniformLocation(name), vec);
+}
+
+void Shader::setInt(const std::string& name, int value) const
+{
+	glUniform1i(uniformLocation(name), value);
+}
+
+void Shader::setIVec2(const std::string& name, const glm::ivec2& vec) const
+{
+	glUniform2iv(uniformLocation(name), 1, glm::value_ptr(vec));
+}
+
+void Shader::setMat4(GLint location, const glm::mat4& mat) const
+{
+	glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::setVec3(GLint location, const glm::vec3& vec) const
+{
+	glUniform3fv(location, 1, glm::value_ptr(vec));
+}
+
+void Shader::setVec4(GLint location, const glm::vec4& vec) const
+{
+	glUniform4fv(location, 1, glm::value_ptr(vec));
 }
 
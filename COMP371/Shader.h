@@ -3,6 +3,7 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <unordered_map>
 #include <mat4x2.hpp>
 
 class Shader
@@ -11,14 +12,41 @@ public:
 	// The program ID
 	unsigned int ID;
 
+	// Starts building the program: loaded from the binary cache when possible, otherwise compiled in the background
 	Shader(const std::string vertex_shader_path, const std::string fragment_shader_path);
+	// Call once per frame until it returns true, the program can't be used before that
+	bool poll();
+	bool isReady() const;
+	bool hasFailed() const;
 	void UseProgram();
+
+	// Locations cached at link time (-1 if the uniform is not active)
+	GLint uniformLocation(const std::string &name) const;
+	GLint uniformBlockIndex(const std::string &name) const;
+	void bindUniformBlock(const std::string &name, GLuint bindingPoint) const;
 	
 	// Helper functions to set uniforms (based on learnoopengl.com shader code)
 	void setMat4(const std::string &name, const glm::mat4 &mat) const;
 	void setVec3(const std::string &name, const glm::vec3 &vec) const;
 	void setVec4(const std::string &name, const glm::vec4 &vec) const;
+	void setInt(const std::string &name, int value) const;
+	void setIVec2(const std::string &name, const glm::ivec2 &vec) const;
+	void setMat4(GLint location, const glm::mat4 &mat) const;
+	void setVec3(GLint location, const glm::vec3 &vec) const;
+	void setVec4(GLint location, const glm::vec4 &vec) const;
+
+private:
+	enum STATUS { COMPILING, READY, FAILED };
+	STATUS status = FAILED;
+	GLuint vertexShader = 0, fragmentShader = 0;
+	std::string cachePath;
+	void finishLink();
+	bool loadBinary();
+	void saveBinary() const;
 
+	std::unordered_map<std::string, GLint> uniformLocations;
+	std::unordered_map<std::string, GLuint> uniformBlocks;
+	void reflectUniforms();
 
 };
 
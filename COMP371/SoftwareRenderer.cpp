@@ -0,0 +1,371 @@
+#include "SoftwareRenderer.h"
+#include "Parallel.h"
+#include "PngWriter.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RENDERER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Primitives are set up and rasterized in batches so the binned triangles of huge meshes never all sit in memory
+static const int BATCH_PRIMITIVES = 1 << 20;
+// Smallest number of primitives worth handing to a setup thread
+static const int SETUP_GRAIN = 4096;
+// Barycentric tolerance so float rounding on shared edges can't leave pixel cracks between triangles
+static const float EDGE_EPSILON = -1e-5f;
+
+static unsigned int shadeHeight(float height)
+{
+	// Same as terrain.frag: a gray level equal to the normalized height
+	unsigned int gray = (unsigned int)(glm::clamp(height, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return 0xFF000000u | (gray << 16) | (gray << 8) | gray;
+}
+
+SoftwareRenderer::SoftwareRenderer(int width, int height)
+	: width(width), height(height)
+{
+	stride = (width + 3) & ~3;
+	tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	colorBuffer.resize(size_t(stride) * height);
+	depthBuffer.resize(size_t(stride) * height);
+}
+
+void SoftwareRenderer::clear(const glm::vec4& color)
+{
+	glm::uvec4 rgba = glm::uvec4(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+	unsigned int packed = (rgba.a << 24) | (rgba.b << 16) | (rgba.g << 8) | rgba.r;
+	std::fill(colorBuffer.begin(), colorBuffer.end(), packed);
+	std::fill(depthBuffer.begin(), depthBuffer.end(), 1.0f);
+	primitivesDrawn = 0;
+}
+
+void SoftwareRenderer::drawElements(const std::vector<float>& positions, const std::vector<int>& indices, PrimitiveMode mode,
+	const glm::mat4& mvp, float heightScale)
+{
+	// Vertex stage
+	int vertexCount = positions.size() / 3;
+	clipPositions.resize(vertexCount);
+	heights.resize(vertexCount);
+	parallelFor(vertexCount, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const float* p = &positions[i * 3];
+			clipPositions[i] = mvp * glm::vec4(p[0], p[1] * heightScale, p[2], 1.0f);
+			heights[i] = p[1];
+		}
+	}, SETUP_GRAIN);
+
+	int primitiveCount = mode == POINTS ? (int)indices.size() : (int)indices.size() - 2;
+	for (int batchBegin = 0; batchBegin < primitiveCount; batchBegin += BATCH_PRIMITIVES)
+	{
+		int batchEnd = std::min(batchBegin + BATCH_PRIMITIVES, primitiveCount);
+		int batchSize = batchEnd - batchBegin;
+
+		// Setup and binning: each bin covers a contiguous primitive range so tiles replay them in submission order
+		int binCount = std::max(1, std::min(workerCount() * 4, batchSize / SETUP_GRAIN));
+		bins.resize(binCount);
+		parallelFor(binCount, [&](int begin, int end)
+		{
+			for (int b = begin; b < end; b++)
+			{
+				Bin& bin = bins[b];
+				bin.triangles.clear();
+				bin.points.clear();
+				bin.tiles.resize(tilesX * tilesY);
+				for (std::vector<int>& tile : bin.tiles)
+					tile.clear();
+
+				int first = batchBegin + (long long)batchSize * b / binCount;
+				int last = batchBegin + (long long)batchSize * (b + 1) / binCount;
+				if (mode == POINTS)
+					setupPoints(indices, first, last, bin);
+				else
+					setupTriangles(indices, first, last, bin);
+			}
+		});
+
+		for (const Bin& bin : bins)
+			primitivesDrawn += mode == POINTS ? bin.points.size() : bin.triangles.size();
+
+		// Rasterization: tiles are independent
+		parallelFor(tilesX * tilesY, [&](int begin, int end)
+		{
+			for (int tile = begin; tile < end; tile++)
+				rasterizeTile(tile, mode);
+		});
+	}
+}
+
+void SoftwareRenderer::setupTriangles(const std::vector<int>& indices, int begin, int end, Bin& bin) const
+{
+	for (int i = begin; i < end; i++)
+	{
+		int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+		if (a == b || b == c || a == c) continue; // degenerate triangle joining two strips
+
+		glm::vec4 clip[3] = { clipPositions[a], clipPositions[b], clipPositions[c] };
+		float vertexHeight[3] = { heights[a], heights[b], heights[c] };
+		addTriangle(clip, vertexHeight, bin);
+	}
+}
+
+void SoftwareRenderer::setupPoints(const std::vector<int>& indices, int begin, int end, Bin& bin) const
+{
+	for (int i = begin; i < end; i++)
+	{
+		const glm::vec4& clip = clipPositions[indices[i]];
+		if (clip.w <= 0.0f || fabs(clip.x) > clip.w || fabs(clip.y) > clip.w || fabs(clip.z) > clip.w)
+			continue;
+
+		Point point;
+		point.x = std::min(width - 1, (int)((clip.x / clip.w * 0.5f + 0.5f) * width));
+		point.y = std::min(height - 1, (int)((0.5f - clip.y / clip.w * 0.5f) * height));
+		point.depth = clip.z / clip.w * 0.5f + 0.5f;
+		point.color = shadeHeight(heights[indices[i]]);
+
+		bin.points.push_back(point);
+		binPrimitive(bin, bin.points.size() - 1, point.x, point.y, point.x, point.y);
+	}
+}
+
+void SoftwareRenderer::addTriangle(const glm::vec4* clip, const float* vertexHeight, Bin& bin) const
+{
+	// Trivially reject triangles entirely outside one of the frustum planes
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w) return;
+		if (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w) return;
+	}
+
+	// Clip against the near plane (z >= -w), giving a polygon of up to 4 vertices
+	glm::vec4 polygon[4];
+	float polygonHeight[4];
+	int count = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		int next = (i + 1) % 3;
+		float distance = clip[i].z + clip[i].w;
+		float nextDistance = clip[next].z + clip[next].w;
+		if (distance >= 0.0f)
+		{
+			polygon[count] = clip[i];
+			polygonHeight[count++] = vertexHeight[i];
+		}
+		if ((distance >= 0.0f) != (nextDistance >= 0.0f))
+		{
+			float t = distance / (distance - nextDistance);
+			polygon[count] = clip[i] + t * (clip[next] - clip[i]);
+			polygonHeight[count++] = vertexHeight[i] + t * (vertexHeight[next] - vertexHeight[i]);
+		}
+	}
+
+	// Fan of screen-space triangles
+	for (int k = 1; k + 1 < count; k++)
+	{
+		const int corner[3] = { 0, k, k + 1 };
+		float x[3], y[3], z[3], invW[3], heightOverW[3];
+		for (int v = 0; v < 3; v++)
+		{
+			const glm::vec4& p = polygon[corner[v]];
+			invW[v] = 1.0f / p.w;
+			x[v] = (p.x * invW[v] * 0.5f + 0.5f) * width;
+			y[v] = (0.5f - p.y * invW[v] * 0.5f) * height;
+			z[v] = p.z * invW[v] * 0.5f + 0.5f;
+			heightOverW[v] = polygonHeight[corner[v]] * invW[v];
+		}
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (fabs(area) < 1e-12f) continue;
+
+		Triangle triangle;
+		triangle.minX = std::max(0, (int)floor(std::min(x[0], std::min(x[1], x[2]))));
+		triangle.minY = std::max(0, (int)floor(std::min(y[0], std::min(y[1], y[2]))));
+		triangle.maxX = std::min(width - 1, (int)ceil(std::max(x[0], std::max(x[1], x[2]))));
+		triangle.maxY = std::min(height - 1, (int)ceil(std::max(y[0], std::max(y[1], y[2]))));
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) continue;
+
+		// Planes are expressed relative to the bounding box corner to keep the float edge functions precise
+		for (int v = 0; v < 3; v++)
+		{
+			x[v] -= triangle.minX;
+			y[v] -= triangle.minY;
+		}
+
+		// Barycentric weight of vertex v is the edge function of the opposite edge divided by the area
+		for (int v = 0; v < 3; v++)
+		{
+			int a = (v + 1) % 3, b = (v + 2) % 3;
+			triangle.edges[v].a = -(y[b] - y[a]) / area;
+			triangle.edges[v].b = (x[b] - x[a]) / area;
+			triangle.edges[v].c = ((y[b] - y[a]) * x[a] - (x[b] - x[a]) * y[a]) / area;
+		}
+
+		// Attributes interpolate linearly in screen space as planes of the barycentric weights
+		auto attributePlane = [&](const float* value)
+		{
+			Plane plane;
+			plane.a = triangle.edges[0].a * value[0] + triangle.edges[1].a * value[1] + triangle.edges[2].a * value[2];
+			plane.b = triangle.edges[0].b * value[0] + triangle.edges[1].b * value[1] + triangle.edges[2].b * value[2];
+			plane.c = triangle.edges[0].c * value[0] + triangle.edges[1].c * value[1] + triangle.edges[2].c * value[2];
+			return plane;
+		};
+		triangle.depth = attributePlane(z);
+		triangle.invW = attributePlane(invW);
+		triangle.heightOverW = attributePlane(heightOverW);
+
+		bin.triangles.push_back(triangle);
+		binPrimitive(bin, bin.triangles.size() - 1, triangle.minX, triangle.minY, triangle.maxX, triangle.maxY);
+	}
+}
+
+void SoftwareRenderer::binPrimitive(Bin& bin, int index, int minX, int minY, int maxX, int maxY) const
+{
+	for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+	{
+		for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+			bin.tiles[ty * tilesX + tx].push_back(index);
+	}
+}
+
+void SoftwareRenderer::rasterizeTile(int tile, PrimitiveMode mode)
+{
+	int tileX0 = (tile % tilesX) * TILE_SIZE;
+	int tileY0 = (tile / tilesX) * TILE_SIZE;
+	int tileX1 = std::min(tileX0 + TILE_SIZE, width) - 1;
+	int tileY1 = std::min(tileY0 + TILE_SIZE, height) - 1;
+
+	for (const Bin& bin : bins)
+	{
+		for (int index : bin.tiles[tile])
+		{
+			if (mode == POINTS)
+			{
+				const Point& point = bin.points[index];
+				size_t pixel = size_t(point.y) * stride + point.x;
+				if (point.depth < depthBuffer[pixel])
+				{
+					depthBuffer[pixel] = point.depth;
+					colorBuffer[pixel] = point.color;
+				}
+				continue;
+			}
+
+			const Triangle& triangle = bin.triangles[index];
+			rasterizeTriangle(triangle,
+				std::max(triangle.minX, tileX0), std::max(triangle.minY, tileY0),
+				std::min(triangle.maxX, tileX1), std::min(triangle.maxY, tileY1));
+		}
+	}
+}
+
+void SoftwareRenderer::rasterizeTriangle(const Triangle& triangle, int x0, int y0, int x1, int y1)
+{
+#ifdef SOFTWARE_RENDERER_SSE2
+	const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 edgeEpsilon = _mm_set1_ps(EDGE_EPSILON);
+	const __m128 minX = _mm_set1_ps((float)x0), maxX = _mm_set1_ps((float)x1);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+	for (int y = y0; y <= y1; y++)
+	{
+		float py = y - triangle.minY + 0.5f;
+		// Row constants of every plane: b * py + c
+		__m128 e0Row = _mm_set1_ps(triangle.edges[0].b * py + triangle.edges[0].c);
+		__m128 e1Row = _mm_set1_ps(triangle.edges[1].b * py + triangle.edges[1].c);
+		__m128 e2Row = _mm_set1_ps(triangle.edges[2].b * py + triangle.edges[2].c);
+		__m128 depthRow = _mm_set1_ps(triangle.depth.b * py + triangle.depth.c);
+		__m128 invWRow = _mm_set1_ps(triangle.invW.b * py + triangle.invW.c);
+		__m128 heightRow = _mm_set1_ps(triangle.heightOverW.b * py + triangle.heightOverW.c);
+
+		// Rows are padded to a multiple of 4 pixels, so aligned groups of 4 never leave the row
+		for (int x = x0 & ~3; x <= x1; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+			__m128 center = _mm_add_ps(_mm_set1_ps(x - triangle.minX + 0.5f), laneOffsets);
+
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edges[0].a), center), e0Row);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edges[1].a), center), e1Row);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edges[2].a), center), e2Row);
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, edgeEpsilon), _mm_cmpge_ps(e1, edgeEpsilon)), _mm_cmpge_ps(e2, edgeEpsilon));
+			inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(px, minX), _mm_cmple_ps(px, maxX)));
+			if (!_mm_movemask_ps(inside)) continue;
+
+			size_t pixel = size_t(y) * stride + x;
+			__m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depth.a), center), depthRow);
+			__m128 oldDepth = _mm_loadu_ps(&depthBuffer[pixel]);
+			__m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, oldDepth));
+			if (!_mm_movemask_ps(pass)) continue;
+			_mm_storeu_ps(&depthBuffer[pixel], _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, oldDepth)));
+
+			// Perspective-correct height, shaded as a gray level
+			__m128 invW = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.invW.a), center), invWRow);
+			__m128 heightOverW = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.heightOverW.a), center), heightRow);
+			__m128 level = _mm_div_ps(heightOverW, invW);
+			level = _mm_min_ps(_mm_max_ps(level, zero), _mm_set1_ps(1.0f));
+			__m128i gray = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(level, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+			__m128i color = _mm_or_si128(_mm_or_si128(gray, _mm_slli_epi32(gray, 8)), _mm_or_si128(_mm_slli_epi32(gray, 16), alpha));
+
+			__m128i passMask = _mm_castps_si128(pass);
+			__m128i* target = reinterpret_cast<__m128i*>(&colorBuffer[pixel]);
+			__m128i oldColor = _mm_loadu_si128(target);
+			_mm_storeu_si128(target, _mm_or_si128(_mm_and_si128(passMask, color), _mm_andnot_si128(passMask, oldColor)));
+		}
+	}
+#else
+	for (int y = y0; y <= y1; y++)
+	{
+		float py = y - triangle.minY + 0.5f;
+		for (int x = x0; x <= x1; x++)
+		{
+			float px = x - triangle.minX + 0.5f;
+			auto eval = [&](const Plane& plane) { return plane.a * px + plane.b * py + plane.c; };
+			if (eval(triangle.edges[0]) < EDGE_EPSILON || eval(triangle.edges[1]) < EDGE_EPSILON || eval(triangle.edges[2]) < EDGE_EPSILON)
+				continue;
+
+			size_t pixel = size_t(y) * stride + x;
+			float depth = eval(triangle.depth);
+			if (depth >= depthBuffer[pixel]) continue;
+			depthBuffer[pixel] = depth;
+			colorBuffer[pixel] = shadeHeight(eval(triangle.heightOverW) / eval(triangle.invW));
+		}
+	}
+#endif
+}
+
+bool SoftwareRenderer::writePng(const std::string& path) const
+{
+	std::vector<unsigned char> rgb(size_t(width) * height * 3);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			unsigned int color = colorBuffer[size_t(y) * stride + x];
+			unsigned char* out = &rgb[(size_t(y) * width + x) * 3];
+			out[0] = color & 0xFF;
+			out[1] = (color >> 8) & 0xFF;
+			out[2] = (color >> 16) & 0xFF;
+		}
+	}
+	return ::writePng(path, width, height, &rgb[0]);
+}
+
+int SoftwareRenderer::getWidth() const
+{
+	return width;
+}
+
+int SoftwareRenderer::getHeight() const
+{
+	return height;
+}
+
+unsigned long long SoftwareRenderer::getPrimitivesDrawn() const
+{
+	return primitivesDrawn;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "glm.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * CPU rendering backend for headless machines: a binned, tiled, multithreaded rasterizer with a depth buffer.
+ * Shading matches terrain.frag (gray level = normalized height). Frames can be written out as PNG.
+ *
+ * Each draw runs in three parallel stages: vertex transform, triangle setup/clipping/binning into screen tiles,
+ * and per-tile rasterization (SSE2, 4 pixels at a time) so no two threads ever touch the same pixel.
+ */
+class SoftwareRenderer
+{
+public:
+	static const int TILE_SIZE = 64;
+	enum PrimitiveMode { TRIANGLE_STRIP, POINTS };
+
+	SoftwareRenderer(int width, int height);
+	void clear(const glm::vec4& color);
+
+	// positions are xyz triples; y is the normalized height, scaled by heightScale before the transform
+	void drawElements(const std::vector<float>& positions, const std::vector<int>& indices, PrimitiveMode mode,
+		const glm::mat4& mvp, float heightScale);
+
+	bool writePng(const std::string& path) const;
+	int getWidth() const;
+	int getHeight() const;
+	unsigned long long getPrimitivesDrawn() const;
+
+private:
+	int width, height;
+	int stride; // pixels per row, padded to a multiple of 4 for the SIMD loops
+	int tilesX, tilesY;
+	std::vector<unsigned int> colorBuffer; // RGBA8
+	std::vector<float> depthBuffer;
+	unsigned long long primitivesDrawn = 0;
+
+	// Screen-space plane a*x + b*y + c, with x and y relative to the triangle's (minX, minY)
+	struct Plane
+	{
+		float a, b, c;
+	};
+
+	struct Triangle
+	{
+		Plane edges[3];		// barycentric weights, all >= 0 inside
+		Plane depth;
+		Plane invW;			// 1/w and height/w for perspective-correct shading
+		Plane heightOverW;
+		int minX, minY, maxX, maxY;
+	};
+
+	struct Point
+	{
+		int x, y;
+		float depth;
+		unsigned int color;
+	};
+
+	// Setup results of one contiguous range of primitives, binned per tile
+	struct Bin
+	{
+		std::vector<Triangle> triangles;
+		std::vector<Point> points;
+		std::vector<std::vector<int>> tiles;
+	};
+
+	std::vector<glm::vec4> clipPositions;
+	std::vector<float> heights;
+	std::vector<Bin> bins;
+
+	void setupTriangles(const std::vector<int>& indices, int begin, int end, Bin& bin) const;
+	void setupPoints(const std::vector<int>& indices, int begin, int end, Bin& bin) const;
+	void addTriangle(const glm::vec4* clip, const float* vertexHeight, Bin& bin) const;
+	void binPrimitive(Bin& bin, int index, int minX, int minY, int maxX, int maxY) const;
+	void rasterizeTile(int tile, PrimitiveMode mode);
+	void rasterizeTriangle(const Triangle& triangle, int x0, int y0, int x1, int y1);
+};
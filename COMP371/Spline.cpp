@@ -0,0 +1,422 @@
+#include "Spline.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPLINE_SSE2
+#include <emmintrin.h>
+#endif
+
+int splineSubdivisions(float stepSize)
+{
+	return std::max(1, (int)ceil(1.0f / stepSize));
+}
+
+bool splineBasisFromName(const std::string& name, SplineBasis& basis)
+{
+	if (name == "catmull") basis = CATMULL_ROM;
+	else if (name == "bspline") basis = B_SPLINE;
+	else if (name == "hermite") basis = HERMITE;
+	else if (name == "centripetal") basis = CENTRIPETAL;
+	else return false;
+	return true;
+}
+
+const char* splineBasisName(SplineBasis basis)
+{
+	static const char* names[] = { "catmull", "bspline", "hermite", "centripetal" };
+	return names[basis];
+}
+
+void combineRows(const SplineWeights& weights, const float* c0, const float* c1, const float* c2, const float* c3,
+	int count, float* out)
+{
+	const float* w = weights.w;
+	int i = 0;
+#ifdef SPLINE_SSE2
+	__m128 w0 = _mm_set1_ps(w[0]), w1 = _mm_set1_ps(w[1]), w2 = _mm_set1_ps(w[2]), w3 = _mm_set1_ps(w[3]);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(c0 + i)), _mm_mul_ps(w1, _mm_loadu_ps(c1 + i)));
+		sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(w2, _mm_loadu_ps(c2 + i)), _mm_mul_ps(w3, _mm_loadu_ps(c3 + i))));
+		_mm_storeu_ps(out + i, sum);
+	}
+#endif
+	// Summed in the same order as the SSE2 loop, so a float comes out the same wherever a chunk of columns starts
+	for (; i < count; i++)
+		out[i] = (w[0] * c0[i] + w[1] * c1[i]) + (w[2] * c2[i] + w[3] * c3[i]);
+}
+
+// Fritsch-Butland: the harmonic mean of the neighbouring slopes, zero at a local extremum
+static float monotoneTangent(float before, float after)
+{
+	return before * after > 0.0f ? 2.0f * before * after / (before + after) : 0.0f;
+}
+
+void HermiteBasis::coefficients(const float* p0, const float* p1, const float* p2, const float* p3, float c[4][3])
+{
+	for (int k = 0; k < 3; k++)
+	{
+		c[0][k] = p1[k];
+		c[1][k] = monotoneTangent(p1[k] - p0[k], p2[k] - p1[k]);
+		c[2][k] = p2[k];
+		c[3][k] = monotoneTangent(p2[k] - p1[k], p3[k] - p2[k]);
+	}
+}
+
+static float knotInterval(const float* a, const float* b)
+{
+	float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+	return sqrtf(sqrtf(dx * dx + dy * dy + dz * dz));
+}
+
+// Derivative of monotoneTangent(before, after)
+static float monotoneTangentSlope(float before, float after, float beforeSlope, float afterSlope)
+{
+	if (before * after <= 0.0f)
+		return 0.0f;
+	float sum = before + after;
+	return 2.0f * (after * after * beforeSlope + before * before * afterSlope) / (sum * sum);
+}
+
+void HermiteBasis::acrossCoefficients(const float* p0, const float* p1, const float* p2, const float* p3,
+	const float* a0, const float* a1, const float* a2, const float* a3, float c[4][3])
+{
+	for (int k = 0; k < 3; k++)
+	{
+		c[0][k] = a1[k];
+		c[1][k] = monotoneTangentSlope(p1[k] - p0[k], p2[k] - p1[k], a1[k] - a0[k], a2[k] - a1[k]);
+		c[2][k] = a2[k];
+		c[3][k] = monotoneTangentSlope(p2[k] - p1[k], p3[k] - p2[k], a2[k] - a1[k], a3[k] - a2[k]);
+	}
+}
+
+// Knot intervals of the segment p1 p2 and of its neighbours; repeated points reuse the middle interval
+static void centripetalKnots(const float* p0, const float* p1, const float* p2, const float* p3, float dt[3])
+{
+	dt[1] = knotInterval(p1, p2);
+	if (dt[1] < 1e-4f) dt[1] = 1.0f;
+	dt[0] = knotInterval(p0, p1);
+	if (dt[0] < 1e-4f) dt[0] = dt[1];
+	dt[2] = knotInterval(p2, p3);
+	if (dt[2] < 1e-4f) dt[2] = dt[1];
+}
+
+// Hermite coefficients of the non-uniform Catmull-Rom segment with knot intervals dt, rescaled to u in [0, 1]
+static void centripetalCoefficients(const float* p0, const float* p1, const float* p2, const float* p3, const float dt[3], float c[4][3])
+{
+	for (int k = 0; k < 3; k++)
+	{
+		c[0][k] = p1[k];
+		c[1][k] = ((p1[k] - p0[k]) / dt[0] - (p2[k] - p0[k]) / (dt[0] + dt[1]) + (p2[k] - p1[k]) / dt[1]) * dt[1];
+		c[2][k] = p2[k];
+		c[3][k] = ((p2[k] - p1[k]) / dt[1] - (p3[k] - p1[k]) / (dt[1] + dt[2]) + (p3[k] - p2[k]) / dt[2]) * dt[1];
+	}
+}
+
+void CentripetalBasis::coefficients(const float* p0, const float* p1, const float* p2, const float* p3, float c[4][3])
+{
+	float dt[3];
+	centripetalKnots(p0, p1, p2, p3, dt);
+	centripetalCoefficients(p0, p1, p2, p3, dt, c);
+}
+
+void CentripetalBasis::acrossCoefficients(const float* p0, const float* p1, const float* p2, const float* p3,
+	const float* a0, const float* a1, const float* a2, const float* a3, float c[4][3])
+{
+	// Linear in the points for fixed knots
+	float dt[3];
+	centripetalKnots(p0, p1, p2, p3, dt);
+	centripetalCoefficients(a0, a1, a2, a3, dt, c);
+}
+
+// Segments with compile-time tables and unrolled loops
+template <class Basis, int N>
+struct FixedSegments
+{
+	typedef SplineKernel<Basis, N> Kernel;
+
+	int subdivisions() const { return N; }
+	void rows(const float* const p[4], int count, float* out, int outStride) const { Kernel::rows(p, count, out, outStride); }
+	void rowsAlong(const float* const p[4], int count, float* along, int outStride) const { Kernel::rowsAlong(p, count, along, outStride); }
+	void rowsNormal(const float* const p[4], const float* const a[4], int count, float* along, float* across, float* normals, int outStride) const
+	{
+		Kernel::rowsNormal(p, a, count, along, across, normals, outStride);
+	}
+	void vertex(const float c[4][3], float* out, int outStride) const { Kernel::vertex(c, out, outStride); }
+	void vertexAlong(const float c[4][3], float* along, int outStride) const { Kernel::vertexAlong(c, along, outStride); }
+	void vertexNormal(const float c[4][3], const float a[4][3], float* normals, int outStride) const
+	{
+		Kernel::vertexNormal(c, a, normals, outStride);
+	}
+};
+
+// Any other subdivision count, or only the end of a segment (u = 1)
+template <class Basis>
+struct RuntimeSegments
+{
+	std::vector<SplineWeights> values, slopes;
+
+	explicit RuntimeSegments(int n, bool segmentEnd = false) : values(segmentEnd ? 1 : n), slopes(values.size())
+	{
+		for (size_t s = 0; s < values.size(); s++)
+		{
+			float u = segmentEnd ? 1.0f : (float)s / n;
+			values[s] = Basis::weights(u);
+			slopes[s] = Basis::derivatives(u);
+		}
+	}
+
+	int subdivisions() const { return (int)values.size(); }
+	void rows(const float* const p[4], int count, float* out, int outStride) const
+	{
+		for (size_t s = 0; s < values.size(); s++)
+			combineRows(values[s], p[0], p[1], p[2], p[3], count, out + s * outStride);
+	}
+	void rowsAlong(const float* const p[4], int count, float* along, int outStride) const
+	{
+		for (size_t s = 0; s < slopes.size(); s++)
+			combineRows(slopes[s], p[0], p[1], p[2], p[3], count, along + s * outStride);
+	}
+	void rowsNormal(const float* const p[4], const float* const a[4], int count, float* along, float* across, float* normals, int outStride) const
+	{
+		for (size_t s = 0; s < values.size(); s++)
+		{
+			combineRows(slopes[s], p[0], p[1], p[2], p[3], count, along);
+			combineRows(values[s], a[0], a[1], a[2], a[3], count, across);
+			for (int i = 0; i < count; i += 3)
+				splineNormal(along + i, across + i, normals + s * outStride + i);
+		}
+	}
+	void vertex(const float c[4][3], float* out, int outStride) const
+	{
+		for (size_t s = 0; s < values.size(); s++)
+			combineVertex(values[s], c, out + s * outStride);
+	}
+	void vertexAlong(const float c[4][3], float* along, int outStride) const
+	{
+		for (size_t s = 0; s < slopes.size(); s++)
+			combineVertex(slopes[s], c, along + s * outStride);
+	}
+	void vertexNormal(const float c[4][3], const float a[4][3], float* normals, int outStride) const
+	{
+		for (size_t s = 0; s < values.size(); s++)
+		{
+			float along[3], across[3];
+			combineVertex(slopes[s], c, along);
+			combineVertex(values[s], a, across);
+			splineNormal(along, across, normals + s * outStride);
+		}
+	}
+};
+
+// Control rows of one curve set, extended past the ends for approximating bases
+template <class Basis>
+struct ControlRows
+{
+	const float* points;
+	int count, pointStride;
+	std::vector<float> before, after;
+
+	ControlRows(const float* points, int count, int pointStride, int rowFloats) : points(points), count(count), pointStride(pointStride)
+	{
+		if (Basis::INTERPOLATING || !points)
+			return;
+		// Reflected control points, so the curve still ends on the end points
+		before.resize(rowFloats);
+		after.resize(rowFloats);
+		const float* last = row(count - 1);
+		for (int i = 0; i < rowFloats; i++)
+		{
+			before[i] = 2.0f * points[i] - points[pointStride + i];
+			after[i] = 2.0f * last[i] - row(count - 2)[i];
+		}
+	}
+
+	// Interpolating bases never read past the ends (their end segments are linear) and clamp
+	const float* row(int k) const
+	{
+		if (k < 0) return Basis::INTERPOLATING ? points : before.data();
+		if (k >= count) return Basis::INTERPOLATING ? row(count - 1) : after.data();
+		return points + size_t(k) * pointStride;
+	}
+};
+
+// Coefficients of one lane of a segment (q) and of its across derivative (a, when not null)
+template <class Basis, bool End>
+struct LaneCoefficients
+{
+	static void get(const float* const q[4], const float* const a[4], float c[4][3], float ca[4][3])
+	{
+		Basis::coefficients(q[0], q[1], q[2], q[3], c);
+		if (a[0])
+			Basis::acrossCoefficients(q[0], q[1], q[2], q[3], a[0], a[1], a[2], a[3], ca);
+	}
+};
+
+template <class Basis>
+struct LaneCoefficients<Basis, true>
+{
+	static void get(const float* const q[4], const float* const a[4], float c[4][3], float ca[4][3])
+	{
+		Basis::endCoefficients(q[1], q[2], c);
+		if (a[0])
+			Basis::endCoefficients(a[1], a[2], ca);
+	}
+};
+
+// Points (and derivatives) of one segment; segmentOut, along and normals point at its first refined point
+template <class Basis, bool End, class Segments>
+static void refineSegment(const Segments& segments, const float* const p[4], const float* const a[4], int lanes, bool wholeRows,
+	float* segmentOut, float* along, float* normals, int outStride, std::vector<float>& scratch)
+{
+	int rowFloats = lanes * 3;
+	if (Basis::UNIFORM && wholeRows)
+	{
+		// Every lane shares the weights: whole rows at once
+		const float* q[4] = { p[0], p[1], p[2], p[3] };
+		const float* qa[4] = { a[0], a[1], a[2], a[3] };
+		if (End)
+		{
+			// The linear end basis weights p1 and p2 only
+			q[0] = q[1];
+			q[3] = q[2];
+			qa[0] = qa[1];
+			qa[3] = qa[2];
+		}
+		segments.rows(q, rowFloats, segmentOut, outStride);
+		if (along)
+			segments.rowsAlong(q, rowFloats, along, outStride);
+		if (normals)
+		{
+			scratch.resize(2 * rowFloats);
+			segments.rowsNormal(q, qa, rowFloats, &scratch[0], &scratch[rowFloats], normals, outStride);
+		}
+		return;
+	}
+
+	for (int lane = 0; lane < lanes; lane++)
+	{
+		int offset = lane * 3;
+		const float* q[4] = { p[0] + offset, p[1] + offset, p[2] + offset, p[3] + offset };
+		const float* qa[4] = { nullptr, nullptr, nullptr, nullptr };
+		if (normals)
+		{
+			for (int k = 0; k < 4; k++)
+				qa[k] = a[k] + offset;
+		}
+		float c[4][3], ca[4][3];
+		LaneCoefficients<Basis, End>::get(q, qa, c, ca);
+
+		segments.vertex(c, segmentOut + offset, outStride);
+		if (along)
+			segments.vertexAlong(c, along + offset, outStride);
+		if (normals)
+			segments.vertexNormal(c, ca, normals + offset, outStride);
+	}
+}
+
+template <class Basis, class Segments, class EndSegments>
+static void refine(const Segments& segments, const EndSegments& endSegments, const float* points, int count, int pointStride,
+	int lanes, float* out, int outStride, const SplineDerivatives& derivatives)
+{
+	typedef typename Basis::EndBasis EndBasis;
+	int n = segments.subdivisions();
+	int rowFloats = lanes * 3;
+	ControlRows<Basis> rows(points, count, pointStride, rowFloats);
+	ControlRows<Basis> acrossRows(derivatives.normals ? derivatives.across : nullptr, count, pointStride, rowFloats);
+	std::vector<float> scratch;
+	// A set of columns goes a row at a time even when it is one column wide, so each column comes out the same
+	// however the columns are split into sets
+	bool wholeRows = lanes > 1 || pointStride > 3;
+
+	auto segmentRows = [&](int segment, const ControlRows<Basis>& control, const float* p[4])
+	{
+		for (int k = 0; k < 4; k++)
+			p[k] = control.points ? control.row(segment - 1 + k) : nullptr;
+	};
+	auto offset = [&](float* base, int point) { return base ? base + size_t(point) * outStride : nullptr; };
+
+	for (int segment = 0; segment < count - 1; segment++)
+	{
+		const float* p[4];
+		const float* a[4];
+		segmentRows(segment, rows, p);
+		segmentRows(segment, acrossRows, a);
+		int first = segment * n;
+		if (Basis::INTERPOLATING && (segment == 0 || segment == count - 2))
+			refineSegment<EndBasis, true>(endSegments, p, a, lanes, wholeRows, offset(out, first), offset(derivatives.along, first), offset(derivatives.normals, first), outStride, scratch);
+		else
+			refineSegment<Basis, false>(segments, p, a, lanes, wholeRows, offset(out, first), offset(derivatives.along, first), offset(derivatives.normals, first), outStride, scratch);
+	}
+
+	// The last control point closes the curve; its derivatives are the end (u = 1) of the last segment
+	int last = (count - 1) * n;
+	if (derivatives.along || derivatives.normals)
+	{
+		const float* p[4];
+		const float* a[4];
+		segmentRows(count - 2, rows, p);
+		segmentRows(count - 2, acrossRows, a);
+		if (Basis::INTERPOLATING)
+			refineSegment<EndBasis, true>(RuntimeSegments<EndBasis>(n, true), p, a, lanes, wholeRows, offset(out, last), offset(derivatives.along, last), offset(derivatives.normals, last), outStride, scratch);
+		else
+			refineSegment<Basis, false>(RuntimeSegments<Basis>(n, true), p, a, lanes, wholeRows, offset(out, last), offset(derivatives.along, last), offset(derivatives.normals, last), outStride, scratch);
+	}
+	memcpy(out + size_t(last) * outStride, rows.row(count - 1), rowFloats * sizeof(float));
+}
+
+template <class Basis, int N>
+static void refineFixed(const float* points, int count, int pointStride, int lanes, float* out, int outStride, const SplineDerivatives& derivatives)
+{
+	refine<Basis>(FixedSegments<Basis, N>(), FixedSegments<typename Basis::EndBasis, N>(), points, count, pointStride, lanes, out, outStride, derivatives);
+}
+
+template <class Basis>
+static void refineBasis(int subdivisions, const float* points, int count, int pointStride, int lanes, float* out, int outStride,
+	const SplineDerivatives& derivatives)
+{
+	switch (subdivisions)
+	{
+	case 1: refineFixed<Basis, 1>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 2: refineFixed<Basis, 2>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 3: refineFixed<Basis, 3>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 4: refineFixed<Basis, 4>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 5: refineFixed<Basis, 5>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 8: refineFixed<Basis, 8>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	case 10: refineFixed<Basis, 10>(points, count, pointStride, lanes, out, outStride, derivatives); break;
+	default:
+		refine<Basis>(RuntimeSegments<Basis>(subdivisions), RuntimeSegments<typename Basis::EndBasis>(subdivisions),
+			points, count, pointStride, lanes, out, outStride, derivatives);
+		break;
+	}
+}
+
+void refineSpline(SplineBasis basis, int subdivisions, const float* points, int count, int pointStride, int lanes,
+	float* out, int outStride, const SplineDerivatives* derivatives)
+{
+	if (count <= 0 || lanes <= 0)
+		return;
+	if (count == 1)
+	{
+		memcpy(out, points, lanes * 3 * sizeof(float));
+		return;
+	}
+
+	SplineDerivatives outputs = { nullptr, nullptr, nullptr };
+	if (derivatives)
+		outputs = *derivatives;
+	if (!outputs.across)
+		outputs.normals = nullptr;
+
+	switch (basis)
+	{
+	case CATMULL_ROM: refineBasis<CatmullRomBasis>(subdivisions, points, count, pointStride, lanes, out, outStride, outputs); break;
+	case B_SPLINE: refineBasis<BSplineBasis>(subdivisions, points, count, pointStride, lanes, out, outStride, outputs); break;
+	case HERMITE: refineBasis<HermiteBasis>(subdivisions, points, count, pointStride, lanes, out, outStride, outputs); break;
+	case CENTRIPETAL: refineBasis<CentripetalBasis>(subdivisions, points, count, pointStride, lanes, out, outStride, outputs); break;
+	}
+}
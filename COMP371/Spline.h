@@ -0,0 +1,310 @@
+#pragma once
+#include <math.h>
+#include <string>
+#include <utility>
+
+/**
+ * Cubic spline refinement shared by the Catmull-Rom passes of Terrain.
+ *
+ * A basis is a policy: constexpr weights(u) of its four coefficients, and how the coefficients come from the four
+ * control points around a segment. Uniform bases weight the control points directly, so a whole row of curves
+ * is one weighted sum of four rows; Hermite-form bases derive tangents per vertex first.
+ * Common subdivision counts get their weights as compile-time tables and fully unrolled segment loops
+ * (SplineKernel); refineSpline picks the instantiation at run time and falls back to a runtime table otherwise.
+ */
+enum SplineBasis { CATMULL_ROM, B_SPLINE, HERMITE, CENTRIPETAL };
+
+// Points per control segment for a step size, ceil(1 / stepSize) as the GPU path computes it
+int splineSubdivisions(float stepSize);
+
+// "catmull", "bspline", "hermite" or "centripetal"; false for an unknown name
+bool splineBasisFromName(const std::string& name, SplineBasis& basis);
+const char* splineBasisName(SplineBasis basis);
+
+/**
+ * Optional outputs of refineSpline, laid out like its out points. along receives the derivative of the refined
+ * curves with respect to u. With across, the derivative of the control points in the other surface direction
+ * (laid out like the points, e.g. the along output of refining the other axis), normals receives the normalized
+ * cross(along, across refined like the points): the analytic normals of the tensor product surface, computed in
+ * the same loop as the positions. Centripetal knots are treated as constant across the curves.
+ */
+struct SplineDerivatives
+{
+	float* along;
+	const float* across;
+	float* normals;
+};
+
+/**
+ * Refines lanes side by side curves of count control points into (count - 1) * subdivisions + 1 points each.
+ * Control point k of lane j is the xyz at points[k * pointStride + j * 3], refined point m of lane j is written
+ * to out[m * outStride + j * 3]; point m sits at u = (m % subdivisions) / subdivisions of its segment.
+ * Interpolating bases refine the first and last segments linearly (they have no outer neighbour), the
+ * B-spline reflects the end points instead so it still ends on them.
+ */
+void refineSpline(SplineBasis basis, int subdivisions, const float* points, int count, int pointStride, int lanes,
+	float* out, int outStride, const SplineDerivatives* derivatives = nullptr);
+
+struct SplineWeights
+{
+	float w[4];
+};
+
+/* Bases: the weights and their derivatives are single expressions so they stay constexpr in C++11 */
+
+struct LinearBasis;
+
+// The weights apply to the control points themselves
+struct UniformForm
+{
+	static const bool UNIFORM = true;
+	typedef LinearBasis EndBasis; // of the end segments of interpolating bases
+
+	static void coefficients(const float* p0, const float* p1, const float* p2, const float* p3, float c[4][3])
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			c[0][k] = p0[k];
+			c[1][k] = p1[k];
+			c[2][k] = p2[k];
+			c[3][k] = p3[k];
+		}
+	}
+	static void acrossCoefficients(const float*, const float*, const float*, const float*,
+		const float* a0, const float* a1, const float* a2, const float* a3, float c[4][3])
+	{
+		coefficients(a0, a1, a2, a3, c);
+	}
+	static void endCoefficients(const float* p1, const float* p2, float c[4][3])
+	{
+		coefficients(p1, p1, p2, p2, c);
+	}
+};
+
+// Straight line between p1 and p2, for the end segments of interpolating bases
+struct LinearBasis : UniformForm
+{
+	static const bool INTERPOLATING = true;
+	static constexpr SplineWeights weights(float u)
+	{
+		return SplineWeights{ { 0.0f, 1.0f - u, u, 0.0f } };
+	}
+	static constexpr SplineWeights derivatives(float)
+	{
+		return SplineWeights{ { 0.0f, -1.0f, 1.0f, 0.0f } };
+	}
+};
+
+struct CatmullRomBasis : UniformForm
+{
+	static const bool INTERPOLATING = true;
+	static constexpr SplineWeights weights(float u)
+	{
+		return SplineWeights{ {
+			0.5f * (-u + 2.0f * u * u - u * u * u),
+			0.5f * (2.0f - 5.0f * u * u + 3.0f * u * u * u),
+			0.5f * (u + 4.0f * u * u - 3.0f * u * u * u),
+			0.5f * (-u * u + u * u * u) } };
+	}
+	static constexpr SplineWeights derivatives(float u)
+	{
+		return SplineWeights{ {
+			0.5f * (-1.0f + 4.0f * u - 3.0f * u * u),
+			0.5f * (-10.0f * u + 9.0f * u * u),
+			0.5f * (1.0f + 8.0f * u - 9.0f * u * u),
+			0.5f * (-2.0f * u + 3.0f * u * u) } };
+	}
+};
+
+// Uniform cubic B-spline: C2 and smoother than Catmull-Rom, but it only passes near the control points
+struct BSplineBasis : UniformForm
+{
+	static const bool INTERPOLATING = false;
+	static constexpr SplineWeights weights(float u)
+	{
+		return SplineWeights{ {
+			(1.0f - u) * (1.0f - u) * (1.0f - u) / 6.0f,
+			(3.0f * u * u * u - 6.0f * u * u + 4.0f) / 6.0f,
+			(-3.0f * u * u * u + 3.0f * u * u + 3.0f * u + 1.0f) / 6.0f,
+			u * u * u / 6.0f } };
+	}
+	static constexpr SplineWeights derivatives(float u)
+	{
+		return SplineWeights{ {
+			-0.5f * (1.0f - u) * (1.0f - u),
+			0.5f * (3.0f * u * u - 4.0f * u),
+			0.5f * (-3.0f * u * u + 2.0f * u + 1.0f),
+			0.5f * u * u } };
+	}
+};
+
+// Cubic Hermite weights of p1, m1, p2, m2
+struct HermiteForm
+{
+	static const bool UNIFORM = false;
+	static const bool INTERPOLATING = true;
+	typedef HermiteForm EndBasis;
+
+	static constexpr SplineWeights weights(float u)
+	{
+		return SplineWeights{ {
+			2.0f * u * u * u - 3.0f * u * u + 1.0f,
+			u * u * u - 2.0f * u * u + u,
+			-2.0f * u * u * u + 3.0f * u * u,
+			u * u * u - u * u } };
+	}
+	static constexpr SplineWeights derivatives(float u)
+	{
+		return SplineWeights{ {
+			6.0f * u * u - 6.0f * u,
+			3.0f * u * u - 4.0f * u + 1.0f,
+			-6.0f * u * u + 6.0f * u,
+			3.0f * u * u - 2.0f * u } };
+	}
+
+	// Both tangents along the chord: the straight line
+	static void endCoefficients(const float* p1, const float* p2, float c[4][3])
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			c[0][k] = p1[k];
+			c[1][k] = c[3][k] = p2[k] - p1[k];
+			c[2][k] = p2[k];
+		}
+	}
+};
+
+// Hermite with monotone (Fritsch-Butland) tangents per component: no overshoot past the control heights
+struct HermiteBasis : HermiteForm
+{
+	static void coefficients(const float* p0, const float* p1, const float* p2, const float* p3, float c[4][3]);
+	static void acrossCoefficients(const float* p0, const float* p1, const float* p2, const float* p3,
+		const float* a0, const float* a1, const float* a2, const float* a3, float c[4][3]);
+};
+
+// Catmull-Rom with knots spaced by the square root of the control point distances: no cusps or self loops
+struct CentripetalBasis : HermiteForm
+{
+	static void coefficients(const float* p0, const float* p1, const float* p2, const float* p3, float c[4][3]);
+	static void acrossCoefficients(const float* p0, const float* p1, const float* p2, const float* p3,
+		const float* a0, const float* a1, const float* a2, const float* a3, float c[4][3]);
+};
+
+// Tables of the derivative weights
+template <class Basis>
+struct SplineDerivative
+{
+	static constexpr SplineWeights weights(float u)
+	{
+		return Basis::derivatives(u);
+	}
+};
+
+// Weights of the subdivisions points of a segment, u = i / subdivisions, built at compile time
+template <class Basis, int N, class Indices = std::make_integer_sequence<int, N> >
+struct SplineTable;
+
+template <class Basis, int N, int... I>
+struct SplineTable<Basis, N, std::integer_sequence<int, I...> >
+{
+	static constexpr SplineWeights weights[N] = { Basis::weights(float(I) / N)... };
+};
+
+template <class Basis, int N, int... I>
+constexpr SplineWeights SplineTable<Basis, N, std::integer_sequence<int, I...> >::weights[N];
+
+// Weighted sum of four coefficient arrays of count floats
+void combineRows(const SplineWeights& weights, const float* c0, const float* c1, const float* c2, const float* c3,
+	int count, float* out);
+
+// Normalized cross(along, across), zero for a degenerate pair
+inline void splineNormal(const float* along, const float* across, float* normal)
+{
+	float x = along[1] * across[2] - along[2] * across[1];
+	float y = along[2] * across[0] - along[0] * across[2];
+	float z = along[0] * across[1] - along[1] * across[0];
+	float length = sqrtf(x * x + y * y + z * z);
+	float scale = length > 0.0f ? 1.0f / length : 0.0f;
+	normal[0] = x * scale;
+	normal[1] = y * scale;
+	normal[2] = z * scale;
+}
+
+// Weighted sum of four xyz coefficients
+inline void combineVertex(const SplineWeights& weights, const float c[4][3], float* out)
+{
+	const float* w = weights.w;
+	out[0] = w[0] * c[0][0] + w[1] * c[1][0] + w[2] * c[2][0] + w[3] * c[3][0];
+	out[1] = w[0] * c[0][1] + w[1] * c[1][1] + w[2] * c[2][1] + w[3] * c[3][1];
+	out[2] = w[0] * c[0][2] + w[1] * c[1][2] + w[2] * c[2][2] + w[3] * c[3][2];
+}
+
+/**
+ * The N points of one segment, unrolled at compile time: point S is written to out + S * outStride
+ */
+template <class Basis, int N, int S = 0>
+struct SplineKernel
+{
+	typedef SplineTable<Basis, N> Values;
+	typedef SplineTable<SplineDerivative<Basis>, N> Slopes;
+
+	// Every float of the four control rows
+	static void rows(const float* const p[4], int count, float* out, int outStride)
+	{
+		combineRows(Values::weights[S], p[0], p[1], p[2], p[3], count, out + S * outStride);
+		SplineKernel<Basis, N, S + 1>::rows(p, count, out, outStride);
+	}
+
+	// Derivatives along the curves of rows()
+	static void rowsAlong(const float* const p[4], int count, float* along, int outStride)
+	{
+		combineRows(Slopes::weights[S], p[0], p[1], p[2], p[3], count, along + S * outStride);
+		SplineKernel<Basis, N, S + 1>::rowsAlong(p, count, along, outStride);
+	}
+
+	// Normals of rows() from the across rows a; along and across are scratch rows of count floats
+	static void rowsNormal(const float* const p[4], const float* const a[4], int count, float* along, float* across,
+		float* normals, int outStride)
+	{
+		combineRows(Slopes::weights[S], p[0], p[1], p[2], p[3], count, along);
+		combineRows(Values::weights[S], a[0], a[1], a[2], a[3], count, across);
+		float* normal = normals + S * outStride;
+		for (int i = 0; i < count; i += 3)
+			splineNormal(along + i, across + i, normal + i);
+		SplineKernel<Basis, N, S + 1>::rowsNormal(p, a, count, along, across, normals, outStride);
+	}
+
+	// One xyz vertex from its four coefficients
+	static void vertex(const float c[4][3], float* out, int outStride)
+	{
+		combineVertex(Values::weights[S], c, out + S * outStride);
+		SplineKernel<Basis, N, S + 1>::vertex(c, out, outStride);
+	}
+
+	static void vertexAlong(const float c[4][3], float* along, int outStride)
+	{
+		combineVertex(Slopes::weights[S], c, along + S * outStride);
+		SplineKernel<Basis, N, S + 1>::vertexAlong(c, along, outStride);
+	}
+
+	// From the coefficients c and the coefficients of the across derivative a
+	static void vertexNormal(const float c[4][3], const float a[4][3], float* normals, int outStride)
+	{
+		float along[3], across[3];
+		combineVertex(Slopes::weights[S], c, along);
+		combineVertex(Values::weights[S], a, across);
+		splineNormal(along, across, normals + S * outStride);
+		SplineKernel<Basis, N, S + 1>::vertexNormal(c, a, normals, outStride);
+	}
+};
+
+template <class Basis, int N>
+struct SplineKernel<Basis, N, N>
+{
+	static void rows(const float* const[4], int, float*, int) {}
+	static void rowsAlong(const float* const[4], int, float*, int) {}
+	static void rowsNormal(const float* const[4], const float* const[4], int, float*, float*, float*, int) {}
+	static void vertex(const float[4][3], float*, int) {}
+	static void vertexAlong(const float[4][3], float*, int) {}
+	static void vertexNormal(const float[4][3], const float[4][3], float*, int) {}
+};
@@ -0,0 +1,363 @@
+#include "StreamedRefinement.h"
+#include "HeightFilter.h"
+#include "JobSystem.h"
+#include "Parallel.h"
+#include "TileFarm.h"
+#include "TiledHeightFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Control points [first, last] of an axis of count points that refined points [begin, end) depend on: the
+ * segments of the points, with one control point before and two after for the spline, clamped to the grid.
+ * Refined as a curve of their own, the window gives the same points as the whole axis, as its outer segments
+ * (the only ones refined differently) are either outside [begin, end) or the ends of the axis as well.
+ */
+static void controlWindow(int begin, int end, int subdivisions, int count, int& first, int& last)
+{
+	int firstSegment = begin / subdivisions;
+	int lastSegment = std::min(count - 2, (end - 1) / subdivisions);
+	first = std::max(0, firstSegment - 1);
+	last = std::min(count - 1, lastSegment + 2);
+}
+
+bool refinedSize(const HeightmapSource& source, const RefinementSettings& settings, int& width, int& height)
+{
+	int sourceWidth = source.getWidth(), sourceHeight = source.getHeight();
+	long long refinedWidth = (long long)splineSubdivisions(settings.stepX) * (sourceWidth - 1) + 1;
+	long long refinedHeight = (long long)splineSubdivisions(settings.stepZ) * (sourceHeight - 1) + 1;
+	if (sourceWidth < 2 || sourceHeight < 2 || refinedWidth > INT_MAX || refinedHeight > INT_MAX)
+	{
+		std::cout << "Cannot refine a " << sourceWidth << "x" << sourceHeight << " heightmap to " << refinedWidth << "x" << refinedHeight << std::endl;
+		return false;
+	}
+	width = (int)refinedWidth;
+	height = (int)refinedHeight;
+	return true;
+}
+
+void refineTileRows(const HeightmapSource& source, const RefinementSettings& settings, TiledHeightFile& file,
+	int firstTileRow, int endTileRow, StreamedRefinementStats* stats)
+{
+	SplineBasis basis = settings.basis;
+	int width = source.getWidth(), height = source.getHeight();
+	int subdivisionsX = splineSubdivisions(settings.stepX), subdivisionsZ = splineSubdivisions(settings.stepZ);
+	int refinedWidth = file.getWidth(), refinedHeight = file.getHeight();
+	int tileSize = file.getTileSize();
+	int tilesX = file.getTilesX();
+
+	// Rows each filter reads past a band, added up as the filters run one after the other
+	int filterHalo = 0;
+	for (const HeightBandFilter& filter : settings.filters)
+		filterHalo += filter.radius;
+
+	// Largest tile buffers of a thread, for the memory estimate
+	std::atomic<size_t> tileBytes(0);
+	size_t peakBandBytes = 0;
+	std::vector<float> band;
+	for (int tileZ = firstTileRow; tileZ < endTileRow; tileZ++)
+	{
+		int rowBegin = tileZ * tileSize, rowEnd = std::min(refinedHeight, rowBegin + tileSize);
+		int firstRow, lastRow;
+		controlWindow(rowBegin, rowEnd, subdivisionsZ, height, firstRow, lastRow);
+		int bandRows = lastRow - firstRow + 1;
+
+		// The filters see their halo rows too; at the edges of the heightmap they repeat the border as they would on all of it
+		int readFirst = std::max(0, firstRow - filterHalo), readLast = std::min(height - 1, lastRow + filterHalo);
+		int readRows = readLast - readFirst + 1;
+		band.resize(size_t(readRows) * width);
+		source.readRegion(0, readFirst, width, readRows, band.data(), width);
+		for (const HeightBandFilter& filter : settings.filters)
+			filter.apply(band.data(), width, readRows, width);
+		const float* bandHeights = &band[size_t(firstRow - readFirst) * width];
+
+		parallelFor(tilesX, [&](int begin, int end)
+		{
+			std::vector<float> control, refinedX, refined, tile(size_t(tileSize) * tileSize);
+			for (int tileX = begin; tileX < end; tileX++)
+			{
+				int colBegin = tileX * tileSize, colEnd = std::min(refinedWidth, colBegin + tileSize);
+				int firstCol, lastCol;
+				controlWindow(colBegin, colEnd, subdivisionsX, width, firstCol, lastCol);
+				int controlCols = lastCol - firstCol + 1;
+
+				// A window of one height refines to that height: no spline to run and no data in the file
+				float flat = bandHeights[firstCol];
+				bool constant = true;
+				for (int row = 0; row < bandRows && constant; row++)
+				{
+					const float* rowHeights = &bandHeights[size_t(row) * width];
+					for (int col = firstCol; col <= lastCol && constant; col++)
+						constant = rowHeights[col] == flat;
+				}
+				if (constant)
+				{
+					file.writeConstantTile(tileX, tileZ, flat);
+					continue;
+				}
+
+				// xyz control points laid out as Terrain has them at skip size 1, so the heights come out the same
+				control.resize(size_t(bandRows) * controlCols * 3);
+				for (int row = 0; row < bandRows; row++)
+				{
+					float* point = &control[size_t(row) * controlCols * 3];
+					for (int col = 0; col < controlCols; col++, point += 3)
+					{
+						point[0] = (float)(firstCol + col);
+						point[1] = bandHeights[size_t(row) * width + firstCol + col];
+						point[2] = (float)(firstRow + row);
+					}
+				}
+
+				// X pass over every row of the window, then the Z pass over the columns of the tile only
+				int refinedCols = (controlCols - 1) * subdivisionsX + 1;
+				refinedX.resize(size_t(bandRows) * refinedCols * 3);
+				for (int row = 0; row < bandRows; row++)
+					refineSpline(basis, subdivisionsX, &control[size_t(row) * controlCols * 3], controlCols, 3, 1, &refinedX[size_t(row) * refinedCols * 3], 3);
+
+				int lanes = colEnd - colBegin;
+				int refinedRows = (bandRows - 1) * subdivisionsZ + 1;
+				refined.resize(size_t(refinedRows) * lanes * 3);
+				int laneOffset = colBegin - firstCol * subdivisionsX;
+				refineSpline(basis, subdivisionsZ, &refinedX[size_t(laneOffset) * 3], bandRows, refinedCols * 3, lanes, refined.data(), lanes * 3);
+
+				// Heights of the rows of the tile; edge tiles are padded with zeros
+				int rowOffset = rowBegin - firstRow * subdivisionsZ;
+				std::fill(tile.begin(), tile.end(), 0.0f);
+				for (int row = 0; row < rowEnd - rowBegin; row++)
+				{
+					const float* point = &refined[(size_t(rowOffset + row) * lanes) * 3 + 1];
+					float* heights = &tile[size_t(row) * tileSize];
+					for (int col = 0; col < lanes; col++)
+						heights[col] = point[col * 3];
+				}
+				file.writeTile(tileX, tileZ, tile.data());
+			}
+
+			size_t bytes = (control.capacity() + refinedX.capacity() + refined.capacity() + tile.capacity()) * sizeof(float);
+			size_t largest = tileBytes;
+			while (bytes > largest && !tileBytes.compare_exchange_weak(largest, bytes)) {}
+		});
+
+		int threads = std::min(JobSystem::get().getThreadCount(), tilesX);
+		peakBandBytes = std::max(peakBandBytes, band.capacity() * sizeof(float) + threads * tileBytes);
+	}
+
+	if (stats)
+		stats->peakBandBytes = std::max(stats->peakBandBytes, peakBandBytes);
+}
+
+// Sizes and tile counts of a written file
+static void fileStats(const TiledHeightFile& file, StreamedRefinementStats& stats)
+{
+	stats.width = file.getWidth();
+	stats.height = file.getHeight();
+	stats.refinedBytes = (long long)file.getTilesX() * file.getTilesZ() * file.getTileSize() * file.getTileSize() * sizeof(float);
+	stats.fileBytes = file.getFileBytes();
+	file.countTiles(stats.constantTiles, stats.duplicateTiles, stats.storedTiles);
+}
+
+bool refineToFile(const HeightmapSource& source, const RefinementSettings& settings, const std::string& path,
+	StreamedRefinementStats* stats)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	int refinedWidth, refinedHeight;
+	if (!refinedSize(source, settings, refinedWidth, refinedHeight)) return false;
+
+	TiledHeightFile file;
+	if (!file.create(path, refinedWidth, refinedHeight)) return false;
+	refineTileRows(source, settings, file, 0, file.getTilesZ(), stats);
+
+	bool written = file.close();
+	if (!written)
+		std::cout << "Failed to write " << path << std::endl;
+	if (stats)
+	{
+		fileStats(file, *stats);
+		stats->seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+	return written;
+}
+
+// Size, time, throughput and tiles of a refinement, as runRefineToFile prints them
+static void printRefinement(const std::string& path, const StreamedRefinementStats& stats)
+{
+	double megabytes = stats.refinedBytes / double(1 << 20);
+	std::cout << path << ": " << stats.width << "x" << stats.height << " heights, " << megabytes << " MB in " << stats.seconds
+		<< " s (" << megabytes / stats.seconds << " MB/s, " << stats.width * stats.height / stats.seconds / 1e6 << " M vertices/s), "
+		<< stats.constantTiles << " constant, " << stats.duplicateTiles << " duplicate and " << stats.storedTiles
+		<< " stored tiles in " << stats.fileBytes / double(1 << 20) << " MB";
+}
+
+int runRefineToFile(int argc, char** argv)
+{
+	bool worker = std::string(argv[1]) == "--refine-worker";
+	std::string outPath = argv[2];
+	std::string heightmapPath = "heightmaps/depth.bmp";
+	RefinementSettings settings;
+	int workers = -1;
+	bool pinThreads = false;
+	int firstCpu = 0; // of a worker process's threads, so pinned processes get CPUs of their own
+	int processes = 0;
+	bool scaling = false;
+	int firstTileRow = 0, endTileRow = -1;
+	// The options that decide the output, passed on as they are to worker processes
+	std::vector<std::string> pipelineArgs;
+
+	for (int i = 3; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (hasValue && (arg == "--heightmap" || arg == "--step" || arg == "--steps" || arg == "--spline" ||
+			arg == "--smooth" || arg == "--median" || arg == "--bilateral"))
+		{
+			pipelineArgs.push_back(arg);
+			pipelineArgs.push_back(argv[i + 1]);
+		}
+
+		if (arg == "--heightmap" && hasValue) heightmapPath = argv[++i];
+		else if (arg == "--step" && hasValue) settings.stepX = settings.stepZ = (float)atof(argv[++i]);
+		else if (arg == "--steps" && hasValue) sscanf(argv[++i], "%f:%f", &settings.stepX, &settings.stepZ);
+		else if (arg == "--spline" && hasValue)
+		{
+			if (!splineBasisFromName(argv[++i], settings.basis))
+			{
+				std::cout << "Unknown spline basis: " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (arg == "--smooth" && hasValue)
+		{
+			// kernel:parameter, e.g. gaussian:1.5 or box:2
+			std::string spec = argv[++i];
+			size_t colon = spec.find(':');
+			FilterKernel kernel;
+			if (!FilterKernel::fromName(spec.substr(0, colon), colon == std::string::npos ? 1.0f : (float)atof(spec.c_str() + colon + 1), kernel))
+			{
+				std::cout << "Unknown smoothing kernel: " << spec << std::endl;
+				return -1;
+			}
+			settings.filters.push_back({ [=](float* heights, int w, int h, int rowStride) { convolveSeparable(heights, w, h, rowStride, kernel); }, kernel.radius() });
+		}
+		else if (arg == "--median" && hasValue)
+		{
+			int radius = std::max(0, atoi(argv[++i]));
+			settings.filters.push_back({ [=](float* heights, int w, int h, int rowStride) { medianFilter(heights, w, h, rowStride, radius); }, radius });
+		}
+		else if (arg == "--bilateral" && hasValue)
+		{
+			// spatialSigma:rangeSigma, e.g. 1.5:0.1
+			float spatialSigma = 1.5f, rangeSigma = 0.1f;
+			sscanf(argv[++i], "%f:%f", &spatialSigma, &rangeSigma);
+			int radius = spatialSigma > 0.0f ? FilterKernel::gaussian(spatialSigma).radius() : 0;
+			settings.filters.push_back({ [=](float* heights, int w, int h, int rowStride) { bilateralFilter(heights, w, h, rowStride, spatialSigma, rangeSigma); }, radius });
+		}
+		else if (arg == "--workers" && hasValue) workers = std::max(0, atoi(argv[++i]));
+		else if (arg == "--pin-threads") pinThreads = true;
+		else if (arg == "--processes" && hasValue && !worker) processes = std::max(1, atoi(argv[++i]));
+		else if (arg == "--scaling" && !worker) scaling = true;
+		else if (arg == "--tile-rows" && hasValue && worker) sscanf(argv[++i], "%d:%d", &firstTileRow, &endTileRow);
+		else if (arg == "--first-cpu" && hasValue && worker) firstCpu = std::max(0, atoi(argv[++i]));
+		else
+		{
+			std::cout << "Unknown refinement option: " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	if (workers >= 0 || pinThreads)
+		JobSystem::configure(workers, pinThreads, firstCpu);
+	std::shared_ptr<HeightmapSource> source = HeightmapSource::open(heightmapPath);
+	if (!source) return -1;
+
+	if (worker)
+	{
+		// Only this process's rows of tiles are written; the coordinator copies them into the output
+		int refinedWidth, refinedHeight;
+		TiledHeightFile file;
+		if (!refinedSize(*source, settings, refinedWidth, refinedHeight) || !file.create(outPath, refinedWidth, refinedHeight)) return -1;
+		refineTileRows(*source, settings, file, std::max(0, firstTileRow), endTileRow < 0 ? file.getTilesZ() : std::min(endTileRow, file.getTilesZ()));
+		if (!file.close())
+		{
+			std::cout << "Failed to write " << outPath << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (processes == 0)
+	{
+		StreamedRefinementStats stats;
+		if (!refineToFile(*source, settings, outPath, &stats)) return -1;
+		printRefinement(outPath, stats);
+		std::cout << ", band memory " << stats.peakBandBytes / double(1 << 20) << " MB" << std::endl;
+		return 0;
+	}
+
+	int refinedWidth, refinedHeight;
+	if (!refinedSize(*source, settings, refinedWidth, refinedHeight)) return -1;
+	// The coordinator only needed the size of the source
+	source.reset();
+
+	// Each run divides the threads of the machine between its processes, unless --workers sets them per process
+	int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::string executable = TileFarm::currentExecutable(argv[0]);
+	double oneProcessSeconds = 0.0;
+	for (int count = scaling ? 1 : processes; count <= processes; count++)
+	{
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point start = Clock::now();
+		TiledHeightFile file;
+		if (!file.create(outPath, refinedWidth, refinedHeight)) return -1;
+
+		// Every worker writes its rows of tiles to a part file of its own
+		int processWorkers = workers >= 0 ? workers : std::max(1, hardwareThreads / count) - 1;
+		std::vector<std::pair<int, int>> parts;
+		auto partPath = [&](int first) { return outPath + ".part" + std::to_string(first); };
+		bool succeeded = TileFarm::run(executable, file.getTilesZ(), count, [&](int first, int end)
+		{
+			std::vector<std::string> args = { "--refine-worker", partPath(first) };
+			args.insert(args.end(), pipelineArgs.begin(), pipelineArgs.end());
+			args.insert(args.end(), { "--workers", std::to_string(processWorkers), "--tile-rows", std::to_string(first) + ":" + std::to_string(end) });
+			// Each process pins its workers after the threads of the processes before it
+			if (pinThreads)
+				args.insert(args.end(), { "--pin-threads", "--first-cpu", std::to_string(parts.size() * (processWorkers + 1)) });
+			parts.push_back(std::make_pair(first, end));
+			return args;
+		});
+
+		// Stitched into the output in order, which deduplicates tiles across the workers too
+		for (const std::pair<int, int>& part : parts)
+		{
+			TiledHeightFile partFile;
+			succeeded = succeeded && partFile.open(partPath(part.first)) && file.copyTiles(partFile, part.first, part.second);
+			partFile.close();
+			std::remove(partPath(part.first).c_str());
+		}
+		succeeded = file.close() && succeeded;
+		if (!succeeded)
+		{
+			std::cout << "Failed to write " << outPath << std::endl;
+			return -1;
+		}
+
+		StreamedRefinementStats stats;
+		fileStats(file, stats);
+		stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		if (count == 1) oneProcessSeconds = stats.seconds;
+		printRefinement(outPath, stats);
+		std::cout << ", " << count << (count == 1 ? " process" : " processes") << " of " << processWorkers + 1 << " threads";
+		if (scaling)
+			std::cout << ", speedup " << oneProcessSeconds / stats.seconds;
+		std::cout << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "HeightmapSource.h"
+#include "Spline.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class TiledHeightFile;
+
+/**
+ * Both CatMull passes over a whole heightmap, streamed to a TiledHeightFile instead of held as a mesh: the output
+ * is made one row of tiles at a time, from a band of source rows plus a halo of one row above and two below
+ * (the control points of the first and last segments). Each tile refines its own window of the band, with the
+ * same halo in x, on the JobSystem threads and goes straight to the file. Memory stays at one band of the source
+ * and a few tiles per thread whatever the output size; the heights match Terrain::nextState at skip size 1.
+ * The one exception is a tile whose control points all have one height: every basis reproduces a constant, so it
+ * is written as a constant tile without running the spline (Terrain may differ by rounding there), and the time
+ * follows the area with detail rather than the extent of the map.
+ */
+struct StreamedRefinementStats
+{
+	long long width = 0, height = 0; // of the refined grid
+	long long refinedBytes = 0;      // of every tile as floats
+	long long fileBytes = 0;         // constant and duplicate tiles take none
+	int constantTiles = 0, duplicateTiles = 0, storedTiles = 0;
+	size_t peakBandBytes = 0; // source band and tile buffers
+	double seconds = 0.0;
+};
+
+/**
+ * A filter of the source heights before the refinement (as Terrain::filterHeights), and the rows it reads on
+ * each side of a texel. Bands are read with the radii of every filter as an extra halo, so a band filters to
+ * the same heights as the whole heightmap.
+ */
+struct HeightBandFilter
+{
+	std::function<void(float* heights, int width, int height, int rowStride)> apply;
+	int radius;
+};
+
+struct RefinementSettings
+{
+	SplineBasis basis = CATMULL_ROM;
+	float stepX = 0.5f, stepZ = 0.5f;
+	std::vector<HeightBandFilter> filters; // in order
+};
+
+bool refineToFile(const HeightmapSource& source, const RefinementSettings& settings, const std::string& path,
+	StreamedRefinementStats* stats = nullptr);
+
+// Size of the refined grid; false (with a message) if it has no segments or does not fit an int
+bool refinedSize(const HeightmapSource& source, const RefinementSettings& settings, int& width, int& height);
+
+// Rows of tiles [firstTileRow, endTileRow) of file, created for refinedSize; the rest of the file is left alone
+void refineTileRows(const HeightmapSource& source, const RefinementSettings& settings, TiledHeightFile& file,
+	int firstTileRow, int endTileRow, StreamedRefinementStats* stats = nullptr);
+
+/**
+ * COMP371 --refine-to out.tiles [--heightmap path] [--step S | --steps SX:SZ]
+ *                               [--spline catmull|bspline|hermite|centripetal]
+ *                               [--smooth gaussian:S] [--median R] [--bilateral S:R]
+ *                               [--workers N] [--pin-threads] [--processes N [--scaling]]
+ *
+ * Refines the heightmap at full resolution into out.tiles and prints the size, time and write throughput.
+ * The file opens as a heightmap again ("--heightmap out.tiles"), one texel per refined vertex.
+ * With --processes, the rows of tiles are shared out to worker processes (see TileFarm.h), which are the same
+ * executable started as "COMP371 --refine-worker part.tiles --tile-rows FIRST:END ..." and are handled here too.
+ */
+int runRefineToFile(int argc, char** argv);
@@ -1,19 +1,61 @@
 #include "Terrain.h"
+#include "Parallel.h"
+
+#include <climits>
+
+// Rows of the heightmap read per readRegion call while building the vertices
+static const int HEIGHTMAP_BAND_ROWS = 64;
+// Triangle strips of indices written per parallel chunk
+static const int INDEX_STRIP_GRAIN = 64;
+// Smallest number of reduced rows worth handing to a thread
+static const int REDUCE_GRAIN = 16;
+// Rows of the CatMull X pass and columns of the Z pass refined per parallel chunk
+static const int REFINE_ROW_GRAIN = 16;
+static const int REFINE_COLUMN_GRAIN = 256;
 
 void Terrain::init(std::string heightmapPath)
 {
+	shared_ptr<HeightmapSource> source = HeightmapSource::open(heightmapPath);
+	if (!source) return;
 
-	heightMapData = stbi_load(heightmapPath.c_str(), &width, &height, &nrComponents, 0);
+	init(source);
+}
 
-	if (!heightMapData)
-	{
-		std::cout << "Texture failed to load at path: " << heightmapPath << std::endl;
-		stbi_image_free(heightMapData);
-	}
+void Terrain::init(const unsigned char* data, int width, int height, int nrComponents)
+{
+	init(make_shared<ImageHeightmap>(data, width, height, nrComponents));
+}
+
+void Terrain::init(shared_ptr<HeightmapSource> source)
+{
+	// A source too large for the mesh (e.g. noise:size=100000x100000) leaves the terrain as it was
+	if (!checkMeshSize(source->getWidth(), source->getHeight())) return;
 
-	getVertices(width, height);
-	getIndices(width, height);
-	setupMesh(true);
+	// Loading again starts over from the full mesh; the skip size and resolution settings stay
+	state = NORMAL;
+	vertices.clear();
+	indices.clear();
+	normals.clear();
+	tangentsX.clear();
+	refinedSteps.clear();
+
+	heightmap = source;
+	width = source->getWidth();
+	height = source->getHeight();
+
+	// The indices only depend on the size, so they are built while the heights load; the pyramid needs the heights
+	JobSystem& jobs = JobSystem::get();
+	JobHandle indicesJob = jobs.submit([&] { getIndices(width, height); });
+	JobHandle verticesJob = jobs.submit([&] { getVertices(width, height); });
+	JobHandle pyramidJob = jobs.submit([&]
+	{
+		pyramid.build(MortonHeights::fromRows(&vertices[1], originalWidth, originalHeight, originalWidth * 3, 3));
+	}, { verticesJob });
+	jobs.wait(indicesJob);
+	jobs.wait(pyramidJob);
+	memory.addAllocations("init", pyramid.getLevelCount(), pyramid.getMemoryBytes());
+	trackMemory("init");
+	meshVersion++; // uploaded by the next Draw calls, so the mesh stages never need a GL context
 }
 
 
@@ -23,70 +65,116 @@ Terrain::Terrain()
 
 Terrain::~Terrain()
 {
-	stbi_image_free(heightMapData);
 }
 
-vector<float> Terrain::getVertices(int width, int height)
+const vector<float>& Terrain::getVertices(int width, int height)
 {
 	if (!vertices.empty()) return vertices;
 
 	vertices.resize(getVerticesCount(width,height)) ;
 
 	int i = 0;
+	vector<float> band(size_t(width) * std::min(height, HEIGHTMAP_BAND_ROWS));
 
-	// Populate Vertex positions
-	for (int row = 0; row < height; row++)
+	// Populate Vertex positions, reading the heightmap a band of rows at a time
+	for (int bandRow = 0; bandRow < height; bandRow += HEIGHTMAP_BAND_ROWS)
 	{
-		for (int col = 0; col <width; col++)
+		int bandHeight = std::min(HEIGHTMAP_BAND_ROWS, height - bandRow);
+		heightmap->readRegion(0, bandRow, width, bandHeight, band.data(), width);
+
+		for (int row = bandRow; row < bandRow + bandHeight; row++)
 		{
-			vertices[i++] = (float)col;	// x pos
-			vertices[i++] = heightMapData[(row*width + col)*nrComponents]/255.0f; // y pos from first color value of pixel
-			vertices[i++] = (float)row;	// z pos
+			for (int col = 0; col <width; col++)
+			{
+				vertices[i++] = (float)col;	// x pos
+				vertices[i++] = band[size_t(row - bandRow)*width + col]; // y pos
+				vertices[i++] = (float)row;	// z pos
+			}
 		}
 	}
 
-	originalVertices = vertices;
+	originalHeights = CompressedHeights::fromRows(&vertices[1], width, height, width * 3, 3);
 	originalWidth = width;
 	originalHeight = height;
 
 	return vertices;
 }
 
-vector<int> Terrain::getIndices(int width, int height)
+const vector<int>& Terrain::getIndices(int width, int height)
 {
 	if (!indices.empty()) return indices;
 
 	indices.resize(getIndicesCount(width, height));
 
 	int numTriStrips = height - 1; // number of triangle strips required
-	int offset = 0;
-
-	for (int y = 0; y < numTriStrips; y++)
+	parallelFor(numTriStrips, [&](int begin, int end)
 	{
-		// Repeat the first vertex to complete the degenerate triangles from the last Tri strip
-		if (y > 0)
-			indices[offset++] = y * width; // first vertex of new strip
-
-										   // Add the indices of the vertices on the triangle strip
-		for (int x = 0; x < width; x++)
+		for (int y = begin; y < end; y++)
 		{
-			indices[offset++] = y * width + x; // Top row of the triangle strip
-			indices[offset++] = (y + 1) * width + x; // bottom row of the triangle strip
-		}
+			// Every strip before y has 2 * width indices and 2 degenerate ones, except the first strip's leading one
+			int offset = y * (2 * width + 2) - (y > 0 ? 1 : 0);
 
-		// Repeat the last vertec for the degenerate triangle to the next triangle strip
-		if (y < height - 2)
-			indices[offset++] = (y + 2) * width - 1; // last vertex of curr strip
-	}
+			// Repeat the first vertex to complete the degenerate triangles from the last Tri strip
+			if (y > 0)
+				indices[offset++] = y * width; // first vertex of new strip
+
+											   // Add the indices of the vertices on the triangle strip
+			for (int x = 0; x < width; x++)
+			{
+				indices[offset++] = y * width + x; // Top row of the triangle strip
+				indices[offset++] = (y + 1) * width + x; // bottom row of the triangle strip
+			}
+
+			// Repeat the last vertec for the degenerate triangle to the next triangle strip
+			if (y < height - 2)
+				indices[offset++] = (y + 2) * width - 1; // last vertex of curr strip
+		}
+	}, INDEX_STRIP_GRAIN);
 	return indices;
 }
 
-void Terrain::Draw(GLenum renderMode)
+/**
+ * Clears the indices and rebuilds them for a width x height mesh as a job, alongside the stage building its vertices
+ */
+JobHandle Terrain::rebuildIndices(int width, int height)
 {
-	// draw mesh
-	glBindVertexArray(VAO);
-	glDrawElements(renderMode, getIndicesCount(width, height), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	indices.clear();
+	return JobSystem::get().submit([this, width, height] { getIndices(width, height); });
+}
+
+/**
+ * Reports the size of every container to memory, counting as allocations of stage the ones whose storage changed
+ * since the last report. stageBytes are the temporary buffers of the stage still alive, for the high-water marks.
+ */
+void Terrain::trackMemory(const char* stage, size_t stageBytes)
+{
+	int index = 0;
+	auto track = [&](const char* name, const void* data, size_t bytes)
+	{
+		if (data != trackedData[index] && bytes > 0)
+			memory.addAllocations(stage, 1, bytes);
+		trackedData[index++] = data;
+		memory.setBytes(MemoryStats::CPU, name, bytes);
+	};
+	track("heightmap", heightmap.get(), heightmap ? heightmap->getMemoryBytes() : 0);
+	track("originalHeights", originalHeights.getData(), originalHeights.getMemoryBytes());
+	track("vertices", vertices.data(), vertices.capacity() * sizeof(float));
+	track("indices", indices.data(), indices.capacity() * sizeof(int));
+	track("normals", normals.data(), normals.capacity() * sizeof(float));
+	track("tangentsX", tangentsX.data(), tangentsX.capacity() * sizeof(float));
+	memory.setBytes(MemoryStats::CPU, "pyramid", pyramid.getMemoryBytes());
+	memory.setBytes(MemoryStats::CPU, "stage buffers", stageBytes);
+}
+
+/**
+ * CPU backend of Draw: rasterizes the current mesh into renderer, with the same height amplitude as terrain.vert
+ */
+void Terrain::Draw(SoftwareRenderer& renderer, const glm::mat4& mvp, GLenum renderMode)
+{
+	SoftwareRenderer::PrimitiveMode mode = renderMode == GL_POINTS ? SoftwareRenderer::POINTS : SoftwareRenderer::TRIANGLE_STRIP;
+	renderer.drawElements(vertices, indices, mode, mvp, 100.0f);
+	drawnWidth = width;
+	drawnHeight = height;
 }
 
 int Terrain::getOriginalWidth() const
@@ -99,53 +187,234 @@ int Terrain::getOriginalHeight() const
 	return originalHeight;
 }
 
+vector<float> Terrain::getOriginalHeights() const
+{
+	vector<float> heights(originalWidth * originalHeight);
+	originalHeights.toRows(heights.data(), originalWidth);
+	return heights;
+}
+
+const HeightPyramid& Terrain::getPyramid() const
+{
+	return pyramid;
+}
+
+/**
+ * Primitives of the mesh last drawn by Draw: points in GL_POINTS mode, otherwise the non-degenerate triangles of the strips
+ */
+unsigned long long Terrain::getTriangleCount(GLenum renderMode) const
+{
+	if (drawnWidth == 0)
+		return 0;
+	if (renderMode == GL_POINTS)
+		return (unsigned long long)drawnWidth * drawnHeight;
+	return 2ULL * (drawnWidth - 1) * (drawnHeight - 1);
+}
+
 void Terrain::setSkipSize(int skipSize)
 {
 	state = REDUCED;
+	this->skipSize = skipSize;
+	resampledWidth = resampledHeight = 0;
+	refinedSteps.clear();
+	normals.clear();
+	tangentsX.clear();
+
+	// Resize the width and height to adjust for the skip size
+	int newWidth = originalWidth / skipSize;
+	int newHeight = originalHeight / skipSize;
+	JobHandle indicesJob = rebuildIndices(newWidth, newHeight);
+	beginRebuildStage(newHeight);
 
 	if(skipSize == 1)
 	{
+		// The full mesh again, its heights decoded from the compressed originals
+		vector<float> tempVertices(getVerticesCount(originalWidth, originalHeight));
+		parallelFor(originalHeight, [&](int begin, int end)
+		{
+			if (rebuildCancelled) return;
+			float* rowVertices = &tempVertices[size_t(begin) * originalWidth * 3];
+			originalHeights.readBlock(0, begin, originalWidth, end - begin, rowVertices + 1, originalWidth * 3, 3);
+			for (int row = begin; row < end; row++)
+			{
+				for (int col = 0; col < originalWidth; col++, rowVertices += 3)
+				{
+					rowVertices[0] = (float)col;	// x pos
+					rowVertices[2] = (float)row;	// z pos
+				}
+			}
+			rebuildPosition += end - begin;
+		}, CompressedHeights::TILE_SIZE);
+
+		JobSystem::get().wait(indicesJob);
+		if (rebuildCancelled) return;
+		trackMemory("setSkipSize", tempVertices.capacity() * sizeof(float));
 		// Overwrite the global values of the Terrain
 		width = originalWidth;
 		height = originalHeight;
-		vertices = originalVertices;
+		vertices.swap(tempVertices);
+		trackMemory("setSkipSize");
 	}else
 	{
-		// Resize the width and height to adjust for the skip size
-		int newWidth = originalWidth / skipSize;
-		int newHeight = originalHeight / skipSize;
-
-		vector<float> tempVertices;
-		tempVertices.reserve(getVerticesCount(newWidth, newHeight));
-
-		// Populate Vertex positions
-		for (int row = 0; row < newHeight; row++)
+		// Each vertex is the mean height of its skipSize x skipSize block, read from the pyramid and placed at the block center
+		vector<float> tempVertices(getVerticesCount(newWidth, newHeight));
+		float blockCenter = (skipSize - 1) * 0.5f;
+		parallelFor(newHeight, [&](int begin, int end)
 		{
-			for (int col = 0; col <newWidth; col++)
+			if (rebuildCancelled) return;
+			vector<float> rowHeights(size_t(end - begin) * newWidth);
+			pyramid.sampleRows(skipSize, begin, end, newWidth, rowHeights.data());
+
+			float* vertex = &tempVertices[size_t(begin) * newWidth * 3];
+			const float* y = rowHeights.data();
+			for (int row = begin; row < end; row++)
 			{
-				int index = (row*skipSize*originalWidth + col*skipSize) * 3;
-				tempVertices.push_back( originalVertices[index + 0] );	// x pos
-				tempVertices.push_back(originalVertices[index + 1] );	// y pos
-				tempVertices.push_back(originalVertices[index + 2] );	// z pos
+				for (int col = 0; col < newWidth; col++)
+				{
+					*vertex++ = col * skipSize + blockCenter;	// x pos
+					*vertex++ = *y++;	// y pos
+					*vertex++ = row * skipSize + blockCenter;	// z pos
+				}
 			}
-		}
+			rebuildPosition += end - begin;
+		}, REDUCE_GRAIN);
 
+		JobSystem::get().wait(indicesJob);
+		if (rebuildCancelled) return;
+		trackMemory("setSkipSize", tempVertices.capacity() * sizeof(float));
 		// Overwrite the global values of the Terrain
 		width = newWidth;
 		height = newHeight;
-		vertices = tempVertices;
+		vertices.swap(tempVertices);
+		trackMemory("setSkipSize");
 	}
 
+	meshVersion++;
+	meshComplete = true;
+}
 
-	// Reset the Mesh
-	indices.clear();
-	getIndices(width, height);
-	setupMesh(false);
+int Terrain::getSkipSize() const
+{
+	return skipSize;
+}
+
+/**
+ * Resamples the original heights to exactly newWidth x newHeight vertices, smaller or larger than the original.
+ * Large reductions start from the pyramid level closest to twice the target size, so the cost follows the output.
+ */
+void Terrain::setResolution(int newWidth, int newHeight, Resampler::Filter filter)
+{
+	newWidth = std::max(newWidth, 2);
+	newHeight = std::max(newHeight, 2);
+	if (!checkMeshSize(newWidth, newHeight)) return;
+	state = REDUCED;
+	resampledWidth = newWidth;
+	resampledHeight = newHeight;
+	resampleFilter = filter;
+	refinedSteps.clear();
+	normals.clear();
+	tangentsX.clear();
+	JobHandle indicesJob = rebuildIndices(newWidth, newHeight);
+	beginRebuildStage(newHeight);
+
+	int level = 0;
+	while (level + 1 < pyramid.getLevelCount())
+	{
+		const MortonHeights& next = pyramid.getLevel(level + 1);
+		if (next.getWidth() < 2 * newWidth || next.getHeight() < 2 * newHeight) break;
+		level++;
+	}
+
+	const MortonHeights& levelHeights = pyramid.getLevel(level);
+	int levelWidth = levelHeights.getWidth(), levelHeight = levelHeights.getHeight();
+	vector<float> heights(size_t(newWidth) * newHeight);
+	Resampler::resample(levelHeights, heights.data(), newWidth, newHeight, filter);
+	if (rebuildCancelled)
+	{
+		JobSystem::get().wait(indicesJob);
+		return;
+	}
+
+	// Level texel x is centered on original position x * scale + (scale - 1) / 2
+	int scale = 1 << level;
+	float blockCenter = (scale - 1) * 0.5f;
+	vector<float> tempVertices(getVerticesCount(newWidth, newHeight));
+	parallelFor(newHeight, [&](int begin, int end)
+	{
+		if (rebuildCancelled) return;
+		for (int row = begin; row < end; row++)
+		{
+			float z = Resampler::sourcePosition(row, levelHeight, newHeight) * scale + blockCenter;
+			float* vertex = &tempVertices[size_t(row) * newWidth * 3];
+			for (int col = 0; col < newWidth; col++)
+			{
+				*vertex++ = Resampler::sourcePosition(col, levelWidth, newWidth) * scale + blockCenter;	// x pos
+				*vertex++ = heights[size_t(row) * newWidth + col];	// y pos
+				*vertex++ = z;	// z pos
+			}
+		}
+		rebuildPosition += end - begin;
+	}, REDUCE_GRAIN);
+
+	JobSystem::get().wait(indicesJob);
+	if (rebuildCancelled) return;
+	trackMemory("setResolution", (heights.capacity() + tempVertices.capacity()) * sizeof(float));
+	width = newWidth;
+	height = newHeight;
+	vertices.swap(tempVertices);
+	trackMemory("setResolution");
 
+	meshVersion++;
+	meshComplete = true;
+}
+
+/**
+ * setResolution with the aspect ratio of the heightmap and at most vertexCount vertices
+ */
+void Terrain::setVertexBudget(long long vertexCount, Resampler::Filter filter)
+{
+	// Sizes past int are clamped there, and refused by setResolution
+	double aspect = (double)originalWidth / originalHeight;
+	long long newHeight = std::max(2LL, std::min<long long>(INT_MAX, (long long)sqrt(vertexCount / aspect)));
+	long long newWidth = std::max(2LL, std::min<long long>(INT_MAX, vertexCount / newHeight));
+	setResolution((int)newWidth, (int)newHeight, filter);
+}
+
+void Terrain::setSplineBasis(SplineBasis basis)
+{
+	splineBasis = basis;
+}
+
+SplineBasis Terrain::getSplineBasis() const
+{
+	return splineBasis;
+}
+
+void Terrain::setNormalsEnabled(bool enabled)
+{
+	normalsEnabled = enabled;
+}
+
+/**
+ * Unit normals of the vertices (xyz triples) once both CatMull passes ran with normals enabled, empty otherwise
+ */
+const vector<float>& Terrain::getNormals() const
+{
+	return normals;
+}
+
+const MemoryStats& Terrain::getMemoryStats() const
+{
+	return memory;
 }
 
 void Terrain::nextState(float value)
 {
+	long long subdivisions = splineSubdivisions(value);
+	long long newWidth = state == REDUCED ? subdivisions * (width - 1) + 1 : width;
+	long long newHeight = state == CATMULLX ? subdivisions * (height - 1) + 1 : height;
+	if (!checkMeshSize(newWidth, newHeight)) return;
+
 	if(state == REDUCED)
 	{
 		getCatMullXVertices(value);
@@ -156,226 +425,333 @@ void Terrain::nextState(float value)
 		getCatMullZVertices(value);
 		state = CATMULLZ;
 	}
+	else return;
+	refinedSteps.push_back(value);
 }
 
-int Terrain::getVerticesCount(int width, int height)
+/**
+ * Reduces the original heights by skipSize in the background
+ */
+void Terrain::requestSkipSize(int skipSize)
 {
-	return width * height * 3;
+	cancelRebuild();
+	requested = MeshRequest();
+	requested.skipSize = skipSize;
+	MeshRequest request = requested;
+	startRebuild([this, request] { runRebuild(request); });
 }
 
-int Terrain::getIndicesCount(int width, int height)
+/**
+ * setResolution in the background
+ */
+void Terrain::requestResolution(int newWidth, int newHeight, Resampler::Filter filter)
 {
-	int numTriStrips = height - 1; // number of triangle strips required
-	int numDegenIndices = 2 * (numTriStrips - 1); // Number of degenerate indices required (used to move from one strip to another)
-	int verticesPerStrip = 2 * width;
-	return (verticesPerStrip * numTriStrips + numDegenIndices);
+	cancelRebuild();
+	requested = MeshRequest();
+	requested.resampledWidth = newWidth;
+	requested.resampledHeight = newHeight;
+	requested.filter = filter;
+	MeshRequest request = requested;
+	startRebuild([this, request] { runRebuild(request); });
 }
 
-void Terrain::getCatMullXVertices(float stepSize)
+/**
+ * setVertexBudget in the background, sized from the heightmap the job finds
+ */
+void Terrain::requestVertexBudget(long long vertexCount, Resampler::Filter filter)
 {
-	// store width and height of reduced vertices
-	int numPtsPerSegment = ceil( 1.0f/ stepSize); // assuming 0.0 < stepSize < 1.0 and excluding one end point
-	int newWidth = numPtsPerSegment * (width-1) + 1; // numPtsPerSegment * numSegmentsPerRow + 1 end point
-	int newHeight = height;
+	cancelRebuild();
+	requested = MeshRequest();
+	requested.vertexBudget = vertexCount;
+	requested.filter = filter;
+	MeshRequest request = requested;
+	startRebuild([this, request] { runRebuild(request); });
+}
+
+/**
+ * nextState in the background, after the passes of the requests before it; like nextState, at most two passes
+ */
+void Terrain::requestNextState(float value)
+{
+	// Add to the request in flight or left half built by a cancel, otherwise go on from the mesh as it is
+	if (!isRebuilding())
+		finishRebuild();
+	if (!rebuildJob && meshComplete)
+	{
+		if (state == NORMAL) return;
+		requested = MeshRequest();
+		requested.steps = refinedSteps;
+	}
+	if (requested.steps.size() >= 2) return;
+
+	cancelRebuild();
+	requested.steps.push_back(value);
+	MeshRequest request = requested;
+	startRebuild([this, request] { runRebuild(request); });
+}
+
+bool Terrain::isRebuilding() const
+{
+	return rebuildJob && !JobSystem::isDone(rebuildJob);
+}
+
+float Terrain::getRebuildProgress() const
+{
+	if (!isRebuilding()) return 1.0f;
+
+	int stages = rebuildStageCount, stageUnits = rebuildStageUnits;
+	long long position = rebuildPosition;
+	int stage = int(position >> 32) - 1, units = int(position & 0xffffffff);
+	if (stages == 0 || stage < 0) return 0.0f;
+	float stageDone = stageUnits > 0 ? std::min(1.0f, (float)units / stageUnits) : 0.0f;
+	return std::min(1.0f, (stage + stageDone) / stages);
+}
 
-	vector<float> tempVertices;
-	tempVertices.reserve(getVerticesCount(newWidth, newHeight));
+void Terrain::finishRebuild()
+{
+	if (!rebuildJob) return;
+	JobSystem::get().wait(rebuildJob);
+	rebuildJob.reset();
+}
 
-	glm::vec3 p0, p1, p2, p3;
+void Terrain::cancelRebuild()
+{
+	if (!rebuildJob) return;
+	rebuildCancelled = true;
+	finishRebuild();
+	rebuildCancelled = false;
+}
 
-	// Populate Vertex positions
-	for (int row = 0; row < height; row++)
+/**
+ * Loads source in the background like init, then applies the current reduction (skip size or resolution) if the
+ * mesh had one. The CatMull passes are dropped, as with filterHeights.
+ */
+void Terrain::requestHeightmap(shared_ptr<HeightmapSource> source)
+{
+	// Keep the reduction of the mesh, or of the request in flight or cut short by a cancel when there is one
+	bool reduce = rebuildJob || !meshComplete ? requested.reduces() || !requested.steps.empty() || loadReduces : state != NORMAL;
+	cancelRebuild();
+	loadReduces = reduce;
+	requested = MeshRequest();
+	startRebuild([this, source, reduce]
 	{
-		// Get first two points of the row
-		int i = row*width * 3;
-		p0 = glm::vec3(vertices[i+ 0], vertices[i + 1], vertices[i + 2]);
-		p1 = glm::vec3(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
-		// Linear interpolation between first Point and 2nd point
-		for (float u = 0.0f; u < 1.0f; u += stepSize)
-		{
-			glm::vec3 point = p0 + u *(p1 - p0);
-			// Add point as a vertex for new mesh
-			tempVertices.push_back(point.x);
-			tempVertices.push_back(point.y);
-			tempVertices.push_back(point.z);
-		}
+		rebuildStageCount = reduce ? 2 : 1;
+		beginRebuildStage(0);
+		init(source);
+		if (reduce && !rebuildCancelled)
+			applyReduction(MeshRequest());
+		meshComplete = !rebuildCancelled;
+	});
+}
 
-		// Do CatMull Rom on every point
-		for (int col = 1; col < width - 2; col++)
-		{
-			// Get four points
-			int index = (row*width + col) * 3;
-			p0 = glm::vec3(vertices[index - 3], vertices[index - 2], vertices[index - 1]);
-			p1 = glm::vec3(vertices[index + 0], vertices[index + 1], vertices[index + 2]);
-			p2 = glm::vec3(vertices[index + 3], vertices[index + 4], vertices[index + 5]);
-			p3 = glm::vec3(vertices[index + 6], vertices[index + 7], vertices[index + 8]);
-
-			// Evaluate and push CatMullPoints
-			glm::vec3 point;
-			for(float u = 0.0f; u < 1.0f; u += stepSize)
-			{			
-				// Calculate the next interpolated curve point
-				point = 0.5f * (
-					(2.0f * p1) +
-					(-p0 + p2)*u +
-					(2.0f * p0 - 5.0f * p1 + 4.0f *p2 - p3)*u*u +
-					(-p0 + 3.0f*p1 - 3.0f*p2 + p3)*u*u*u);
-
-				// Add point as a vertex for new mesh
-				tempVertices.push_back(point.x);
-				tempVertices.push_back(point.y);
-				tempVertices.push_back(point.z);
-			}
-		}
+/**
+ * Runs filter over the original heights and rebuilds the reduction in the background, dropping the CatMull passes.
+ * The new heights are kept even when a newer request cancels the job, which then starts from them.
+ */
+void Terrain::requestFilterHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter)
+{
+	// Keep the reduction of the request in flight or cut short by a cancel, which the mesh may not have yet
+	MeshRequest reduction = rebuildJob || !meshComplete ? requested : MeshRequest();
+	reduction.steps.clear();
+	cancelRebuild();
+	loadReduces = true;
+	requested = reduction;
+	startRebuild([this, filter, reduction]
+	{
+		rebuildStageCount = 2;
+		beginRebuildStage(0);
+		replaceHeights(filter);
+		applyReduction(reduction);
+		meshComplete = !rebuildCancelled;
+	});
+}
 
-		// Get last two points of the row
-		i = (row*width + (width - 2)) * 3;
-		p0 = glm::vec3(vertices[i + 0], vertices[i + 1], vertices[i+ 2]);
-		p1 = glm::vec3(vertices[i + 3], vertices[i + 4], vertices[i+ 5]);
-		// Linear interpolation between 2nd to last Point and last point
-		for (float u = 0.0f; u < 1.0f; u += stepSize)
-		{
-			glm::vec3 point = p0 + u *(p1 - p0);
-			// Add point as a vertex for new mesh
-			tempVertices.push_back(point.x);
-			tempVertices.push_back(point.y);
-			tempVertices.push_back(point.z);
-		}
+/**
+ * Runs task as the rebuild job, or right away when the job system has no workers to run it
+ */
+void Terrain::startRebuild(const function<void()>& task)
+{
+	rebuildPosition = 0;
+	rebuildStageCount = 0;
+	rebuildStageUnits = 0;
+	if (JobSystem::get().getThreadCount() == 1)
+	{
+		task();
+		return;
+	}
+	rebuildJob = JobSystem::get().submit(task);
+}
 
-		// Add last point in row
-		// Add point as a vertex for new mesh
-		tempVertices.push_back(p1.x);
-		tempVertices.push_back(p1.y);
-		tempVertices.push_back(p1.z);
+/**
+ * Builds the mesh of request, keeping the current reduction and passes when the request only adds passes.
+ * The stages stop early once rebuildCancelled is set, leaving a half built mesh that Draw does not upload.
+ */
+void Terrain::runRebuild(const MeshRequest& request)
+{
+	bool extend = !request.reduces() && meshComplete;
+	size_t firstStep = extend ? refinedSteps.size() : 0;
+	rebuildStageCount = int(request.steps.size() - firstStep) + (extend ? 0 : 1);
+
+	if (!extend)
+		applyReduction(request);
+	for (size_t i = firstStep; i < request.steps.size() && !rebuildCancelled; i++)
+	{
+		nextState(request.steps[i]);
 	}
 
-	// Overwrite the global values of the Terrain
-	width = newWidth;
-	height = newHeight;
-	vertices = tempVertices;
+	// A cancel may have stopped any of the stages: keep the mesh off the screen and redo it from the reduction
+	meshComplete = !rebuildCancelled;
+}
 
-	// Reset the Mesh
-	indices.clear();
-	getIndices(width, height);
-	setupMesh(false);
+void Terrain::applyReduction(const MeshRequest& request)
+{
+	if (request.skipSize > 0)
+		setSkipSize(request.skipSize);
+	else if (request.resampledWidth > 0)
+		setResolution(request.resampledWidth, request.resampledHeight, request.filter);
+	else if (request.vertexBudget > 0)
+		setVertexBudget(request.vertexBudget, request.filter);
+	else if (resampledWidth > 0)
+		setResolution(resampledWidth, resampledHeight, resampleFilter);
+	else
+		setSkipSize(skipSize);
 }
 
-void Terrain::getCatMullZVertices(double stepSize)
+/**
+ * Starts the progress of a stage over units rows or columns, which its parallel chunks add to rebuildPosition
+ */
+void Terrain::beginRebuildStage(int units)
 {
+	rebuildPosition = ((rebuildPosition >> 32) + 1) << 32;
+	rebuildStageUnits = units;
+}
 
-	// store width and height of reduced vertices
-	int numPtsPerSegment = ceil(1.0f / stepSize); // assuming 0.0 < stepSize < 1.0 and excluding one end point
-	int newHeight = numPtsPerSegment * (height - 1) + 1; // numPtsPerSegment * numSegmentsPerCol + 1 end point
-	int newWidth = width;
+/**
+ * Smooths the original heights in place, then rebuilds the reduced mesh at the current skip size
+ */
+void Terrain::smooth(const FilterKernel& kernel)
+{
+	filterHeights([&](float* heights, int width, int height, int rowStride)
+	{
+		convolveSeparable(heights, width, height, rowStride, kernel);
+	});
+}
 
-	vector<float> tempVertices;
-	tempVertices.resize(getVerticesCount(newWidth, newHeight));
+/**
+ * Runs filter over the original heights (a row-major grid), then rebuilds the reduced mesh at the current skip size
+ */
+void Terrain::filterHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter)
+{
+	replaceHeights(filter);
+	applyReduction(MeshRequest());
+}
 
-	glm::vec3 p0, p1, p2, p3;
+/**
+ * Runs filter over the original heights and rebuilds the pyramid from them, leaving the mesh alone
+ */
+void Terrain::replaceHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter)
+{
+	vector<float> heights = getOriginalHeights();
+	filter(heights.data(), originalWidth, originalHeight, originalWidth);
+	originalHeights = CompressedHeights::fromRows(heights.data(), originalWidth, originalHeight, originalWidth);
+	pyramid.build(MortonHeights::fromRows(heights.data(), originalWidth, originalHeight, originalWidth));
+	memory.addAllocations("filterHeights", pyramid.getLevelCount(), pyramid.getMemoryBytes());
+	trackMemory("filterHeights", heights.capacity() * sizeof(float));
+}
 
-	// Populate Vertex positions
-	for (int col  = 0; col < width; col++)
-	{
-		// Get first two points of the col
-		int i = col * 3;
-		p0 = glm::vec3(vertices[i + 0], vertices[i + 1], vertices[i + 2]);
-		p1 = glm::vec3(vertices[width*3 + i + 0], vertices[width*3 + i + 1], vertices[width*3 + i + 2]);
-		// Linear interpolation between first Point and 2nd point
-		int newRow = 0;
-		for (float u = 0.0f; u < 1.0f; u += stepSize)
-		{
-			glm::vec3 point = p0 + u *(p1 - p0);
-			int index = (newRow*newWidth + col )* 3;
-			// Add point as a vertex for new mesh
-			tempVertices[index + 0] = point.x;
-			tempVertices[index + 1] = point.y;
-			tempVertices[index + 2] = point.z;
-			newRow++;
-		}
+/**
+ * The mesh is one vector of xyz floats drawn with int indices, both counted in int (getVerticesCount,
+ * getIndicesCount); larger meshes only fit refineToFile (StreamedRefinement.h)
+ */
+bool Terrain::checkMeshSize(long long width, long long height)
+{
+	// Each side on its own first, so the products cannot overflow
+	if (width <= INT_MAX / 3 && height <= INT_MAX / 3 && 3 * width * height <= INT_MAX && (2 * width + 2) * (height - 1) <= INT_MAX)
+		return true;
+	cout << "A " << width << "x" << height << " mesh is too large, refine it to a file with --refine-to" << endl;
+	return false;
+}
 
-		// Do CatMull Rom on every point
-		for (int row = 1; row < height - 2; row++)
-		{
-			// Get four points
-			auto index = [&](int offset) {return (width*(row+ offset) + col) * 3; };
-			p0 = glm::vec3(vertices[index(-1) + 0], vertices[index(-1) + 1], vertices[index(-1) +2]);
-			p1 = glm::vec3(vertices[index(0) + 0], vertices[index(0) + 1], vertices[index(0) +2]);
-			p2 = glm::vec3(vertices[index(1) + 0], vertices[index(1) + 1], vertices[index(1) +2]);
-			p3 = glm::vec3(vertices[index(2) + 0], vertices[index(2) + 1], vertices[index(2) +2]);
-
-			// Evaluate and push CatMullPoints
-			float u = 0.0f; // Current step
-			glm::vec3 point;
-			for (float u = 0.0f; u < 1.0f; u += stepSize)
-			{
-				// Calculate the next interpolated curve point
-				point = 0.5f * (
-					(2.0f * p1) +
-					(-p0 + p2)*u +
-					(2.0f * p0 - 5.0f * p1 + 4.0f *p2 - p3)*u*u +
-					(-p0 + 3.0f*p1 - 3.0f*p2 + p3)*u*u*u);
-
-				// Add point as a vertex for new mesh
-				int i = (newRow*newWidth + col) * 3;
-				tempVertices[i + 0] = point.x;
-				tempVertices[i + 1] = point.y;
-				tempVertices[i + 2] = point.z;
-				newRow++;
-			}
-		}
+int Terrain::getVerticesCount(int width, int height)
+{
+	return width * height * 3;
+}
 
-		// Get last two points of the col
-		i = (width*(height-2) + col) * 3;
-		p0 = glm::vec3(vertices[i + 0], vertices[i + 1], vertices[i + 2]);
-		p1 = glm::vec3(vertices[width * 3 + i + 0], vertices[width * 3 + i + 1], vertices[width * 3 + i + 2]);
-		// Linear interpolation between first Point and 2nd point
-		for (float u = 0.0f; u < 1.0f; u += stepSize)
+int Terrain::getIndicesCount(int width, int height)
+{
+	int numTriStrips = height - 1; // number of triangle strips required
+	int numDegenIndices = 2 * (numTriStrips - 1); // Number of degenerate indices required (used to move from one strip to another)
+	int verticesPerStrip = 2 * width;
+	return (verticesPerStrip * numTriStrips + numDegenIndices);
+}
+
+/**
+ * Refines every row into splineSubdivisions(stepSize) points per segment with the spline basis
+ */
+void Terrain::getCatMullXVertices(float stepSize)
+{
+	int subdivisions = splineSubdivisions(stepSize);
+	int newWidth = subdivisions * (width - 1) + 1; // subdivisions * numSegmentsPerRow + 1 end point
+	int newHeight = height;
+
+	JobHandle indicesJob = rebuildIndices(newWidth, newHeight);
+	vector<float> tempVertices(getVerticesCount(newWidth, newHeight));
+	// The x derivatives of the rows are kept for the normals of the Z pass
+	tangentsX.resize(normalsEnabled ? tempVertices.size() : 0);
+	beginRebuildStage(height);
+	parallelFor(height, [&](int begin, int end)
+	{
+		if (rebuildCancelled) return;
+		for (int row = begin; row < end; row++)
 		{
-			glm::vec3 point = p0 + u *(p1 - p0);
-			int index = (newRow*newWidth + col) * 3;
-			// Add point as a vertex for new mesh
-			tempVertices[index + 0] = point.x;
-			tempVertices[index + 1] = point.y;
-			tempVertices[index + 2] = point.z;
-			newRow++;
+			SplineDerivatives derivatives = { normalsEnabled ? &tangentsX[size_t(row) * newWidth * 3] : nullptr, nullptr, nullptr };
+			refineSpline(splineBasis, subdivisions, &vertices[size_t(row) * width * 3], width, 3, 1, &tempVertices[size_t(row) * newWidth * 3], 3, &derivatives);
 		}
+		rebuildPosition += end - begin;
+	}, REFINE_ROW_GRAIN);
 
-		// Add last point in column
-		tempVertices[(newWidth*newRow + col)*3+ 0] = p1.x;
-		tempVertices[(newWidth*newRow + col) * 3 + 1] = p1.y;
-		tempVertices[(newWidth*newRow + col) * 3 + 2] = p1.z;
-	}
-
+	JobSystem::get().wait(indicesJob);
+	if (rebuildCancelled) return;
+	trackMemory("getCatMullXVertices", tempVertices.capacity() * sizeof(float));
 	// Overwrite the global values of the Terrain
 	width = newWidth;
 	height = newHeight;
-	vertices = tempVertices;
-
-	// Reset the Mesh
-	indices.clear();
-	getIndices(width, height);
-	setupMesh(false);
+	vertices.swap(tempVertices);
+	trackMemory("getCatMullXVertices");
+	meshVersion++;
 }
 
-void Terrain::setupMesh(bool init = true)
+/**
+ * Refines every column; a block of columns is one set of side by side curves, refined a whole row at a time.
+ * With normals enabled, they come out of the same loop from the analytic derivatives of both passes.
+ */
+void Terrain::getCatMullZVertices(float stepSize)
 {
-	if(init)
-	{
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-	}
-
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, getVerticesCount(width, height) * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, getIndicesCount(width, height) * sizeof(int), &indices[0], GL_STATIC_DRAW);
-
-	// vertex positions
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void*)0);
+	int subdivisions = splineSubdivisions(stepSize);
+	int newHeight = subdivisions * (height - 1) + 1; // subdivisions * numSegmentsPerCol + 1 end point
+	int newWidth = width;
 
-	glBindVertexArray(0);
+	JobHandle indicesJob = rebuildIndices(newWidth, newHeight);
+	vector<float> tempVertices(getVerticesCount(newWidth, newHeight));
+	// Normals from the z derivative and the refined x derivatives, in the same pass as the positions
+	bool withNormals = normalsEnabled && tangentsX.size() == vertices.size();
+	normals.resize(withNormals ? tempVertices.size() : 0);
+	beginRebuildStage(width);
+	parallelFor(width, [&](int begin, int end)
+	{
+		if (rebuildCancelled) return;
+		SplineDerivatives derivatives = { nullptr, withNormals ? &tangentsX[size_t(begin) * 3] : nullptr, withNormals ? &normals[size_t(begin) * 3] : nullptr };
+		refineSpline(splineBasis, subdivisions, &vertices[size_t(begin) * 3], height, width * 3, end - begin, &tempVertices[size_t(begin) * 3], newWidth * 3, &derivatives);
+		rebuildPosition += end - begin;
+	}, REFINE_COLUMN_GRAIN);
+	JobSystem::get().wait(indicesJob);
+	if (rebuildCancelled) return;
+	trackMemory("getCatMullZVertices", tempVertices.capacity() * sizeof(float));
+	vector<float>().swap(tangentsX);
+	// Overwrite the global values of the Terrain
+	width = newWidth;
+	height = newHeight;
+	vertices.swap(tempVertices);
+	trackMemory("getCatMullZVertices");
+	meshVersion++;
 }
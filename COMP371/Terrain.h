@@ -1,8 +1,15 @@
 #pragma once
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #include "glm.hpp"
+#include "CompressedHeights.h"
+#include "HeightFilter.h"
+#include "HeightPyramid.h"
+#include "HeightmapSource.h"
+#include "JobSystem.h"
+#include "MemoryStats.h"
+#include "Resampler.h"
+#include "SoftwareRenderer.h"
+#include "Spline.h"
 
 #include <string>
 #include <glew.h>
@@ -10,6 +17,7 @@
 #include  <vector>
 #include <math.h> 
 #include <algorithm>
+#include <functional>
 
 using namespace std;
 
@@ -18,38 +26,130 @@ class Terrain
 public:
 	Terrain();
 	void init(std::string heightmapPath);
+	void init(const unsigned char* data, int width, int height, int nrComponents);
+	void init(std::shared_ptr<HeightmapSource> source);
 	~Terrain();
-	vector<float> getVertices(int width, int height);
-	vector<int> getIndices(int width, int height);
+	const vector<float>& getVertices(int width, int height);
+	const vector<int>& getIndices(int width, int height);
 	void Draw(GLenum renderMode);
+	// Time and bytes Draw spends uploading a new mesh per call, 0 for no limit; see TerrainDraw.cpp
+	void setUploadBudget(float milliseconds, size_t bytes);
+	bool isUploading() const; // a finished mesh is still on its way to the GPU
+	void Draw(SoftwareRenderer& renderer, const glm::mat4& mvp, GLenum renderMode);
 	int getOriginalWidth() const;
 	int getOriginalHeight() const;
+	vector<float> getOriginalHeights() const;
+	const HeightPyramid& getPyramid() const; // block means of the original heights, as setSkipSize reads them
+	unsigned long long getTriangleCount(GLenum renderMode) const;
 	void setSkipSize(int skipSize);
+	int getSkipSize() const;
+	void setResolution(int newWidth, int newHeight, Resampler::Filter filter = Resampler::LANCZOS3);
+	void setVertexBudget(long long vertexCount, Resampler::Filter filter = Resampler::LANCZOS3);
 	void nextState(float value);
+	// Whether a width x height mesh keeps its vertex floats and indices countable in int, with a message if not
+	static bool checkMeshSize(long long width, long long height);
+
+	// Background rebuilds: the stages run as a job while Draw keeps showing the previous mesh, and the new mesh
+	// replaces it on the first Draw after the job finishes. A newer request cancels the one in flight.
+	// Without JobSystem workers they run synchronously. Call finishRebuild before any other change to the mesh.
+	void requestSkipSize(int skipSize);
+	void requestResolution(int newWidth, int newHeight, Resampler::Filter filter = Resampler::LANCZOS3);
+	void requestVertexBudget(long long vertexCount, Resampler::Filter filter = Resampler::LANCZOS3);
+	void requestNextState(float value);
+	void requestHeightmap(shared_ptr<HeightmapSource> source);
+	// filterHeights in the background; the filter itself always completes, a cancel only stops the reduction after it
+	void requestFilterHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter);
+	bool isRebuilding() const;
+	float getRebuildProgress() const; // of the request in flight, 1 when idle
+	void finishRebuild(); // waits for the request in flight
+	void cancelRebuild(); // stops it, keeping the mesh on screen
+	void setSplineBasis(SplineBasis basis); // used by the following CatMull passes
+	SplineBasis getSplineBasis() const;
+	void setNormalsEnabled(bool enabled); // analytic normals from the following CatMull passes
+	const vector<float>& getNormals() const;
+	void smooth(const FilterKernel& kernel);
+	void filterHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter);
+	// Bytes held by the containers and GL buffers and allocations per stage, updated as the stages run
+	const MemoryStats& getMemoryStats() const;
 private:
+	// Benchmarks drive the individual mesh stages directly
+	friend class TerrainBenchmark;
+
 	int width;
 	int height;
-	int nrComponents;
 
-	int originalWidth;
-	int originalHeight;
-	vector<float> originalVertices;
+	int originalWidth = 0;
+	int originalHeight = 0;
+	CompressedHeights originalHeights; // the full resolution heights, decoded a tile at a time when a stage reads them
+	HeightPyramid pyramid; // prefiltered reductions of the original heights, for setSkipSize
 
 	// Store State
 	enum STATE {NORMAL, REDUCED, CATMULLX, CATMULLZ};
 	STATE state = NORMAL;
+	int skipSize = 1;
+	int resampledWidth = 0, resampledHeight = 0; // set while the reduced mesh comes from setResolution
+	Resampler::Filter resampleFilter = Resampler::LANCZOS3;
+	SplineBasis splineBasis = CATMULL_ROM;
+	bool normalsEnabled = false;
+	vector<float> normals;
+	vector<float> tangentsX; // x derivatives of the CatMull X pass, until the Z pass turns them into normals
+
+	vector<float> refinedSteps; // step sizes of the CatMull passes applied since the reduction
+	bool meshComplete = true; // false once a cancelled rebuild has left the mesh half built
+
+	// Mesh built in the background: a reduction, then one CatMull pass per step
+	struct MeshRequest
+	{
+		// The reduction: a skip size, a resolution or a vertex budget; none of them keeps the current one
+		int skipSize;
+		int resampledWidth, resampledHeight;
+		long long vertexBudget;
+		Resampler::Filter filter; // of the resolution or vertex budget
+		vector<float> steps;
+
+		MeshRequest() : skipSize(0), resampledWidth(0), resampledHeight(0), vertexBudget(0), filter(Resampler::LANCZOS3) {}
+		bool reduces() const { return skipSize > 0 || resampledWidth > 0 || vertexBudget > 0; }
+	};
+	MeshRequest requested;
+	bool loadReduces = false; // whether the last requestHeightmap applies the reduction, when requested is empty
+	JobHandle rebuildJob;
+	std::atomic<bool> rebuildCancelled{ false };
+	// Stages begun in the high 32 bits and rows or columns of the current one done in the low ones, out of
+	// rebuildStageCount stages and rebuildStageUnits units; one atomic so the progress never goes back
+	std::atomic<long long> rebuildPosition{ 0 };
+	std::atomic<int> rebuildStageCount{ 0 }, rebuildStageUnits{ 0 };
+	void startRebuild(const function<void()>& task);
+	void runRebuild(const MeshRequest& request);
+	void applyReduction(const MeshRequest& request); // the reduction of request, or the current one
+	void replaceHeights(const function<void(float* heights, int width, int height, int rowStride)>& filter);
+	void beginRebuildStage(int units);
 
 	vector<float> vertices ;
 	vector<int> indices;
 	int getVerticesCount(int width, int height);
 	int getIndicesCount(int width, int height);
-	unsigned char *heightMapData;
+	JobHandle rebuildIndices(int width, int height);
+	shared_ptr<HeightmapSource> heightmap;
+
+	MemoryStats memory;
+	const void* trackedData[6] = {}; // storage of each container at the last trackMemory
+	void trackMemory(const char* stage, size_t stageBytes = 0);
 
 	void getCatMullXVertices(float stepSize);
-	void getCatMullZVertices(double stepSize);
+	void getCatMullZVertices(float stepSize);
 
-	/* Render Data */
-	unsigned int VAO, VBO, EBO;
-	void setupMesh(bool init);
+	/* Render Data (see TerrainDraw.cpp) */
+	// Two sets of buffers: a finished mesh is uploaded to the back set, then swapped to the front
+	unsigned int VAO[2] = { 0, 0 }, VBO[2] = { 0, 0 }, EBO[2] = { 0, 0 };
+	int frontBuffers = 0;
+	int drawnWidth = 0, drawnHeight = 0; // size of the mesh on screen
+	unsigned meshVersion = 0; // bumped by every stage; Draw uploads the mesh when it differs from drawnVersion
+	unsigned drawnVersion = 0, uploadVersion = 0;
+	float uploadBudgetMs = 0;
+	size_t uploadBudgetBytes = 0;
+	int uploadBuffers = -1; // set being filled with mesh uploadVersion, -1 when no upload is in progress
+	int uploadedRows = 0, uploadedIndices = 0;
+	void allocateMesh(int buffers);
+	bool uploadBands();
 };
 
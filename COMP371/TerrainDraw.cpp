@@ -0,0 +1,135 @@
+// GPU side of the Terrain: buffer uploads and draw calls.
+// Kept out of Terrain.cpp so the mesh stages can be built and benchmarked without OpenGL.
+
+#include "Terrain.h"
+
+#include <chrono>
+
+// Rows of vertices, or of triangle strips, sent per glBufferSubData call; the budget is checked between bands
+static const int UPLOAD_BAND_ROWS = 32;
+
+void Terrain::Draw(GLenum renderMode)
+{
+	// Upload a finished mesh to the back buffers, a few bands per frame, and swap them in once complete.
+	// The upload pauses while a rebuild runs, and starts over if the mesh changed meanwhile.
+	if (!isRebuilding() && meshComplete && meshVersion != drawnVersion)
+	{
+		if (uploadBuffers < 0 || uploadVersion != meshVersion)
+		{
+			uploadBuffers = drawnWidth == 0 ? frontBuffers : 1 - frontBuffers;
+			uploadVersion = meshVersion;
+			allocateMesh(uploadBuffers);
+		}
+		if (uploadBands())
+		{
+			frontBuffers = uploadBuffers;
+			uploadBuffers = -1;
+			drawnWidth = width;
+			drawnHeight = height;
+			drawnVersion = meshVersion;
+		}
+	}
+	if (drawnWidth == 0) return;
+
+	// draw mesh
+	glBindVertexArray(VAO[frontBuffers]);
+	glDrawElements(renderMode, getIndicesCount(drawnWidth, drawnHeight), GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
+
+void Terrain::setUploadBudget(float milliseconds, size_t bytes)
+{
+	uploadBudgetMs = milliseconds;
+	uploadBudgetBytes = bytes;
+}
+
+bool Terrain::isUploading() const
+{
+	// meshVersion only changes in a rebuild, read it once that is over
+	return !isRebuilding() && meshComplete && meshVersion != drawnVersion;
+}
+
+/**
+ * Sizes the buffers of set buffers for the current mesh, orphaning their previous storage
+ */
+void Terrain::allocateMesh(int buffers)
+{
+	if (VAO[buffers] == 0)
+	{
+		glGenVertexArrays(1, &VAO[buffers]);
+		glGenBuffers(1, &VBO[buffers]);
+		glGenBuffers(1, &EBO[buffers]);
+	}
+
+	size_t vertexBytes = getVerticesCount(width, height) * sizeof(float);
+	size_t indexBytes = getIndicesCount(width, height) * sizeof(int);
+	glBindVertexArray(VAO[buffers]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[buffers]);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[buffers]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_STATIC_DRAW);
+
+	memory.setBytes(MemoryStats::GPU, "vertex buffer " + to_string(buffers), vertexBytes);
+	memory.setBytes(MemoryStats::GPU, "index buffer " + to_string(buffers), indexBytes);
+	memory.addAllocations("upload", 2, vertexBytes + indexBytes);
+
+	// vertex positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void*)0);
+
+	glBindVertexArray(0);
+	uploadedRows = 0;
+	uploadedIndices = 0;
+}
+
+/**
+ * Sends the next bands of vertex rows, then of index strips, to uploadBuffers until the budget of this frame
+ * is spent; at least one band goes every frame. Returns true once the whole mesh is uploaded.
+ */
+bool Terrain::uploadBands()
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	size_t rowBytes = getVerticesCount(width, 1) * sizeof(float);
+	int indexCount = getIndicesCount(width, height);
+	int stripIndices = 2 * width + 2; // a strip and its degenerate indices
+	size_t stripBytes = stripIndices * sizeof(int);
+	size_t sent = 0;
+
+	glBindVertexArray(VAO[uploadBuffers]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[uploadBuffers]);
+	while (uploadedRows < height || uploadedIndices < indexCount)
+	{
+		if (sent > 0)
+		{
+			double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			if ((uploadBudgetBytes > 0 && sent >= uploadBudgetBytes) || (uploadBudgetMs > 0 && elapsed >= uploadBudgetMs))
+				break;
+		}
+
+		// Whole rows, no more than the bytes left in the budget
+		bool sendingRows = uploadedRows < height;
+		int bandRows = UPLOAD_BAND_ROWS;
+		if (uploadBudgetBytes > 0)
+			bandRows = std::max(1, std::min(bandRows, int((uploadBudgetBytes - sent) / (sendingRows ? rowBytes : stripBytes))));
+
+		if (sendingRows)
+		{
+			int rows = std::min(bandRows, height - uploadedRows);
+			glBufferSubData(GL_ARRAY_BUFFER, uploadedRows * rowBytes, rows * rowBytes, &vertices[size_t(uploadedRows) * width * 3]);
+			uploadedRows += rows;
+			sent += rows * rowBytes;
+		}
+		else
+		{
+			int count = std::min(bandRows * stripIndices, indexCount - uploadedIndices);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, uploadedIndices * sizeof(int), count * sizeof(int), &indices[uploadedIndices]);
+			uploadedIndices += count;
+			sent += count * sizeof(int);
+		}
+	}
+	glBindVertexArray(0);
+
+	return uploadedRows == height && uploadedIndices == indexCount;
+}
@@ -0,0 +1,144 @@
+#include "TileFarm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+typedef HANDLE ProcessHandle;
+#else
+#include <cerrno>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+typedef pid_t ProcessHandle;
+#endif
+
+#ifdef _WIN32
+// One argument of a CreateProcess command line, quoted so that CommandLineToArgvW splits it back out
+static std::string quoteArgument(const std::string& arg)
+{
+	if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos)
+		return arg;
+	std::string quoted = "\"";
+	int backslashes = 0;
+	for (char c : arg)
+	{
+		if (c == '\\')
+		{
+			backslashes++;
+			continue;
+		}
+		// Backslashes are only special before a quote
+		quoted.append(c == '"' ? 2 * backslashes + 1 : backslashes, '\\');
+		backslashes = 0;
+		quoted += c;
+	}
+	quoted.append(2 * backslashes, '\\');
+	return quoted + "\"";
+}
+
+static bool startProcess(const std::vector<std::string>& args, ProcessHandle& process)
+{
+	std::string commandLine;
+	for (const std::string& arg : args)
+		commandLine += (commandLine.empty() ? "" : " ") + quoteArgument(arg);
+
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION info = {};
+	if (!CreateProcessA(args[0].c_str(), &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info))
+		return false;
+	CloseHandle(info.hThread);
+	process = info.hProcess;
+	return true;
+}
+
+static bool waitProcess(ProcessHandle process)
+{
+	DWORD exitCode = 1;
+	WaitForSingleObject(process, INFINITE);
+	GetExitCodeProcess(process, &exitCode);
+	CloseHandle(process);
+	return exitCode == 0;
+}
+#else
+static bool startProcess(const std::vector<std::string>& args, ProcessHandle& process)
+{
+	// posix_spawn rather than fork: the job system threads of this process must not be copied half way
+	std::vector<char*> argv;
+	for (const std::string& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+	return posix_spawn(&process, args[0].c_str(), nullptr, nullptr, argv.data(), environ) == 0;
+}
+
+static bool waitProcess(ProcessHandle process)
+{
+	int status = 0;
+	while (waitpid(process, &status, 0) < 0)
+	{
+		if (errno != EINTR) return false;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
+
+bool TileFarm::run(const std::string& executable, int tileRows, int processes, const WorkerArgs& workerArgs,
+	double* seconds)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	processes = std::max(1, std::min(processes, tileRows));
+
+	std::vector<ProcessHandle> running;
+	bool succeeded = true;
+	for (int i = 0; i < processes; i++)
+	{
+		int first = (int)((long long)tileRows * i / processes), end = (int)((long long)tileRows * (i + 1) / processes);
+		std::vector<std::string> args = { executable };
+		std::vector<std::string> rangeArgs = workerArgs(first, end);
+		args.insert(args.end(), rangeArgs.begin(), rangeArgs.end());
+
+		ProcessHandle process;
+		if (!startProcess(args, process))
+		{
+			std::cout << "Failed to start worker process " << executable << std::endl;
+			succeeded = false;
+			break;
+		}
+		running.push_back(process);
+	}
+
+	// Every started worker is waited for, even after a failure, so none is left behind
+	for (size_t i = 0; i < running.size(); i++)
+	{
+		if (!waitProcess(running[i]))
+		{
+			std::cout << "Worker process " << i << " failed" << std::endl;
+			succeeded = false;
+		}
+	}
+	if (seconds)
+		*seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return succeeded;
+}
+
+std::string TileFarm::currentExecutable(const char* argv0)
+{
+#ifdef _WIN32
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	if (length > 0 && length < MAX_PATH)
+		return std::string(path, length);
+#elif defined(__linux__)
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+	if (length > 0 && length < (ssize_t)sizeof(path))
+		return std::string(path, length);
+#endif
+	return argv0;
+}
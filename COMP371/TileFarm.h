@@ -0,0 +1,25 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Shares the rows of tiles of a TiledHeightFile out to local worker processes, for refinements too large for the
+ * memory or the NUMA node of one process. The rows [0, tileRows) are split into one contiguous range per process,
+ * and each process is started as "executable workerArgs(first, end)...". Files are the transport: each worker reads
+ * its own halo rows from the source and writes its rows to a file of its own, which the coordinator stitches into
+ * the output (TiledHeightFile::copyTiles) once every worker is done.
+ */
+class TileFarm
+{
+public:
+	// Arguments of the worker for rows of tiles [first, end), after the executable
+	typedef std::function<std::vector<std::string>(int first, int end)> WorkerArgs;
+
+	// Starts the processes and waits for all of them; false if one could not start or exited with an error
+	static bool run(const std::string& executable, int tileRows, int processes, const WorkerArgs& workerArgs,
+		double* seconds = nullptr);
+
+	// Path of the running executable, to start workers of the same build; argv0 when the system has no better
+	static std::string currentExecutable(const char* argv0);
+};
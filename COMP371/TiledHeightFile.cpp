@@ -0,0 +1,311 @@
+#include "TiledHeightFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+static const char MAGIC[4] = { 'H', 'T', 'I', 'L' };
+static const uint32_t VERSION = 2;
+
+// Whether every float has the bits of the first, so -0 and 0 or two NaNs never make a tile constant
+static bool isConstant(const float* heights, size_t count)
+{
+	uint32_t first, bits;
+	memcpy(&first, heights, sizeof(first));
+	for (size_t i = 1; i < count; i++)
+	{
+		memcpy(&bits, heights + i, sizeof(bits));
+		if (bits != first) return false;
+	}
+	return true;
+}
+
+// FNV-1a over 32-bit words; equal hashes are confirmed by comparing the bytes
+static uint64_t contentHash(const float* heights, size_t count)
+{
+	uint64_t hash = 14695981039346656037ull;
+	uint32_t bits;
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(&bits, heights + i, sizeof(bits));
+		hash = (hash ^ bits) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool TiledHeightFile::create(const std::string& path, int width, int height, int tileSize)
+{
+	file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Failed to create tiled height file " << path << std::endl;
+		return false;
+	}
+	// A tile never needs to be larger than the grid, which open() relies on to reject foreign files
+	this->width = width;
+	this->height = height;
+	this->tileSize = std::min(tileSize, std::max(width, height));
+	writable = true;
+	failed = false;
+	directory.assign(size_t(getTilesX()) * getTilesZ(), TileEntry{ 0, 0.0f, 0 });
+	blocks.clear();
+
+	// The directory is written again by close(), once every tile is known
+	char header[HEADER_BYTES] = {};
+	uint32_t fields[4] = { VERSION, uint32_t(width), uint32_t(height), uint32_t(this->tileSize) };
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	memcpy(header + sizeof(MAGIC), fields, sizeof(fields));
+	file.write(header, HEADER_BYTES);
+	file.write((const char*)directory.data(), std::streamsize(directory.size() * sizeof(TileEntry)));
+	dataEnd = HEADER_BYTES + directory.size() * sizeof(TileEntry);
+	return bool(file);
+}
+
+bool TiledHeightFile::open(const std::string& path)
+{
+	file.open(path, std::ios::in | std::ios::binary);
+	char header[HEADER_BYTES];
+	uint32_t fields[4];
+	if (!file || !file.read(header, HEADER_BYTES) || memcmp(header, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		std::cout << "Not a tiled height file: " << path << std::endl;
+		return false;
+	}
+	memcpy(fields, header + sizeof(MAGIC), sizeof(fields));
+	if (fields[0] != VERSION)
+	{
+		std::cout << "Unsupported tiled height file version " << fields[0] << ": " << path << std::endl;
+		return false;
+	}
+	width = int(fields[1]);
+	height = int(fields[2]);
+	tileSize = int(fields[3]);
+	if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize > std::max(width, height))
+	{
+		std::cout << "Invalid size " << fields[1] << "x" << fields[2] << " or tile size " << fields[3]
+			<< " in tiled height file: " << path << std::endl;
+		width = height = tileSize = 0;
+		return false;
+	}
+	writable = false;
+	failed = false;
+
+	// The directory has to fit the file before it is allocated
+	uint64_t directoryBytes = uint64_t(getTilesX()) * getTilesZ() * sizeof(TileEntry);
+	file.seekg(0, std::ios::end);
+	uint64_t fileBytes = uint64_t(file.tellg());
+	file.seekg(HEADER_BYTES);
+	if (fileBytes < HEADER_BYTES + directoryBytes)
+	{
+		std::cout << "Truncated tiled height file: " << path << std::endl;
+		return false;
+	}
+	directory.resize(size_t(getTilesX()) * getTilesZ());
+	if (!file.read((char*)directory.data(), std::streamsize(directory.size() * sizeof(TileEntry))))
+	{
+		std::cout << "Truncated tiled height file: " << path << std::endl;
+		return false;
+	}
+	dataEnd = HEADER_BYTES + directory.size() * sizeof(TileEntry);
+	for (const TileEntry& tile : directory)
+		dataEnd = std::max<uint64_t>(dataEnd, tile.offset ? tile.offset + tileBytes() : 0);
+	return true;
+}
+
+bool TiledHeightFile::close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (file.is_open())
+	{
+		if (writable && !failed)
+		{
+			file.seekp(HEADER_BYTES);
+			file.write((const char*)directory.data(), std::streamsize(directory.size() * sizeof(TileEntry)));
+		}
+		file.flush();
+		failed = failed || !file;
+		file.close();
+	}
+	blocks.clear();
+	return !failed;
+}
+
+int TiledHeightFile::getWidth() const
+{
+	return width;
+}
+
+int TiledHeightFile::getHeight() const
+{
+	return height;
+}
+
+int TiledHeightFile::getTileSize() const
+{
+	return tileSize;
+}
+
+int TiledHeightFile::getTilesX() const
+{
+	return int((width + (long long)tileSize - 1) / tileSize);
+}
+
+int TiledHeightFile::getTilesZ() const
+{
+	return int((height + (long long)tileSize - 1) / tileSize);
+}
+
+bool TiledHeightFile::writeTile(int tileX, int tileZ, const float* heights)
+{
+	size_t count = size_t(tileSize) * tileSize;
+	if (isConstant(heights, count))
+		return writeConstantTile(tileX, tileZ, heights[0]);
+	uint64_t hash = contentHash(heights, count);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	TileEntry& tile = directory[size_t(tileZ) * getTilesX() + tileX];
+	auto candidates = blocks.equal_range(hash);
+	for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+	{
+		compared.resize(count);
+		file.seekg(candidate->second);
+		bool read = bool(file.read((char*)compared.data(), tileBytes()));
+		file.clear();
+		if (read && memcmp(compared.data(), heights, size_t(tileBytes())) == 0)
+		{
+			tile = TileEntry{ candidate->second, 0.0f, 0 };
+			return !failed;
+		}
+	}
+
+	file.seekp(dataEnd);
+	file.write((const char*)heights, tileBytes());
+	failed = failed || !file;
+	tile = TileEntry{ dataEnd, 0.0f, 0 };
+	blocks.emplace(hash, dataEnd);
+	dataEnd += tileBytes();
+	return !failed;
+}
+
+bool TiledHeightFile::writeConstantTile(int tileX, int tileZ, float height)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	directory[size_t(tileZ) * getTilesX() + tileX] = TileEntry{ 0, height, 0 };
+	return !failed;
+}
+
+bool TiledHeightFile::readTile(int tileX, int tileZ, float* heights, int firstRow, int rows) const
+{
+	if (rows < 0) rows = tileSize - firstRow;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const TileEntry& tile = entry(tileX, tileZ);
+	if (!tile.offset)
+	{
+		std::fill(heights, heights + size_t(rows) * tileSize, tile.height);
+		return true;
+	}
+	file.clear();
+	file.seekg(tile.offset + (long long)firstRow * tileSize * sizeof(float));
+	return bool(file.read((char*)heights, std::streamsize(rows) * tileSize * sizeof(float)));
+}
+
+bool TiledHeightFile::isConstantTile(int tileX, int tileZ, float& height) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const TileEntry& tile = entry(tileX, tileZ);
+	height = tile.height;
+	return !tile.offset;
+}
+
+bool TiledHeightFile::copyTiles(const TiledHeightFile& from, int firstTileRow, int endTileRow)
+{
+	if (from.width != width || from.height != height || from.tileSize != tileSize)
+	{
+		std::cout << "Cannot copy tiles between tiled height files of different sizes" << std::endl;
+		return false;
+	}
+	std::vector<float> heights(size_t(tileSize) * tileSize);
+	for (int tileZ = firstTileRow; tileZ < endTileRow; tileZ++)
+	{
+		for (int tileX = 0; tileX < getTilesX(); tileX++)
+		{
+			float constant;
+			if (from.isConstantTile(tileX, tileZ, constant))
+				writeConstantTile(tileX, tileZ, constant);
+			else if (!from.readTile(tileX, tileZ, heights.data()) || !writeTile(tileX, tileZ, heights.data()))
+				return false;
+		}
+	}
+	return true;
+}
+
+void TiledHeightFile::countTiles(int& constant, int& duplicate, int& stored) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::unordered_map<uint64_t, int> uses;
+	constant = 0;
+	for (const TileEntry& tile : directory)
+	{
+		if (tile.offset) uses[tile.offset]++;
+		else constant++;
+	}
+	stored = (int)uses.size();
+	duplicate = (int)directory.size() - constant - stored;
+}
+
+long long TiledHeightFile::getFileBytes() const
+{
+	return (long long)dataEnd;
+}
+
+const TiledHeightFile::TileEntry& TiledHeightFile::entry(int tileX, int tileZ) const
+{
+	return directory[size_t(tileZ) * getTilesX() + tileX];
+}
+
+long long TiledHeightFile::tileBytes() const
+{
+	return (long long)tileSize * tileSize * sizeof(float);
+}
+
+std::shared_ptr<TiledHeightmap> TiledHeightmap::load(const std::string& path)
+{
+	std::shared_ptr<TiledHeightmap> heightmap = std::make_shared<TiledHeightmap>();
+	if (!heightmap->file.open(path)) return nullptr;
+	return heightmap;
+}
+
+int TiledHeightmap::getWidth() const
+{
+	return file.getWidth();
+}
+
+int TiledHeightmap::getHeight() const
+{
+	return file.getHeight();
+}
+
+void TiledHeightmap::readRegion(int x, int z, int regionWidth, int regionHeight, float* out, int rowStride) const
+{
+	// The rows of a tile are contiguous, so each tile the region touches is one read
+	int tileSize = file.getTileSize();
+	std::vector<float> rows(size_t(tileSize) * std::min(tileSize, regionHeight));
+	for (int tileZ = z / tileSize; tileZ * tileSize < z + regionHeight; tileZ++)
+	{
+		int rowBegin = std::max(z, tileZ * tileSize), rowEnd = std::min(z + regionHeight, (tileZ + 1) * tileSize);
+		for (int tileX = x / tileSize; tileX * tileSize < x + regionWidth; tileX++)
+		{
+			int colBegin = std::max(x, tileX * tileSize), colEnd = std::min(x + regionWidth, (tileX + 1) * tileSize);
+			if (!file.readTile(tileX, tileZ, rows.data(), rowBegin - tileZ * tileSize, rowEnd - rowBegin))
+				std::fill(rows.begin(), rows.end(), 0.0f);
+			for (int row = rowBegin; row < rowEnd; row++)
+			{
+				const float* tileRow = &rows[size_t(row - rowBegin) * tileSize + (colBegin - tileX * tileSize)];
+				std::copy(tileRow, tileRow + (colEnd - colBegin), out + size_t(row - z) * rowStride + (colBegin - x));
+			}
+		}
+	}
+}
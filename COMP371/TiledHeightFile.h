@@ -0,0 +1,90 @@
+#pragma once
+#include "HeightmapSource.h"
+
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Height grid on disk as square tiles of floats, so a region can be read or written without touching the rest:
+ *
+ *	header		"HTIL", version, width, height, tile size (uint32 each), padded to HEADER_BYTES
+ *	directory	one entry per tile, row-major by tile: offset of its data (uint64), or 0 and its height (float)
+ *	data		tileSize x tileSize floats row-major per stored tile; edge tiles are padded to full size
+ *
+ * Only tiles with more than one height take data: a constant tile (sea level, a flattened pad, no data) is its
+ * directory entry alone, and a tile identical to one already written (same content hash, then same bytes) points
+ * at that tile's data. The file grows with the area that has detail rather than with the extent of the grid.
+ * Tiles can be written in any order and from several threads; tiles never written are constant 0.
+ */
+class TiledHeightFile
+{
+public:
+	static const int DEFAULT_TILE_SIZE = 256;
+
+	// tileSize is held to the larger side of the grid; open() rejects files with a larger one
+	bool create(const std::string& path, int width, int height, int tileSize = DEFAULT_TILE_SIZE);
+	bool open(const std::string& path);
+	bool close(); // writes the directory of a created file; false if a write failed
+
+	int getWidth() const;
+	int getHeight() const;
+	int getTileSize() const;
+	int getTilesX() const;
+	int getTilesZ() const;
+
+	// A whole tile of tileSize x tileSize floats
+	bool writeTile(int tileX, int tileZ, const float* heights);
+	bool writeConstantTile(int tileX, int tileZ, float height);
+	// Rows [firstRow, firstRow + rows) of a tile, tileSize floats each; a constant tile is filled without reading
+	bool readTile(int tileX, int tileZ, float* heights, int firstRow = 0, int rows = -1) const;
+	bool isConstantTile(int tileX, int tileZ, float& height) const;
+
+	// Copies rows of tiles [firstTileRow, endTileRow) of another file of the same size, deduplicating them again
+	bool copyTiles(const TiledHeightFile& from, int firstTileRow, int endTileRow);
+
+	// Tiles by kind (every tile is one of them) and the bytes of the file
+	void countTiles(int& constant, int& duplicate, int& stored) const;
+	long long getFileBytes() const;
+
+private:
+	static const int HEADER_BYTES = 32;
+
+	struct TileEntry
+	{
+		uint64_t offset; // of the data, 0 for a constant tile
+		float height;    // of a constant tile
+		uint32_t unused;
+	};
+
+	mutable std::mutex mutex; // one position for every thread; guards the directory and blocks too
+	mutable std::fstream file;
+	int width = 0, height = 0, tileSize = 0;
+	bool writable = false, failed = false;
+	std::vector<TileEntry> directory;
+	std::unordered_multimap<uint64_t, uint64_t> blocks; // content hash to the offset of each stored tile
+	uint64_t dataEnd = 0;
+	std::vector<float> compared; // a stored tile read back to compare with one of the same hash
+
+	const TileEntry& entry(int tileX, int tileZ) const;
+	long long tileBytes() const;
+};
+
+/**
+ * HeightmapSource reading a TiledHeightFile, only the tiles of each region; nothing is kept in memory
+ */
+class TiledHeightmap : public HeightmapSource
+{
+public:
+	static std::shared_ptr<TiledHeightmap> load(const std::string& path);
+
+	int getWidth() const override;
+	int getHeight() const override;
+	void readRegion(int x, int z, int width, int height, float* out, int rowStride) const override;
+
+private:
+	TiledHeightFile file;
+};
@@ -2,16 +2,122 @@
 
 layout(location = 0) in vec3 aPos;
 
+// Shared per-frame camera data (see CameraUniforms)
+layout(std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Displacement path (see DisplacedTerrain): aPos is a vertex of an instanced grid patch and the height is sampled
+uniform bool displacement = false;
+uniform sampler2D heightMap;	// mip level l holds HeightPyramid level l
+uniform ivec2 heightMapSize;	// of the heightmap, mip levels are padded past the pyramid sizes
+uniform int heightMapLevels;
+uniform int skipSize;		// heightmap texels between control points
+uniform ivec2 controlPoints;	// control points per axis after the skip
+uniform ivec2 subdivisions;	// vertices per control segment per axis
+uniform int patchesPerRow;
+uniform int patchSize;
+uniform bool catmullRom;	// Catmull-Rom between control points, linear otherwise
 
 out vec3 Position;
 out float amplitude;
+
+// Texel of a pyramid level, clamped to the level size (the pyramid rounds odd sizes up)
+float levelHeight(ivec2 texel, int level)
+{
+	ivec2 levelSize = (heightMapSize + (1 << level) - 1) >> level;
+	return texelFetch(heightMap, clamp(texel, ivec2(0), levelSize - 1), level).r;
+}
+
+// Bilinear sample of a pyramid level at the center of the point's block, as HeightPyramid::sampleLevel
+float sampleLevel(ivec2 point, int level)
+{
+	int scale = 1 << level;
+	ivec2 levelSize = (heightMapSize + scale - 1) >> level;
+	float offset = ((skipSize - 1) * 0.5 - (scale - 1) * 0.5) / float(scale);
+	vec2 position = clamp(vec2(point) * (float(skipSize) / float(scale)) + offset, vec2(0.0), vec2(levelSize - 1));
+	ivec2 first = ivec2(position);
+	vec2 weight = position - vec2(first);
+
+	// Along z first, then x, in the order the CPU blends
+	float left = mix(levelHeight(first, level), levelHeight(ivec2(first.x, first.y + 1), level), weight.y);
+	float right = mix(levelHeight(ivec2(first.x + 1, first.y), level), levelHeight(first + 1, level), weight.y);
+	return mix(left, right, weight.x);
+}
+
+// Mean height of the point's skipSize x skipSize block, read like HeightPyramid::sampleRows so it matches the CPU mesh
+float controlHeight(ivec2 point)
+{
+	point = clamp(point, ivec2(0), controlPoints - 1);
+
+	// Finest level whose blocks are no larger than the skip size
+	int level = 0;
+	while ((2 << level) <= skipSize && level + 1 < heightMapLevels)
+		level++;
+	if ((1 << level) == skipSize)
+		return levelHeight(point, level);
+
+	// Otherwise blend both levels by the log2 distance
+	float height = sampleLevel(point, level);
+	if (level + 1 < heightMapLevels)
+		height = mix(height, sampleLevel(point, level + 1), log2(float(skipSize)) - float(level));
+	return height;
+}
+
+// Weights of p0..p3 for the segment between p1 and p2, matching Terrain::getCatMullXVertices
+vec4 curveWeights(float u, int segment, int segmentCount)
+{
+	// The first and last segments have no outer neighbour and are interpolated linearly
+	if (!catmullRom || segment == 0 || segment >= segmentCount - 1)
+		return vec4(0.0, 1.0 - u, u, 0.0);
+
+	float u2 = u * u;
+	float u3 = u2 * u;
+	return 0.5 * vec4(
+		-u + 2.0 * u2 - u3,
+		2.0 - 5.0 * u2 + 3.0 * u3,
+		u + 4.0 * u2 - 3.0 * u3,
+		-u2 + u3);
+}
+
+vec3 displacedPosition()
+{
+	// Vertex index in the refined grid, clamped so patches overhanging the edge collapse onto it
+	ivec2 patchCoord = ivec2(gl_InstanceID % patchesPerRow, gl_InstanceID / patchesPerRow);
+	ivec2 lastVertex = subdivisions * (controlPoints - 1);
+	ivec2 vertex = min(patchCoord * patchSize + ivec2(aPos.xz), lastVertex);
+
+	// Control segment and position within it
+	ivec2 segment = min(vertex / subdivisions, controlPoints - 2);
+	vec2 u = vec2(vertex - segment * subdivisions) / vec2(subdivisions);
+
+	vec4 wx = curveWeights(u.x, segment.x, controlPoints.x - 1);
+	vec4 wz = curveWeights(u.y, segment.y, controlPoints.y - 1);
+
+	// Tensor product: interpolate along x on four control rows, then along z
+	float height = 0.0;
+	for (int j = 0; j < 4; j++)
+	{
+		if (wz[j] == 0.0) continue;
+		ivec2 row = segment + ivec2(-1, j - 1);
+		vec4 h = vec4(controlHeight(row), controlHeight(row + ivec2(1, 0)), controlHeight(row + ivec2(2, 0)), controlHeight(row + ivec2(3, 0)));
+		height += wz[j] * dot(wx, h);
+	}
+
+	// Control points sit at their block centers, like the CPU mesh
+	vec2 xz = (vec2(segment) + u) * float(skipSize) + (skipSize - 1) * 0.5;
+	return vec3(xz.x, height, xz.y);
+}
+
 void main()
 {
 	amplitude = 100;
-	Position = aPos;
+	Position = displacement ? displacedPosition() : aPos;
 	Position.y *= amplitude;
-	gl_Position = projection * view * model * vec4(Position,1.0);
-}
\ No newline at end of file
+	gl_Position = viewProjection * model * vec4(Position,1.0);
+}
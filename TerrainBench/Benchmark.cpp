@@ -0,0 +1,560 @@
+// Microbenchmarks for the Terrain mesh stages (getVertices, getIndices, buildPyramid, setSkipSize, setResolution,
+// both Catmull-Rom passes and the Z pass with normals), for the procedural heightmap generator, the height filters
+// (Gaussian smoothing, 3x3 and 5x5 median, bilateral) and the height layouts (column and block reads row-major, from
+// Morton tiles and from the compressed tiles, with their encoding and decoding).
+// Runs every stage on synthetic square heightmaps, sweeping skip sizes and step sizes, and prints the results as JSON.
+// No OpenGL context is created: only Terrain.cpp and the GL-free sources it uses are linked, the GPU upload lives
+// in TerrainDraw.cpp.
+
+#include "JobSystem.h"
+#include "ProceduralHeightmap.h"
+#include "Terrain.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/* Allocation tracking: every global new is prefixed with its size so live and peak heap bytes can be followed */
+
+namespace
+{
+	const size_t ALLOC_HEADER = 16; // keeps the returned pointer aligned for any fundamental type
+
+	std::atomic<size_t> allocCount(0);
+	std::atomic<size_t> allocBytes(0);
+	std::atomic<size_t> liveBytes(0);
+	std::atomic<size_t> peakLiveBytes(0);
+
+	void* trackedAlloc(size_t size)
+	{
+		char* block = static_cast<char*>(malloc(size + ALLOC_HEADER));
+		if (!block) throw std::bad_alloc();
+		*reinterpret_cast<size_t*>(block) = size;
+
+		allocCount++;
+		allocBytes += size;
+		size_t live = liveBytes += size;
+		size_t peak = peakLiveBytes.load();
+		while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live)) {}
+
+		return block + ALLOC_HEADER;
+	}
+
+	void trackedFree(void* ptr)
+	{
+		if (!ptr) return;
+		char* block = static_cast<char*>(ptr) - ALLOC_HEADER;
+		liveBytes -= *reinterpret_cast<size_t*>(block);
+		free(block);
+	}
+}
+
+void* operator new(size_t size) { return trackedAlloc(size); }
+void* operator new[](size_t size) { return trackedAlloc(size); }
+void operator delete(void* ptr) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { trackedFree(ptr); }
+
+/* Process peak resident set size */
+
+static void resetPeakRss()
+{
+#ifdef __linux__
+	// Linux >= 4.0 resets VmHWM when "5" is written to clear_refs, giving a per-stage peak
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	if (clearRefs.is_open())
+		clearRefs << "5";
+#endif
+}
+
+static size_t peakRssBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+#ifdef __linux__
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (getline(status, line))
+	{
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+	}
+#endif
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss; // bytes on macOS
+#else
+	return usage.ru_maxrss * 1024; // kilobytes elsewhere
+#endif
+#endif
+}
+
+/* Benchmark driver */
+
+struct BenchmarkOptions
+{
+	vector<int> sizes = { 256, 512, 1024, 2048, 4096, 8192, 16384 };
+	vector<int> skipSizes = { 1, 2, 4, 8, 16 };
+	// 2, 4, 8 and 16 points per segment
+	vector<float> stepSizes = { 0.5f, 0.25f, 0.125f, 0.0625f };
+	int repeat = 3;
+	long long maxVertices = 64LL * 1024 * 1024; // configurations producing more output vertices are skipped
+	int workers = -1; // JobSystem threads besides the main one, -1 for one per extra core
+	bool pinThreads = false;
+	std::string outPath;
+};
+
+struct StageResult
+{
+	std::string stage;
+	int mapSize = 0;
+	int skipSize = 0;
+	float stepSize = 0.0f;
+	long long inputVertices = 0;
+	long long outputVertices = 0;
+	long long outputIndices = 0;
+	std::string skipped;
+
+	vector<double> timesMs;
+	size_t allocations = 0;
+	size_t allocatedBytes = 0;
+	size_t peakHeapBytes = 0;
+	size_t peakRss = 0;
+};
+
+class TerrainBenchmark
+{
+public:
+	explicit TerrainBenchmark(const BenchmarkOptions& options) : options(options) {}
+
+	void run()
+	{
+		for (int size : options.sizes)
+		{
+			if ((long long)size * size > options.maxVertices)
+			{
+				StageResult result = makeResult("getVertices", size, 1, 0.0f);
+				result.skipped = "exceeds max vertices";
+				results.push_back(result);
+				continue;
+			}
+
+			benchProcedural(size);
+
+			vector<unsigned char> heightmap = makeSyntheticHeightmap(size);
+			Terrain terrain;
+			terrain.init(heightmap.data(), size, size, 1);
+
+			benchVertices(terrain, size);
+			benchSmooth(heightmap, size);
+			benchLayout(heightmap, size);
+			benchIndices(terrain, size);
+			benchPyramid(terrain, size);
+
+			for (int skipSize : options.skipSizes)
+			{
+				if (skipSize >= size / 2) continue;
+				benchSkipSize(terrain, size, skipSize);
+				benchResolution(terrain, size, skipSize);
+
+				for (float stepSize : options.stepSizes)
+				{
+					benchCatMullX(terrain, size, skipSize, stepSize);
+					benchCatMullZ(terrain, size, skipSize, stepSize);
+					benchCatMullZ(terrain, size, skipSize, stepSize, true);
+				}
+			}
+		}
+	}
+
+	void writeJson(std::ostream& out) const
+	{
+		out << "{\n";
+		out << "  \"benchmark\": \"terrain-stages\",\n";
+		out << "  \"repeat\": " << options.repeat << ",\n";
+		out << "  \"max_vertices\": " << options.maxVertices << ",\n";
+		out << "  \"threads\": " << JobSystem::get().getThreadCount() << ",\n";
+		out << "  \"results\": [";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const StageResult& r = results[i];
+			out << (i ? ",\n" : "\n") << "    {";
+			out << "\"stage\": \"" << r.stage << "\", \"map_size\": " << r.mapSize
+				<< ", \"skip_size\": " << r.skipSize << ", \"step_size\": " << r.stepSize;
+			if (!r.skipped.empty())
+			{
+				out << ", \"skipped\": \"" << r.skipped << "\"}";
+				continue;
+			}
+
+			vector<double> times = r.timesMs;
+			sort(times.begin(), times.end());
+			double minMs = times.front();
+			double medianMs = times[times.size() / 2];
+			double seconds = minMs / 1000.0;
+
+			out << ", \"input_vertices\": " << r.inputVertices
+				<< ", \"output_vertices\": " << r.outputVertices
+				<< ", \"output_indices\": " << r.outputIndices
+				<< ", \"time_ms\": {\"min\": " << minMs << ", \"median\": " << medianMs << ", \"max\": " << times.back() << "}"
+				<< ", \"vertices_per_second\": " << (seconds > 0 ? r.outputVertices / seconds : 0.0)
+				<< ", \"indices_per_second\": " << (seconds > 0 ? r.outputIndices / seconds : 0.0)
+				<< ", \"allocations\": " << r.allocations
+				<< ", \"allocated_bytes\": " << r.allocatedBytes
+				<< ", \"peak_heap_bytes\": " << r.peakHeapBytes
+				<< ", \"peak_rss_bytes\": " << r.peakRss << "}";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+private:
+	const BenchmarkOptions& options;
+	vector<StageResult> results;
+
+	static vector<unsigned char> makeSyntheticHeightmap(int size)
+	{
+		// Rolling hills plus a little hashed noise so neighbouring texels differ
+		vector<unsigned char> heightmap(size_t(size) * size);
+		for (int z = 0; z < size; z++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				unsigned int hash = (unsigned int)(x * 73856093) ^ (unsigned int)(z * 19349663);
+				hash = (hash ^ (hash >> 13)) * 1274126177u;
+				float hills = 0.5f + 0.3f * sinf(x * 0.021f) * cosf(z * 0.017f);
+				float noise = ((hash >> 24) / 255.0f - 0.5f) * 0.2f;
+				heightmap[size_t(z) * size + x] = (unsigned char)glm::clamp((hills + noise) * 255.0f, 0.0f, 255.0f);
+			}
+		}
+		return heightmap;
+	}
+
+	static StageResult makeResult(const char* stage, int mapSize, int skipSize, float stepSize)
+	{
+		StageResult result;
+		result.stage = stage;
+		result.mapSize = mapSize;
+		result.skipSize = skipSize;
+		result.stepSize = stepSize;
+		return result;
+	}
+
+	// Runs setup (untimed) then stage (timed) options.repeat times, recording allocations and memory of the stage
+	void measure(StageResult& result, const std::function<void()>& setup, const std::function<void()>& stage)
+	{
+		for (int i = 0; i < options.repeat; i++)
+		{
+			setup();
+
+			resetPeakRss();
+			allocCount = 0;
+			allocBytes = 0;
+			peakLiveBytes = liveBytes.load();
+
+			auto start = std::chrono::steady_clock::now();
+			stage();
+			auto end = std::chrono::steady_clock::now();
+
+			result.timesMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+			result.allocations = allocCount;
+			result.allocatedBytes = allocBytes;
+			result.peakHeapBytes = peakLiveBytes;
+			result.peakRss = peakRssBytes();
+		}
+	}
+
+	static long long vertexCount(const Terrain& terrain)
+	{
+		return (long long)terrain.width * terrain.height;
+	}
+
+	static int catMullPoints(int points, float stepSize)
+	{
+		return splineSubdivisions(stepSize) * (points - 1) + 1;
+	}
+
+	void benchProcedural(int size)
+	{
+		StageResult result = makeResult("generateHeightmap", size, 1, 0.0f);
+		ProceduralHeightmap::Parameters parameters;
+		parameters.width = size;
+		parameters.height = size;
+		ProceduralHeightmap heightmap(parameters);
+		vector<float> heights(size_t(size) * size);
+
+		measure(result, [] {}, [&] { heightmap.readRegion(0, 0, size, size, heights.data(), size); });
+		result.outputVertices = (long long)size * size;
+		results.push_back(result);
+	}
+
+	void benchVertices(Terrain& terrain, int size)
+	{
+		StageResult result = makeResult("getVertices", size, 1, 0.0f);
+		measure(result,
+			[&] { terrain.vertices.clear(); terrain.vertices.shrink_to_fit(); },
+			[&] { terrain.getVertices(size, size); });
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = vertexCount(terrain);
+		results.push_back(result);
+	}
+
+	void benchSmooth(const vector<unsigned char>& heightmap, int size)
+	{
+		vector<float> original(heightmap.size()), heights;
+		for (size_t i = 0; i < heightmap.size(); i++)
+			original[i] = heightmap[i] / 255.0f;
+
+		FilterKernel kernel = FilterKernel::gaussian(1.0f);
+		benchFilter("smoothGaussian", size, original, heights, [&] { convolveSeparable(heights.data(), size, size, size, kernel); });
+		benchFilter("medianFilter3x3", size, original, heights, [&] { medianFilter(heights.data(), size, size, size, 1); });
+		benchFilter("medianFilter5x5", size, original, heights, [&] { medianFilter(heights.data(), size, size, size, 2); });
+		benchFilter("bilateralFilter", size, original, heights, [&] { bilateralFilter(heights.data(), size, size, size, 1.5f, 0.1f); });
+	}
+
+	// Column and block reads from a row-major grid against the same reads from MortonHeights tiles
+	void benchLayout(const vector<unsigned char>& heightmap, int size)
+	{
+		vector<float> rows(heightmap.size());
+		for (size_t i = 0; i < heightmap.size(); i++)
+			rows[i] = heightmap[i] / 255.0f;
+		MortonHeights tiled = MortonHeights::fromRows(rows.data(), size, size, size);
+		vector<float> out(size_t(size) * size);
+
+		benchRead("readColumnsRowMajor", size, [&]
+		{
+			for (int x = 0; x < size; x++)
+				for (int z = 0; z < size; z++)
+					out[size_t(x) * size + z] = rows[size_t(z) * size + x];
+		});
+		benchRead("readColumnsMorton", size, [&]
+		{
+			for (int x = 0; x < size; x++)
+				tiled.readColumn(x, 0, size, &out[size_t(x) * size]);
+		});
+
+		// 16 x 16 blocks visited down the columns of blocks and summed, as a 2D filter or tile mesher walks them
+		const int block = 16;
+		vector<float> blockHeights(block * block);
+		auto sumBlock = [&] { float sum = 0.0f; for (float h : blockHeights) sum += h; return sum; };
+		benchRead("readBlocksRowMajor", size, [&]
+		{
+			for (int x = 0; x + block <= size; x += block)
+				for (int z = 0; z + block <= size; z += block)
+				{
+					for (int row = 0; row < block; row++)
+						memcpy(&blockHeights[row * block], &rows[size_t(z + row) * size + x], block * sizeof(float));
+					out[size_t(z / block) * size + x / block] = sumBlock();
+				}
+		});
+		benchRead("readBlocksMorton", size, [&]
+		{
+			for (int x = 0; x + block <= size; x += block)
+				for (int z = 0; z + block <= size; z += block)
+				{
+					tiled.readBlock(x, z, block, block, blockHeights.data(), block);
+					out[size_t(z / block) * size + x / block] = sumBlock();
+				}
+		});
+
+		// The lossless tiles Terrain keeps the original heights in: encoding, whole-grid decode and the same blocks
+		CompressedHeights compressed;
+		benchRead("compressHeights", size, [&] { compressed = CompressedHeights::fromRows(rows.data(), size, size, size); });
+		benchRead("decodeHeights", size, [&] { compressed.toRows(out.data(), size); });
+		benchRead("readBlocksCompressed", size, [&]
+		{
+			for (int x = 0; x + block <= size; x += block)
+				for (int z = 0; z + block <= size; z += block)
+				{
+					compressed.readBlock(x, z, block, block, blockHeights.data(), block);
+					out[size_t(z / block) * size + x / block] = sumBlock();
+				}
+		});
+	}
+
+	void benchRead(const char* stage, int size, const std::function<void()>& read)
+	{
+		StageResult result = makeResult(stage, size, 1, 0.0f);
+		measure(result, [] {}, read);
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = (long long)size * size;
+		results.push_back(result);
+	}
+
+	// Times one in-place height filter, starting from a fresh copy of the original heights every run
+	void benchFilter(const char* stage, int size, const vector<float>& original, vector<float>& heights, const std::function<void()>& filter)
+	{
+		StageResult result = makeResult(stage, size, 1, 0.0f);
+		measure(result, [&] { heights = original; }, filter);
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = (long long)size * size;
+		results.push_back(result);
+	}
+
+	void benchIndices(Terrain& terrain, int size)
+	{
+		StageResult result = makeResult("getIndices", size, 1, 0.0f);
+		measure(result,
+			[&] { terrain.indices.clear(); terrain.indices.shrink_to_fit(); },
+			[&] { terrain.getIndices(size, size); });
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = vertexCount(terrain);
+		result.outputIndices = terrain.indices.size();
+		results.push_back(result);
+	}
+
+	void benchPyramid(Terrain& terrain, int size)
+	{
+		StageResult result = makeResult("buildPyramid", size, 1, 0.0f);
+		measure(result, [] {}, [&] { terrain.pyramid.build(MortonHeights::fromRows(&terrain.vertices[1], size, size, size * 3, 3)); });
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = (long long)size * size;
+		results.push_back(result);
+	}
+
+	void benchSkipSize(Terrain& terrain, int size, int skipSize)
+	{
+		StageResult result = makeResult("setSkipSize", size, skipSize, 0.0f);
+		measure(result, [] {}, [&] { terrain.setSkipSize(skipSize); });
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = vertexCount(terrain);
+		result.outputIndices = terrain.indices.size();
+		results.push_back(result);
+	}
+
+	// Lanczos3 resampling to the vertex count of the skip size
+	void benchResolution(Terrain& terrain, int size, int skipSize)
+	{
+		StageResult result = makeResult("setResolution", size, skipSize, 0.0f);
+		int reduced = size / skipSize;
+		measure(result, [] {}, [&] { terrain.setResolution(reduced, reduced); });
+		result.inputVertices = (long long)size * size;
+		result.outputVertices = vertexCount(terrain);
+		result.outputIndices = terrain.indices.size();
+		results.push_back(result);
+	}
+
+	void benchCatMullX(Terrain& terrain, int size, int skipSize, float stepSize)
+	{
+		StageResult result = makeResult("getCatMullXVertices", size, skipSize, stepSize);
+		int reduced = size / skipSize;
+		if ((long long)catMullPoints(reduced, stepSize) * reduced > options.maxVertices)
+		{
+			result.skipped = "exceeds max vertices";
+			results.push_back(result);
+			return;
+		}
+
+		measure(result,
+			[&] { terrain.setSkipSize(skipSize); },
+			[&] { terrain.getCatMullXVertices(stepSize); });
+		result.inputVertices = (long long)reduced * reduced;
+		result.outputVertices = vertexCount(terrain);
+		result.outputIndices = terrain.indices.size();
+		results.push_back(result);
+	}
+
+	// With normals, the X pass of the setup keeps its derivatives and the Z pass also writes the normals
+	void benchCatMullZ(Terrain& terrain, int size, int skipSize, float stepSize, bool normals = false)
+	{
+		StageResult result = makeResult(normals ? "getCatMullZNormals" : "getCatMullZVertices", size, skipSize, stepSize);
+		int reduced = size / skipSize;
+		long long refinedWidth = catMullPoints(reduced, stepSize);
+		if (refinedWidth * catMullPoints(reduced, stepSize) > options.maxVertices)
+		{
+			result.skipped = "exceeds max vertices";
+			results.push_back(result);
+			return;
+		}
+
+		terrain.setNormalsEnabled(normals);
+		measure(result,
+			[&] { terrain.setSkipSize(skipSize); terrain.getCatMullXVertices(stepSize); },
+			[&] { terrain.getCatMullZVertices(stepSize); });
+		terrain.setNormalsEnabled(false);
+		result.inputVertices = refinedWidth * reduced;
+		result.outputVertices = vertexCount(terrain);
+		result.outputIndices = terrain.indices.size();
+		results.push_back(result);
+	}
+};
+
+template <typename T>
+static vector<T> parseList(const char* text)
+{
+	vector<T> values;
+	std::stringstream stream(text);
+	std::string item;
+	while (getline(stream, item, ','))
+	{
+		std::stringstream itemStream(item);
+		T value;
+		if (itemStream >> value)
+			values.push_back(value);
+	}
+	return values;
+}
+
+static void printUsage()
+{
+	std::cerr << "Usage: TerrainBench [--sizes 256,512,...] [--skips 1,2,...] [--steps 0.5,0.25,...]\n"
+		<< "                    [--repeat N] [--max-vertices N] [--workers N] [--pin-threads] [--out results.json]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--sizes" && hasValue) options.sizes = parseList<int>(argv[++i]);
+		else if (arg == "--skips" && hasValue) options.skipSizes = parseList<int>(argv[++i]);
+		else if (arg == "--steps" && hasValue) options.stepSizes = parseList<float>(argv[++i]);
+		else if (arg == "--repeat" && hasValue) options.repeat = std::max(1, atoi(argv[++i]));
+		else if (arg == "--max-vertices" && hasValue) options.maxVertices = atoll(argv[++i]);
+		else if (arg == "--workers" && hasValue) options.workers = std::max(0, atoi(argv[++i]));
+		else if (arg == "--pin-threads") options.pinThreads = true;
+		else if (arg == "--out" && hasValue) options.outPath = argv[++i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (options.workers >= 0 || options.pinThreads)
+		JobSystem::configure(options.workers, options.pinThreads);
+
+	TerrainBenchmark benchmark(options);
+	benchmark.run();
+
+	if (options.outPath.empty())
+	{
+		benchmark.writeJson(std::cout);
+	}
+	else
+	{
+		std::ofstream out(options.outPath);
+		benchmark.writeJson(out);
+	}
+	return 0;
+}